@@ -0,0 +1,386 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cstdarg>
+#include <cstring>
+#include <string>
+
+#include <samplerate.h>
+
+#include "bench.h"
+#include "player.h"
+#include "sequence.h"
+#include "songgen.h"
+
+// same clock as OPLPlayer
+static const unsigned chipClock = 14400000;
+
+// length of the generated song
+static const unsigned songBars = 16;
+
+namespace
+{
+
+struct Result
+{
+	std::string name;
+	std::string fields; // JSON members
+};
+
+class BenchInterface : public ymfm::ymfm_interface
+{
+};
+
+// ----------------------------------------------------------------------------
+double seconds(std::chrono::steady_clock::time_point start)
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now() - start).count();
+}
+
+// ----------------------------------------------------------------------------
+// repeats 'step' (which returns the units of work it did) for the given time,
+// returns the units per second (and the time it actually took)
+template<typename F> double measure(double time, F&& step, double *elapsedTime = nullptr)
+{
+	step(); // warm up
+
+	const auto start = std::chrono::steady_clock::now();
+	double units = 0, elapsed = 0;
+	do
+	{
+		units += step();
+		elapsed = seconds(start);
+	} while (elapsed < time);
+
+	if (elapsedTime)
+		*elapsedTime = elapsed;
+	return units / elapsed;
+}
+
+// ----------------------------------------------------------------------------
+void writeChip(ymfm::ymf262& chip, uint16_t addr, uint8_t data)
+{
+	if (addr < 0x100)
+		chip.write_address((uint8_t)addr);
+	else
+		chip.write_address_hi((uint8_t)addr);
+	chip.write_data(data);
+}
+
+// ----------------------------------------------------------------------------
+// all 18 channels keyed on with a sustained tone (or 6 4op and 6 2op channels)
+void setupChip(ymfm::ymf262& chip, uint8_t waveform, bool fourOp)
+{
+	static const uint8_t opOffset[9] = { 0, 1, 2, 8, 9, 10, 16, 17, 18 };
+
+	chip.reset();
+	writeChip(chip, 0x105, 0x01);
+	writeChip(chip, 0x104, fourOp ? 0x3f : 0x00);
+
+	for (uint16_t bank = 0; bank < 0x200; bank += 0x100)
+	{
+		for (uint16_t ch = 0; ch < 9; ch++)
+		{
+			for (uint16_t op = opOffset[ch]; op <= opOffset[ch] + 3u; op += 3)
+			{
+				writeChip(chip, bank + 0x20 + op, 0x21); // sustained, multiple 1
+				writeChip(chip, bank + 0x40 + op, 0x10);
+				writeChip(chip, bank + 0x60 + op, 0xf4);
+				writeChip(chip, bank + 0x80 + op, 0x0f);
+				writeChip(chip, bank + 0xe0 + op, waveform);
+			}
+			writeChip(chip, bank + 0xc0 + ch, 0x3c); // both speakers, feedback 6
+
+			const uint16_t fnum = 0x200 + ch * 37 + bank / 8;
+			writeChip(chip, bank + 0xa0 + ch, fnum & 0xff);
+			writeChip(chip, bank + 0xb0 + ch, 0x20 | (4 << 2) | (fnum >> 8));
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+bool readFile(const char *path, std::vector<uint8_t>& data)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return false;
+
+	uint8_t buffer[4096];
+	size_t size;
+	while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		data.insert(data.end(), buffer, buffer + size);
+	fclose(file);
+	return !data.empty();
+}
+
+// ----------------------------------------------------------------------------
+std::string format(const char *fmt, ...)
+{
+	char buffer[256];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(buffer, sizeof(buffer), fmt, args);
+	va_end(args);
+	return buffer;
+}
+
+// ----------------------------------------------------------------------------
+// quoted and escaped for JSON (song names and paths can have backslashes and quotes)
+std::string jsonString(const std::string& text)
+{
+	std::string json = "\"";
+	for (char c : text)
+	{
+		if (c == '\\' || c == '"')
+			json += '\\';
+		if ((unsigned char)c < 0x20)
+			json += format("\\u%04x", c);
+		else
+			json += c;
+	}
+	return json + "\"";
+}
+
+// ----------------------------------------------------------------------------
+void benchChip(const BenchSettings& settings, std::vector<Result>& results)
+{
+	BenchInterface intf;
+	ymfm::ymf262 chip(intf);
+	const double rate = chip.sample_rate(chipClock);
+	std::vector<ymfm::ymf262::output_data> buffer(512);
+
+	for (int i = 0; i <= 8; i++)
+	{
+		const bool fourOp = (i == 8);
+		const std::string name = fourOp ? "4op" : format("2op_wave%d", i);
+		fprintf(stderr, "chip: %s\n", name.c_str());
+
+		setupChip(chip, fourOp ? 0 : (uint8_t)i, fourOp);
+		const double samples = measure(settings.seconds, [&]
+		{
+			chip.generate(buffer.data(), (uint32_t)buffer.size());
+			return (double)buffer.size();
+		});
+		results.push_back({ name, format("\"samples_per_second\": %.0f, \"realtime\": %.2f", samples, samples / rate) });
+	}
+}
+
+// ----------------------------------------------------------------------------
+// 'loadSequence' loads the song into the given player
+template<typename F> bool benchPlayer(const BenchSettings& settings, const char *section, F&& loadSequence,
+	std::vector<Result>& results)
+{
+	std::vector<float> buffer(512 * 2);
+
+	for (int chips = 1; chips <= 16; chips *= 2)
+	{
+		fprintf(stderr, "%s: %d chips\n", section, chips);
+
+		OPLPlayer player(chips);
+		if (!player.loadPatches(settings.patchPath) || !loadSequence(player))
+			return false;
+		player.setSampleRate(player.nativeSampleRate());
+		player.setLoop(true);
+
+		const double samples = measure(settings.seconds, [&]
+		{
+			player.generate(buffer.data(), 512);
+			return 512.0;
+		});
+		results.push_back({ format("%d_chips", chips), format("\"chips\": %d, \"samples_per_second\": %.0f, \"realtime\": %.2f",
+			chips, samples, samples / player.nativeSampleRate()) });
+	}
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+// numEvents/length: of the generated song (0 if unknown)
+bool benchSequence(const BenchSettings& settings, const char *name, const std::vector<uint8_t>& data,
+	unsigned numEvents, double length, std::vector<Result>& results)
+{
+	fprintf(stderr, "sequencer: %s\n", name);
+
+	const char *ext = strrchr(name, '.');
+	std::string type = ext ? ext + 1 : "";
+	for (auto& c : type)
+		c = toupper(c);
+
+	const double loads = measure(settings.seconds, [&]
+	{
+		delete Sequence::load(data.data(), data.size());
+		return 1.0;
+	});
+
+	// events are dispatched to a player (with register writes), but nothing is rendered
+	OPLPlayer player(1);
+	Sequence *seq = Sequence::load(data.data(), data.size());
+	if (!seq || !player.loadPatches(settings.patchPath))
+	{
+		delete seq;
+		return false;
+	}
+	player.setSampleRate(player.nativeSampleRate());
+
+	double songSamples = 0, elapsed = 0;
+	seq->update(player);
+	const double updates = measure(settings.seconds, [&]
+	{
+		const uint32_t samples = seq->update(player);
+		if (samples != UINT_MAX)
+			songSamples += samples;
+		return 1.0;
+	}, &elapsed);
+	delete seq;
+
+	// (song time passed during the warm up call counts too, which is negligible)
+	const double songRate = songSamples / player.nativeSampleRate() / elapsed;
+
+	std::string fields = format("\"format\": \"%s\", \"bytes\": %u, \"loads_per_second\": %.1f, \"load_mb_per_second\": %.2f, "
+		"\"updates_per_second\": %.0f, \"song_seconds_per_second\": %.1f",
+		type.c_str(), (unsigned)data.size(), loads, loads * data.size() / 1e6, updates, songRate);
+	if (numEvents && length > 0)
+		fields += format(", \"events_per_second\": %.0f", songRate * numEvents / length);
+	results.push_back({ name, fields });
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+void benchResampler(const BenchSettings& settings, std::vector<Result>& results)
+{
+	static const struct
+	{
+		int type;
+		const char *name; // as in --resampler
+	} converters[] = {
+		{ SRC_ZERO_ORDER_HOLD, "nearest" },
+		{ SRC_LINEAR, "linear" },
+		{ SRC_SINC_FASTEST, "sinc_fast" },
+		{ SRC_SINC_MEDIUM_QUALITY, "sinc_medium" },
+		{ SRC_SINC_BEST_QUALITY, "sinc_best" },
+	};
+	static const unsigned outputRates[] = { 44100, 48000 };
+
+	BenchInterface intf;
+	const unsigned inputRate = ymfm::ymf262(intf).sample_rate(chipClock);
+
+	// a block of stereo noise
+	const unsigned frames = 512;
+	std::vector<float> in(frames * 2), out((frames + 64) * 2);
+	uint32_t seed = 1;
+	for (auto& sample : in)
+	{
+		seed = seed * 1103515245 + 12345;
+		sample = (int)(seed >> 16 & 0xffff) / 65536.0f - 0.5f;
+	}
+
+	for (auto& converter : converters)
+	{
+		for (unsigned outputRate : outputRates)
+		{
+			fprintf(stderr, "resampler: %s to %u Hz\n", converter.name, outputRate);
+
+			int err = 0;
+			SRC_STATE *src = src_new(converter.type, 2, &err);
+			if (!src)
+			{
+				// e.g. not compiled into this build of libsamplerate
+				fprintf(stderr, "resampler: %s isn't available (%s), skipped\n", converter.name, src_strerror(err));
+				continue;
+			}
+
+			SRC_DATA d{};
+			d.data_in = in.data();
+			d.input_frames = frames;
+			d.data_out = out.data();
+			d.output_frames = frames + 64;
+			d.src_ratio = (double)outputRate / inputRate;
+
+			const double rate = measure(settings.seconds, [&]
+			{
+				src_process(src, &d);
+				return (double)frames;
+			});
+			src_delete(src);
+
+			results.push_back({ format("%s_%u", converter.name, outputRate), format("\"converter\": \"%s\", \"output_rate\": %u, "
+				"\"input_frames_per_second\": %.0f, \"realtime\": %.2f",
+				converter.name, outputRate, rate, rate / inputRate) });
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+void writeResults(FILE *out, const char *section, const std::vector<Result>& results, bool last = false)
+{
+	fprintf(out, "  \"%s\": [\n", section);
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		fprintf(out, "    { \"name\": %s, %s }%s\n", jsonString(results[i].name).c_str(), results[i].fields.c_str(),
+			i + 1 < results.size() ? "," : "");
+	}
+	fprintf(out, "  ]%s\n", last ? "" : ",");
+}
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+bool runBenchmarks(FILE *out, const BenchSettings& settings)
+{
+	std::vector<Result> chip, player, load, sequencer, resampler;
+
+	const std::vector<SongEvent> events = makeTestSong(songBars);
+	const std::vector<uint8_t> song = writeSong(events, SongMID);
+
+	benchChip(settings, chip);
+	if (!benchPlayer(settings, "player", [&](OPLPlayer& p) { return p.loadSequence(song.data(), song.size()); }, player))
+	{
+		fprintf(stderr, "benchmark: couldn't load the patches\n");
+		return false;
+	}
+	if (!benchPlayer(settings, "load_player", [&](OPLPlayer& p) { return p.loadSequence(settings.loadPath); }, load))
+	{
+		fprintf(stderr, "benchmark: couldn't load %s\n", settings.loadPath);
+		return false;
+	}
+
+	for (int format = 0; format < NumSongFormats; format++)
+	{
+		const std::string name = std::string("generated.") + songFormatName((SongFormat)format);
+		if (!benchSequence(settings, name.c_str(), writeSong(events, (SongFormat)format),
+			songEventCount(events), songLength(events), sequencer))
+		{
+			fprintf(stderr, "benchmark: couldn't load %s\n", name.c_str());
+			return false;
+		}
+	}
+
+	for (const char *path : settings.songs)
+	{
+		std::vector<uint8_t> data;
+		const char *name = path;
+		for (const char *c = path; *c; c++)
+		{
+			if (*c == '\\' || *c == '/')
+				name = c + 1;
+		}
+		if (!readFile(path, data) || !benchSequence(settings, name, data, 0, 0, sequencer))
+		{
+			fprintf(stderr, "benchmark: couldn't load %s\n", path);
+			return false;
+		}
+	}
+
+	benchResampler(settings, resampler);
+
+	fprintf(out, "{\n  \"seconds_per_case\": %.2f,\n", settings.seconds);
+	fprintf(out, "  \"load_path\": %s,\n", jsonString(settings.loadPath).c_str());
+	writeResults(out, "chip", chip);
+	writeResults(out, "player", player);
+	writeResults(out, "load_player", load);
+	writeResults(out, "sequencer", sequencer);
+	writeResults(out, "resampler", resampler, true);
+	fprintf(out, "}\n");
+	return true;
+}
@@ -0,0 +1,27 @@
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <cstdio>
+#include <vector>
+
+struct BenchSettings
+{
+	double seconds = 1.0;           // measuring time of each case
+	const char *patchPath = nullptr; // patches for the player and sequencer cases
+	std::vector<const char*> songs; // extra songs (any format) for the sequencer cases
+	// synthetic load for the load_player cases (see loadgen.h)
+	const char *loadPath = "//LOADGEN:notes=1000,poly=64,bend=100,cc=10,sysex=2,fourop=0.5";
+};
+
+// headless throughput benchmarks, without any audio device:
+// - chip:      ymf262::generate with all channels playing (2op in each waveform, 4op)
+// - player:    OPLPlayer rendering a generated MIDI song with 1..16 chips
+// - load_player: same with the synthetic load (a worst case for voice allocation by default)
+// - sequencer: parsing and dispatching the generated song (in each format) and the given ones
+// - resampler: each libsamplerate converter from the OPL rate to 44.1/48 kHz
+//              (converters missing from the build are skipped)
+// writes the results as JSON to 'out' and the progress to stderr.
+// returns false if a case couldn't run
+bool runBenchmarks(FILE *out, const BenchSettings& settings);
+
+#endif // __BENCH_H
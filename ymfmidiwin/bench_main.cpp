@@ -0,0 +1,99 @@
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bench.h"
+
+// standalone front end for the throughput benchmarks (same as ymfmidiwin --bench),
+// for building and running them without the Windows player:
+//   ymfmidi_bench [--seconds <n>] <out.json|-> [patch_path] [song_path...] [//LOADGEN...]
+
+// ----------------------------------------------------------------------------
+static bool hasExtension(const char *path, const char *ext)
+{
+	const char *fileext = strrchr(path, '.');
+	if (!fileext || strlen(fileext) != strlen(ext))
+		return false;
+	for (; *ext; fileext++, ext++)
+	{
+		if (tolower((unsigned char)*fileext) != *ext)
+			return false;
+	}
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+static bool isPatchFile(const char *path)
+{
+	static const char *const exts[] = { ".wopl", ".opl", ".op2", ".tmb", ".ad", ".bin", ".dll" };
+	for (const char *ext : exts)
+	{
+		if (hasExtension(path, ext))
+			return true;
+	}
+	return false;
+}
+
+// ----------------------------------------------------------------------------
+static bool isLoadPath(const char *path)
+{
+	static const char prefix[] = "//LOADGEN";
+	for (unsigned i = 0; prefix[i]; i++)
+	{
+		if (toupper((unsigned char)path[i]) != prefix[i])
+			return false;
+	}
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [--seconds <n>] <out.json|-> [patch_path] [song_path...] [//LOADGEN...]\n", name);
+}
+
+// ----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	BenchSettings settings;
+	settings.patchPath = "GENMIDI.wopl";
+
+	int arg = 1;
+	if (arg + 1 < argc && strcmp(argv[arg], "--seconds") == 0)
+	{
+		settings.seconds = atof(argv[arg + 1]);
+		arg += 2;
+	}
+	if (arg >= argc || settings.seconds <= 0)
+	{
+		usage(argv[0]);
+		return 2;
+	}
+
+	const char *outPath = argv[arg++];
+	for (; arg < argc; arg++)
+	{
+		if (isPatchFile(argv[arg]))
+			settings.patchPath = argv[arg];
+		else if (isLoadPath(argv[arg]))
+			settings.loadPath = argv[arg];
+		else
+			settings.songs.push_back(argv[arg]);
+	}
+
+	FILE *file = stdout;
+	if (strcmp(outPath, "-") != 0)
+	{
+		file = fopen(outPath, "w");
+		if (!file)
+		{
+			fprintf(stderr, "couldn't open %s\n", outPath);
+			return 1;
+		}
+	}
+	const bool ok = runBenchmarks(file, settings);
+	if (file != stdout)
+		fclose(file);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,79 @@
+#ifndef __COMMANDQUEUE_H
+#define __COMMANDQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+// bounded multiple producer / single consumer queue that never locks or allocates
+// (each slot carries a sequence number telling whose turn it is, so producers only
+// compete for the write index, see OPLPlayer::postCommand)
+template <typename T, size_t Capacity>
+class CommandQueue
+{
+	static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of 2");
+
+public:
+	CommandQueue()
+	{
+		for (size_t i = 0; i < Capacity; i++)
+			m_slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	// any thread, false if the queue is full
+	bool push(const T& item)
+	{
+		size_t pos = m_writeIndex.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Slot& slot = m_slots[pos % Capacity];
+			const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+			const ptrdiff_t diff = (ptrdiff_t)(sequence - pos);
+			if (diff == 0)
+			{
+				// the slot is free, claim it
+				if (m_writeIndex.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					slot.item = item;
+					slot.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+			{
+				// the slot still holds an item from the last time around
+				return false;
+			}
+			else
+			{
+				// another producer got there first
+				pos = m_writeIndex.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// consumer thread only, false if the queue is empty
+	bool pop(T& item)
+	{
+		Slot& slot = m_slots[m_readIndex % Capacity];
+		if (slot.sequence.load(std::memory_order_acquire) != m_readIndex + 1)
+			return false;
+
+		item = slot.item;
+		slot.sequence.store(m_readIndex + Capacity, std::memory_order_release);
+		m_readIndex++;
+		return true;
+	}
+
+private:
+	struct Slot
+	{
+		std::atomic<size_t> sequence;
+		T item;
+	};
+
+	Slot m_slots[Capacity];
+	std::atomic<size_t> m_writeIndex{ 0 };
+	size_t m_readIndex = 0;
+};
+
+#endif // __COMMANDQUEUE_H
@@ -0,0 +1,204 @@
+#ifndef __DSP_H
+#define __DSP_H
+
+#include <cstdint>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DSP_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+// block processing stages for the output chain.
+// all buffers are interleaved stereo float (full scale = +/-1.0) unless noted otherwise,
+// and all sample counts are in frames (one left + one right sample).
+namespace dsp
+{
+
+// 1-pole filter coefficients. a coefficient of 1.0 disables the stage.
+struct FilterCoefs
+{
+	float hp = 1.0f; // recursive highpass (DC blocker)
+	float lp = 1.0f; // IIR lowpass
+};
+
+struct FilterState
+{
+	float hpLastIn[2] = {0}, hpLastOut[2] = {0};
+	float lpLastOut[2] = {0};
+
+	void reset() { *this = FilterState(); }
+};
+
+// ----------------------------------------------------------------------------
+// convert mixed chip output to float and apply gain
+inline void gain(const int32_t *in, float *out, unsigned frames, float gain)
+{
+	unsigned i = 0;
+	const unsigned count = frames * 2;
+#ifdef DSP_HAVE_SSE2
+	const __m128 g = _mm_set1_ps(gain);
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128 s = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(in + i)));
+		_mm_storeu_ps(out + i, _mm_mul_ps(s, g));
+	}
+#endif
+	for (; i < count; i++)
+		out[i] = in[i] * gain;
+}
+
+// ----------------------------------------------------------------------------
+// run the enabled filter stages over a block.
+// the per-channel state stays in locals for the whole block, and disabled stages
+// are removed at compile time instead of being tested for every sample
+template<bool HP, bool LP>
+void filterBlock(float *data, unsigned frames, const FilterCoefs& coefs, FilterState& state)
+{
+	const float hp = coefs.hp;
+	const float lp = coefs.lp, lpInv = 1.0f - coefs.lp;
+
+	float hpInL = state.hpLastIn[0], hpInR = state.hpLastIn[1];
+	float hpOutL = state.hpLastOut[0], hpOutR = state.hpLastOut[1];
+	float lpOutL = state.lpLastOut[0], lpOutR = state.lpLastOut[1];
+
+	for (unsigned i = 0; i < frames; i++)
+	{
+		float l = data[i*2];
+		float r = data[i*2+1];
+
+		if (HP)
+		{
+			hpOutL = hp * (hpOutL + l - hpInL);
+			hpOutR = hp * (hpOutR + r - hpInR);
+			hpInL = l;
+			hpInR = r;
+			l = hpOutL;
+			r = hpOutR;
+		}
+		if (LP)
+		{
+			lpOutL = lp * l + lpInv * lpOutL;
+			lpOutR = lp * r + lpInv * lpOutR;
+			l = lpOutL;
+			r = lpOutR;
+		}
+
+		data[i*2]   = l;
+		data[i*2+1] = r;
+	}
+
+	state.hpLastIn[0] = hpInL;   state.hpLastIn[1] = hpInR;
+	state.hpLastOut[0] = hpOutL; state.hpLastOut[1] = hpOutR;
+	state.lpLastOut[0] = lpOutL; state.lpLastOut[1] = lpOutR;
+}
+
+// ----------------------------------------------------------------------------
+inline void filter(float *data, unsigned frames, const FilterCoefs& coefs, FilterState& state)
+{
+	const bool hp = coefs.hp < 1.0f;
+	const bool lp = coefs.lp < 1.0f;
+
+	if (hp && lp)
+		filterBlock<true, true>(data, frames, coefs, state);
+	else if (hp)
+		filterBlock<true, false>(data, frames, coefs, state);
+	else if (lp)
+		filterBlock<false, true>(data, frames, coefs, state);
+}
+
+// ----------------------------------------------------------------------------
+// triangular PDF dither, +/-1 LSB peak
+class Dither
+{
+public:
+	explicit Dither(uint32_t seed = 0x12345678) : m_state(seed ? seed : 1) {}
+
+	// returns a value in the range (-1.0, 1.0) LSB
+	float next()
+	{
+		return uniform() - uniform();
+	}
+
+private:
+	float uniform()
+	{
+		// xorshift32
+		m_state ^= m_state << 13;
+		m_state ^= m_state >> 17;
+		m_state ^= m_state << 5;
+		return (m_state >> 8) * (1.0f / 16777216.0f);
+	}
+
+	uint32_t m_state;
+};
+
+// ----------------------------------------------------------------------------
+template<bool DITHER>
+void toInt16Block(const float *in, int16_t *out, unsigned count, Dither *dither)
+{
+	unsigned i = 0;
+#ifdef DSP_HAVE_SSE2
+	if (!DITHER)
+	{
+		const __m128 scale = _mm_set1_ps(32767.0f);
+		for (; i + 8 <= count; i += 8)
+		{
+			// cvtps rounds to nearest, packs saturates to int16
+			const __m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i), scale));
+			const __m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale));
+			_mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(a, b));
+		}
+	}
+#endif
+	for (; i < count; i++)
+	{
+		float f = in[i] * 32767.0f;
+		if (DITHER)
+			f += dither->next();
+		if (f < -32768.0f) f = -32768.0f;
+		if (f > +32767.0f) f = +32767.0f;
+		out[i] = (int16_t)lrintf(f);
+	}
+}
+
+// ----------------------------------------------------------------------------
+template<bool DITHER>
+void toInt24Block(const float *in, uint8_t *out, unsigned count, Dither *dither)
+{
+	for (unsigned i = 0; i < count; i++)
+	{
+		float f = in[i] * 8388607.0f;
+		if (DITHER)
+			f += dither->next();
+		if (f < -8388608.0f) f = -8388608.0f;
+		if (f > +8388607.0f) f = +8388607.0f;
+		const int32_t s = lrintf(f);
+		out[i*3]   = (uint8_t)(s);
+		out[i*3+1] = (uint8_t)(s >> 8);
+		out[i*3+2] = (uint8_t)(s >> 16);
+	}
+}
+
+// ----------------------------------------------------------------------------
+// convert 'count' float samples to 16-bit or packed little-endian 24-bit PCM.
+// if 'dither' is non-null, TPDF dither is added before quantization
+inline void toInt16(const float *in, int16_t *out, unsigned count, Dither *dither = nullptr)
+{
+	if (dither)
+		toInt16Block<true>(in, out, count, dither);
+	else
+		toInt16Block<false>(in, out, count, nullptr);
+}
+
+inline void toInt24(const float *in, uint8_t *out, unsigned count, Dither *dither = nullptr)
+{
+	if (dither)
+		toInt24Block<true>(in, out, count, dither);
+	else
+		toInt24Block<false>(in, out, count, nullptr);
+}
+
+}
+
+#endif // __DSP_H
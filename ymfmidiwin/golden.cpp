@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "golden.h"
+#include "player.h"
+#include "songgen.h"
+
+// rendered length of each case (the generated song plays for 4 seconds, then notes are held)
+static const double renderSeconds = 3.0;
+static const unsigned songBars = 2;
+
+namespace
+{
+
+struct GoldenCase
+{
+	const char *name;
+	SongFormat format;
+	const char *patches;
+	int chips;
+	OPLPlayer::ChipType type;
+	unsigned rate; // 0 = native
+	bool drumCache;
+	unsigned voiceReduction; // free voices (0 = off)
+};
+
+const GoldenCase goldenCases[] =
+{
+	// every song format
+	{ "mid_opl3",          SongMID, "GENMIDI.wopl", 1, OPLPlayer::ChipOPL3, 0, false, 0 },
+	{ "xmi_opl3",          SongXMI, "GENMIDI.wopl", 1, OPLPlayer::ChipOPL3, 0, false, 0 },
+	{ "mus_opl3",          SongMUS, "GENMIDI.op2",  1, OPLPlayer::ChipOPL3, 0, false, 0 },
+	{ "hmi_opl3",          SongHMI, "GENMIDI.wopl", 1, OPLPlayer::ChipOPL3, 0, false, 0 },
+	{ "hmp_opl3",          SongHMP, "GENMIDI.wopl", 1, OPLPlayer::ChipOPL3, 0, false, 0 },
+	// chip types and counts
+	{ "mid_opl3_2chips",   SongMID, "GENMIDI.wopl", 2, OPLPlayer::ChipOPL3, 0, false, 0 },
+	{ "mid_opl3_4chips",   SongMID, "GENMIDI.wopl", 4, OPLPlayer::ChipOPL3, 0, false, 0 },
+	{ "mid_opl2",          SongMID, "GENMIDI.wopl", 1, OPLPlayer::ChipOPL2, 0, false, 0 },
+	{ "mid_opl2_2chips",   SongMID, "GENMIDI.wopl", 2, OPLPlayer::ChipOPL2, 0, false, 0 },
+	{ "mid_opl",           SongMID, "GENMIDI.wopl", 1, OPLPlayer::ChipOPL,  0, false, 0 },
+	// the other banks
+	{ "mid_bank_gs",       SongMID, "GENMIDI(GS).wopl",         1, OPLPlayer::ChipOPL3, 0, false, 0 },
+	{ "mid_bank_xg",       SongMID, "GENMIDI(XG).wopl",         1, OPLPlayer::ChipOPL3, 0, false, 0 },
+	{ "mid_bank_kirby",    SongMID, "GENMIDI(Kirby test).wopl", 1, OPLPlayer::ChipOPL3, 0, false, 0 },
+	{ "mid_bank_op2",      SongMID, "GENMIDI.op2",              1, OPLPlayer::ChipOPL3, 0, false, 0 },
+	{ "mid_bank_vanilla",  SongMID, "GENMIDI - Vanilla.op2",    1, OPLPlayer::ChipOPL3, 0, false, 0 },
+	// the internal downsampler, the drum cache and the voice reduction
+	{ "mid_opl3_44k",      SongMID, "GENMIDI.wopl", 1, OPLPlayer::ChipOPL3, 44100, false, 0 },
+	{ "mid_opl3_drumcache", SongMID, "GENMIDI.wopl", 1, OPLPlayer::ChipOPL3, 0, true, 0 },
+	{ "mid_opl3_reduce",   SongMID, "GENMIDI.wopl", 1, OPLPlayer::ChipOPL3, 0, false, 12 },
+};
+
+struct RegWrite
+{
+	uint32_t frame; // output sample it happened before
+	uint8_t chip;
+	uint8_t data;
+	uint16_t addr;
+};
+
+struct GoldenHeader
+{
+	char magic[8];
+	uint32_t rawFrames, outFrames, numWrites, reserved;
+	uint64_t rawHash, outHash, writeHash;
+};
+
+const char goldenMagic[8] = { 'Y', 'M', 'F', 'G', 'O', 'L', 'D', '1' };
+
+// everything one case produced
+struct Render : public OPLTap
+{
+	std::vector<int32_t> raw; // stereo, native rate only
+	std::vector<float> out;   // stereo
+	std::vector<RegWrite> writes;
+	uint32_t frame = 0;
+	uint32_t rawRate = 0, outRate = 0; // sample rates of the two streams
+
+	void regWrite(int chip, uint16_t addr, uint8_t data)
+	{
+		writes.push_back({ frame, (uint8_t)chip, data, addr });
+	}
+	void chipOutput(const int32_t *data, unsigned numSamples)
+	{
+		raw.insert(raw.end(), data, data + numSamples * 2);
+		frame += numSamples;
+	}
+};
+
+// ----------------------------------------------------------------------------
+// FNV-1a
+uint64_t hash(const void *data, size_t size)
+{
+	const uint8_t *bytes = (const uint8_t*)data;
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < size; i++)
+		h = (h ^ bytes[i]) * 0x100000001b3ull;
+	return h;
+}
+
+// ----------------------------------------------------------------------------
+bool render(const GoldenCase& c, const char *patchDir, Render& result)
+{
+	OPLPlayer player(c.chips, c.type);
+	player.setTap(&result);
+
+	const std::string patchPath = std::string(patchDir) + "/" + c.patches;
+	const std::vector<uint8_t> song = writeSong(makeTestSong(songBars), c.format);
+	if (!player.loadPatches(patchPath.c_str()) || !player.loadSequence(song.data(), song.size()))
+	{
+		printf("%s: couldn't load %s\n", c.name, patchPath.c_str());
+		return false;
+	}
+	player.setLoop(false);
+	player.setSampleRate(c.rate ? c.rate : player.nativeSampleRate());
+	player.setDrumCache(c.drumCache, false);
+	player.setVoiceReduction(c.voiceReduction);
+	result.rawRate = player.nativeSampleRate();
+	result.outRate = player.sampleRate();
+
+	const unsigned frames = (unsigned)(renderSeconds * player.sampleRate());
+	result.out.resize(frames * 2);
+	for (unsigned pos = 0; pos < frames; pos += 512)
+	{
+		// (at the native rate the tap keeps the exact position)
+		if (c.rate)
+			result.frame = pos;
+		player.generate(&result.out[pos * 2], std::min(512u, frames - pos));
+	}
+	player.setTap(nullptr);
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+GoldenHeader makeHeader(const Render& r)
+{
+	GoldenHeader header = {};
+	memcpy(header.magic, goldenMagic, sizeof(goldenMagic));
+	header.rawFrames = (uint32_t)r.raw.size() / 2;
+	header.outFrames = (uint32_t)r.out.size() / 2;
+	header.numWrites = (uint32_t)r.writes.size();
+	header.rawHash = hash(r.raw.data(), r.raw.size() * sizeof(int32_t));
+	header.outHash = hash(r.out.data(), r.out.size() * sizeof(float));
+	header.writeHash = hash(r.writes.data(), r.writes.size() * sizeof(RegWrite));
+	return header;
+}
+
+// ----------------------------------------------------------------------------
+bool save(const std::string& path, const Render& r)
+{
+	FILE *file = fopen(path.c_str(), "wb");
+	if (!file)
+		return false;
+
+	const GoldenHeader header = makeHeader(r);
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ok &= fwrite(r.raw.data(), sizeof(int32_t), r.raw.size(), file) == r.raw.size();
+	ok &= fwrite(r.out.data(), sizeof(float), r.out.size(), file) == r.out.size();
+	ok &= fwrite(r.writes.data(), sizeof(RegWrite), r.writes.size(), file) == r.writes.size();
+	fclose(file);
+	return ok;
+}
+
+// ----------------------------------------------------------------------------
+bool load(const std::string& path, GoldenHeader& header, Render& r)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file)
+		return false;
+
+	bool ok = fread(&header, sizeof(header), 1, file) == 1
+		&& !memcmp(header.magic, goldenMagic, sizeof(goldenMagic));
+	if (ok)
+	{
+		r.raw.resize(header.rawFrames * 2);
+		r.out.resize(header.outFrames * 2);
+		r.writes.resize(header.numWrites);
+		ok = fread(r.raw.data(), sizeof(int32_t), r.raw.size(), file) == r.raw.size()
+			&& fread(r.out.data(), sizeof(float), r.out.size(), file) == r.out.size()
+			&& fread(r.writes.data(), sizeof(RegWrite), r.writes.size(), file) == r.writes.size();
+	}
+	fclose(file);
+	return ok;
+}
+
+// ----------------------------------------------------------------------------
+// index of the first different element (or of the end of the shorter one), -1 if equal
+template<typename T> long long firstDifference(const std::vector<T>& a, const std::vector<T>& b)
+{
+	const size_t size = std::min(a.size(), b.size());
+	for (size_t i = 0; i < size; i++)
+	{
+		if (memcmp(&a[i], &b[i], sizeof(T)))
+			return (long long)i;
+	}
+	return a.size() == b.size() ? -1 : (long long)size;
+}
+
+// ----------------------------------------------------------------------------
+std::string describe(const std::vector<RegWrite>& writes, size_t i)
+{
+	if (i >= writes.size())
+		return "(none)";
+	char text[64];
+	snprintf(text, sizeof(text), "frame %u chip %u reg %03x = %02x",
+		writes[i].frame, writes[i].chip, writes[i].addr, writes[i].data);
+	return text;
+}
+
+// ----------------------------------------------------------------------------
+// prints where 'got' diverges from 'expected', returns false if it does
+bool compare(const GoldenCase& c, const Render& expected, const Render& got)
+{
+	const double rawRate = got.rawRate, outRate = got.outRate;
+	bool same = true;
+	static const char *side[2] = { "left", "right" };
+
+	const long long raw = firstDifference(expected.raw, got.raw);
+	if (raw >= 0)
+	{
+		same = false;
+		printf("%s: chip output differs from frame %lld (%.4f s, %s)", c.name, raw / 2, raw / 2 / rawRate, side[raw & 1]);
+		if ((size_t)raw < expected.raw.size() && (size_t)raw < got.raw.size())
+			printf(": expected %d, got %d\n", expected.raw[raw], got.raw[raw]);
+		else
+			printf(": expected %u frames, got %u\n", (unsigned)expected.raw.size() / 2, (unsigned)got.raw.size() / 2);
+	}
+
+	const long long out = firstDifference(expected.out, got.out);
+	if (out >= 0)
+	{
+		same = false;
+		printf("%s: output differs from frame %lld (%.4f s, %s)", c.name, out / 2, out / 2 / outRate, side[out & 1]);
+		if ((size_t)out < expected.out.size() && (size_t)out < got.out.size())
+			printf(": expected %.9g, got %.9g\n", expected.out[out], got.out[out]);
+		else
+			printf(": expected %u frames, got %u\n", (unsigned)expected.out.size() / 2, (unsigned)got.out.size() / 2);
+	}
+
+	const long long write = firstDifference(expected.writes, got.writes);
+	if (write >= 0)
+	{
+		same = false;
+		printf("%s: register writes differ from #%lld (of %u, now %u):\n", c.name, write,
+			(unsigned)expected.writes.size(), (unsigned)got.writes.size());
+		for (size_t i = (size_t)write; i < (size_t)write + 4; i++)
+		{
+			printf("  expected %-36s got %s\n",
+				describe(expected.writes, i).c_str(), describe(got.writes, i).c_str());
+		}
+	}
+
+	return same;
+}
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+bool runGoldenTests(const char *goldenDir, const char *patchDir, bool update)
+{
+	const std::string dir = goldenDir;
+	unsigned failed = 0;
+
+	FILE *summary = nullptr;
+	if (update && !(summary = fopen((dir + "/golden.txt").c_str(), "w")))
+	{
+		printf("couldn't write to %s\n", goldenDir);
+		return false;
+	}
+
+	for (auto& c : goldenCases)
+	{
+		const std::string path = dir + "/" + c.name + ".golden";
+
+		Render got;
+		if (!render(c, patchDir, got))
+		{
+			failed++;
+			continue;
+		}
+		const GoldenHeader header = makeHeader(got);
+
+		if (update)
+		{
+			if (!save(path, got))
+			{
+				printf("%s: couldn't write %s\n", c.name, path.c_str());
+				failed++;
+				continue;
+			}
+			fprintf(summary, "%-20s chip %016llx  out %016llx  writes %6u %016llx\n", c.name,
+				(unsigned long long)header.rawHash, (unsigned long long)header.outHash,
+				header.numWrites, (unsigned long long)header.writeHash);
+			printf("%s: written\n", c.name);
+			continue;
+		}
+
+		GoldenHeader stored;
+		Render expected;
+		if (!load(path, stored, expected))
+		{
+			printf("%s: couldn't read %s\n", c.name, path.c_str());
+			failed++;
+			continue;
+		}
+
+		const GoldenHeader expectedHeader = makeHeader(expected);
+		if (expectedHeader.rawHash != stored.rawHash || expectedHeader.outHash != stored.outHash
+			|| expectedHeader.writeHash != stored.writeHash)
+		{
+			printf("%s: %s doesn't match its own hashes (damaged?)\n", c.name, path.c_str());
+			failed++;
+			continue;
+		}
+
+		if (!memcmp(&expectedHeader, &header, sizeof(header)))
+			printf("%s: ok\n", c.name);
+		else if (!compare(c, expected, got))
+			failed++;
+	}
+
+	if (summary)
+		fclose(summary);
+
+	const unsigned numCases = sizeof(goldenCases) / sizeof(goldenCases[0]);
+	printf("%u of %u cases %s\n", numCases - failed, numCases, update ? "written" : "passed");
+	return failed == 0;
+}
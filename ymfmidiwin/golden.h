@@ -0,0 +1,16 @@
+#ifndef __GOLDEN_H
+#define __GOLDEN_H
+
+// golden output regression tests: a fixed set of cases (generated songs in every supported
+// format, against the bundled patch banks, with several chip types and counts) is rendered and
+// compared bit for bit with reference renders made earlier by the same function.
+// each case records the mixed chip output (before gain and filters), the final output and
+// every register write; differences are reported at the first divergent sample / write.
+//
+// goldenDir: one <case>.golden file per case plus a golden.txt summary of the hashes
+// patchDir:  the DMXOPL directory
+// update:    write the reference renders instead of checking against them
+// prints the results, returns false if anything differs or a case couldn't run
+bool runGoldenTests(const char *goldenDir, const char *patchDir, bool update);
+
+#endif // __GOLDEN_H
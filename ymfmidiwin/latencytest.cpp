@@ -0,0 +1,383 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include <samplerate.h>
+
+#include "latencytest.h"
+#include "midiin.h"
+#include "player.h"
+
+// onset detection: a note starts where the output first exceeds onsetLevel,
+// after having stayed below quietLevel for at least quietTime
+static const float onsetLevel = 0.01f;  // -40 dBFS
+static const float quietLevel = 0.002f; // -54 dBFS
+static const unsigned quietTime = 10;   // msec
+
+// the shared mode device period (WASAPI default)
+static const unsigned devicePeriod = 10; // msec
+
+namespace
+{
+
+class LatencySimulation
+{
+public:
+	LatencySimulation(OPLPlayer *player, const LatencyTestSettings& settings, MidiInLoopback *input);
+	~LatencySimulation();
+
+	bool run();
+	void report() const;
+
+private:
+	struct Note
+	{
+		int64_t sent;  // device clock (frames)
+		int64_t heard; // -1 if not found
+	};
+
+	void sendMIDI(int64_t now);
+	void advanceDevice(int64_t now);
+	void render(int64_t now, bool waited);
+	void writeDevice(int64_t now);
+	void detectOnsets(const float *data, unsigned frames, int64_t playTime);
+
+	OPLPlayer *m_player;
+	LatencyTestSettings m_settings;
+	MidiInLoopback *m_input;
+	SRC_STATE *m_src = nullptr;
+	double m_ratio;
+
+	// the render loop (same as StartWasapiAudio)
+	std::vector<float> m_fifo, m_in, m_out;
+	unsigned m_fifoFrames, m_inBufferFrames, m_outBufferFrames;
+	bool m_sleeping = false;
+
+	// the simulated device
+	bool m_running = true;
+	int64_t m_written = 0, m_played = 0;
+	int64_t m_lastTime = 0;
+	int64_t m_nextTick = 0;
+	unsigned m_underruns = 0;
+	unsigned m_sleeps = 0;
+
+	// MIDI input (a note-off follows each note-on after 100 ms)
+	std::vector<Note> m_notes;
+	unsigned m_nextSend = 0;
+	bool m_noteOffPending = false;
+
+	// onset detector
+	bool m_armed = false;
+	unsigned m_quietCount = 0;
+	unsigned m_spurious = 0;
+};
+
+// ----------------------------------------------------------------------------
+LatencySimulation::LatencySimulation(OPLPlayer *player, const LatencyTestSettings& settings, MidiInLoopback *input)
+	: m_player(player)
+	, m_settings(settings)
+	, m_input(input)
+{
+	int err = 0;
+	m_src = src_new(settings.resampler, 2, &err);
+	m_ratio = (double)settings.outputRate / player->sampleRate();
+
+	m_fifoFrames = settings.bufferFrames;
+	m_inBufferFrames = (unsigned)(m_fifoFrames / m_ratio);
+	m_outBufferFrames = m_fifoFrames + 64;
+	m_fifo.reserve(m_fifoFrames * 2);
+	m_in.resize(m_inBufferFrames * 2);
+	m_out.resize(m_outBufferFrames * 2);
+
+	// random spacing so that the notes hit every phase of the device period and render blocks
+	// (fixed seed, every run sends the same notes)
+	const int64_t rate = settings.outputRate;
+	uint32_t seed = 12345;
+	int64_t time = rate / 2;
+	for (unsigned i = 0; i < settings.numNotes; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		m_notes.push_back({ time, -1 });
+		time += rate / 4 + (int64_t)((seed >> 8) % (rate / 4));
+	}
+}
+
+// ----------------------------------------------------------------------------
+LatencySimulation::~LatencySimulation()
+{
+	if (m_src)
+		src_delete(m_src);
+}
+
+// ----------------------------------------------------------------------------
+bool LatencySimulation::run()
+{
+	if (!m_src || !m_inBufferFrames)
+		return false;
+
+	const int64_t rate = m_settings.outputRate;
+	const int64_t period = std::max<int64_t>(rate * devicePeriod / 1000, 1);
+	const int64_t end = m_notes.empty() ? 0 : m_notes.back().sent + rate;
+
+	// start with the buffer filled, as after opening the device
+	render(0, false);
+
+	int64_t now = 0;
+	while (now < end)
+	{
+		// the next thing to happen: a device period elapsing (while it runs) or MIDI input
+		int64_t next = m_running ? m_nextTick : end;
+		if (m_nextSend < m_notes.size())
+		{
+			const Note& note = m_notes[m_nextSend];
+			const int64_t sendTime = m_noteOffPending ? note.sent + rate / 10 : note.sent;
+			next = std::min(next, sendTime);
+		}
+		now = next;
+
+		advanceDevice(now);
+		sendMIDI(now);
+
+		if (m_sleeping)
+		{
+			// the render thread waits for MIDI input
+			if (m_input->getMessageCount())
+				render(now, false);
+		}
+		else if (now == m_nextTick)
+		{
+			m_nextTick += period;
+			render(now, true);
+		}
+
+		if (!m_running)
+			m_nextTick = now + period;
+	}
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+void LatencySimulation::sendMIDI(int64_t now)
+{
+	while (m_nextSend < m_notes.size())
+	{
+		const Note& note = m_notes[m_nextSend];
+		const int64_t sendTime = m_noteOffPending ? note.sent + m_settings.outputRate / 10 : note.sent;
+		if (sendTime > now)
+			break;
+
+		const uint32_t timestamp = (uint32_t)(sendTime * 1000000 / m_settings.outputRate);
+		const uint8_t noteOn[] = { 0x90, 60, 127 };
+		// (with all sound off first, the next onset is only found after silence)
+		const uint8_t noteOff[] = { 0xb0, 120, 0, 0x80, 60, 0 };
+		if (m_noteOffPending)
+		{
+			m_input->send(noteOff, sizeof(noteOff), timestamp);
+			m_nextSend++;
+		}
+		else
+		{
+			m_input->send(noteOn, sizeof(noteOn), timestamp);
+		}
+		m_noteOffPending ^= true;
+	}
+}
+
+// ----------------------------------------------------------------------------
+void LatencySimulation::advanceDevice(int64_t now)
+{
+	if (m_running)
+	{
+		const int64_t elapsed = now - m_lastTime;
+		if (elapsed > m_written - m_played && !m_sleeping)
+			m_underruns++; // ran dry, the device plays silence until there's more
+		m_played = std::min(m_written, m_played + elapsed);
+	}
+	m_lastTime = now;
+}
+
+// ----------------------------------------------------------------------------
+void LatencySimulation::render(int64_t now, bool waited)
+{
+	for (;;)
+	{
+		if (!waited)
+		{
+			const int sampleremain = (int)m_fifoFrames - (int)(m_fifo.size() / 2);
+			if (sampleremain > 0)
+			{
+				const unsigned samples = std::min<unsigned>(m_inBufferFrames, sampleremain);
+				m_player->generate(m_in.data(), samples);
+
+				if (m_player->isSleepMode())
+				{
+					if (!m_sleeping)
+					{
+						// the device is stopped, the FIFO mostly filled for a quick restart
+						m_sleeping = true;
+						m_running = false;
+						m_sleeps++;
+						m_fifo.assign(m_fifoFrames * 2 * 19 / 20, 0);
+					}
+					return;
+				}
+
+				if (m_sleeping)
+				{
+					// restart the device with a buffer of silence
+					m_sleeping = false;
+					m_running = true;
+					m_played = m_written;
+					m_lastTime = now;
+					m_nextTick = now + std::max<int64_t>(m_settings.outputRate * devicePeriod / 1000, 1);
+
+					static const float silence[2] = { 0, 0 };
+					for (unsigned i = 0; i < m_settings.bufferFrames; i++)
+						detectOnsets(silence, 1, now + i);
+					m_written += m_settings.bufferFrames;
+				}
+
+				SRC_DATA d{};
+				d.data_in = m_in.data();
+				d.input_frames = samples;
+				d.data_out = m_out.data();
+				d.output_frames = m_outBufferFrames;
+				d.src_ratio = m_ratio;
+				src_process(m_src, &d);
+
+				m_fifo.insert(m_fifo.end(), m_out.data(), m_out.data() + d.output_frames_gen * 2);
+			}
+
+			if (m_sleeping)
+				return;
+
+			// wait for the next period unless half the buffer is free
+			if (m_settings.bufferFrames - (m_written - m_played) < m_settings.bufferFrames / 2)
+				return;
+		}
+		waited = false;
+
+		const unsigned before = (unsigned)(m_fifo.size() / 2);
+		writeDevice(now);
+		if (before && m_fifo.size() / 2 == before)
+			return;
+	}
+}
+
+// ----------------------------------------------------------------------------
+void LatencySimulation::writeDevice(int64_t now)
+{
+	const int64_t padding = m_written - m_played;
+	const int64_t available = m_settings.bufferFrames - padding;
+	const unsigned frames = (unsigned)std::min<int64_t>(available, m_fifo.size() / 2);
+	if (!frames)
+		return;
+
+	// with the device running steadily, whatever is written now is heard after what's queued
+	detectOnsets(m_fifo.data(), frames, now + padding);
+	m_written += frames;
+	m_fifo.erase(m_fifo.begin(), m_fifo.begin() + frames * 2);
+}
+
+// ----------------------------------------------------------------------------
+void LatencySimulation::detectOnsets(const float *data, unsigned frames, int64_t playTime)
+{
+	const unsigned quietFrames = m_settings.outputRate * quietTime / 1000;
+
+	for (unsigned i = 0; i < frames; i++)
+	{
+		const float level = std::max(fabsf(data[i * 2]), fabsf(data[i * 2 + 1]));
+		if (level < quietLevel)
+		{
+			if (++m_quietCount >= quietFrames)
+				m_armed = true;
+			continue;
+		}
+		m_quietCount = 0;
+
+		if (!m_armed || level < onsetLevel)
+			continue;
+		m_armed = false;
+
+		// the latest note sent before this is the one being heard
+		const int64_t heard = playTime + i;
+		Note *note = nullptr;
+		for (auto& n : m_notes)
+		{
+			if (n.sent > heard)
+				break;
+			note = &n;
+		}
+		if (note && note->heard < 0)
+			note->heard = heard;
+		else
+			m_spurious++;
+	}
+}
+
+// ----------------------------------------------------------------------------
+void LatencySimulation::report() const
+{
+	const double msec = 1000.0 / m_settings.outputRate;
+
+	std::vector<double> latency;
+	for (auto& note : m_notes)
+	{
+		if (note.heard >= 0)
+			latency.push_back((note.heard - note.sent) * msec);
+	}
+	std::sort(latency.begin(), latency.end());
+
+	printf("device: %u Hz, buffer %u frames (%.1f ms), period %u ms, resampler %s\n",
+		m_settings.outputRate, m_settings.bufferFrames, m_settings.bufferFrames * msec,
+		devicePeriod, src_get_name(m_settings.resampler));
+	printf("notes:  %u sent, %u heard, %u spurious onsets, %u underruns, %u sleeps\n",
+		(unsigned)m_notes.size(), (unsigned)latency.size(), m_spurious, m_underruns, m_sleeps);
+	if (latency.empty())
+		return;
+
+	auto percentile = [&](double p)
+	{
+		return latency[std::min(latency.size() - 1, (size_t)(p / 100 * latency.size()))];
+	};
+
+	double mean = 0, variance = 0;
+	for (double l : latency)
+		mean += l;
+	mean /= latency.size();
+	for (double l : latency)
+		variance += (l - mean) * (l - mean);
+	variance /= latency.size();
+
+	printf("latency (ms): min %.2f  p50 %.2f  p90 %.2f  p99 %.2f  max %.2f  mean %.2f\n",
+		latency.front(), percentile(50), percentile(90), percentile(99), latency.back(), mean);
+	printf("jitter (ms):  stddev %.2f  p99-p1 %.2f  max-min %.2f\n",
+		sqrt(variance), percentile(99) - percentile(1), latency.back() - latency.front());
+}
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+bool runLatencyTest(OPLPlayer *player, const LatencyTestSettings& settings)
+{
+	MidiInLoopback *input = MidiInLoopback::find(0);
+	if (!input)
+	{
+		fprintf(stderr, "latency test: loopback MIDI input isn't open\n");
+		return false;
+	}
+
+	// the player renders at the chip's rate and the resampler converts, as in the WASAPI loop
+	player->setSampleRate(player->nativeSampleRate());
+	player->reset();
+
+	LatencySimulation sim(player, settings, input);
+	if (!sim.run())
+	{
+		fprintf(stderr, "latency test: couldn't set up the simulated device\n");
+		return false;
+	}
+	sim.report();
+	return true;
+}
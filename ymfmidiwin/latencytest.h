@@ -0,0 +1,24 @@
+#ifndef __LATENCYTEST_H
+#define __LATENCYTEST_H
+
+#include <cstdint>
+
+class OPLPlayer;
+
+struct LatencyTestSettings
+{
+	unsigned numNotes = 100;
+	uint32_t outputRate = 44100;  // rate of the simulated audio device
+	uint32_t bufferFrames = 4410; // device buffer size (frames at outputRate)
+	int resampler = 0;            // libsamplerate converter type
+};
+
+// measure the MIDI IN to audio latency without any real device:
+// note-ons are sent through the "loopback" MIDI input with known timestamps, the output goes
+// through the same buffering as the WASAPI loop, but paced by a simulated device clock,
+// and the time each note is heard is found by onset detection on the device output.
+// the player must have loaded "//MIDIIN:loopback"; its auto suspend time decides whether
+// sleep mode is entered between notes. prints a report, returns false if the test couldn't run
+bool runLatencyTest(OPLPlayer *player, const LatencyTestSettings& settings);
+
+#endif // __LATENCYTEST_H
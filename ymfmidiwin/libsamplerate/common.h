@@ -16,7 +16,9 @@
 
 #define ENABLE_SINC_FAST_CONVERTER
 #define ENABLE_SINC_MEDIUM_CONVERTER
+#ifndef SRC_NO_BEST_CONVERTER
 #define ENABLE_SINC_BEST_CONVERTER
+#endif
 
 #if defined(__x86_64__) || defined(_M_X64)
 #   define HAVE_SSE2_INTRINSICS
@@ -48,6 +50,11 @@
 #endif
 #endif /* HAVE_SSE2_INTRINSICS */
 
+#if defined(__aarch64__) || defined(_M_ARM64)
+#   define HAVE_NEON_INTRINSICS
+#   include <arm_neon.h>
+#endif /* HAVE_NEON_INTRINSICS */
+
 #include <math.h>
 
 #ifdef HAVE_VISIBILITY
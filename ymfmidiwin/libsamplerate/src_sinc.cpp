@@ -161,6 +161,114 @@ int_div_ceil (int divident, int divisor) /* == (int) ceil ((float) divident / di
 	return (divident + (divisor - 1)) / divisor ;
 }
 
+/*----------------------------------------------------------------------------------------
+**	Channel-parallel multiply-accumulate used by the stereo/quad/hex/multi kernels.
+**	Every filter tap interpolates one coefficient and applies it to all channels of a
+**	frame, so the per-channel loop is done two doubles at a time (SSE2 or NEON).
+**	Accumulation stays in double precision and in the same order as the scalar code,
+**	so the vector and plain C builds produce identical output.
+*/
+
+#if defined (HAVE_SSE2_INTRINSICS) && !defined (USE_TARGET_ATTRIBUTE)
+
+typedef __m128d acc2_t ;
+
+static inline acc2_t
+acc2_zero (void)
+{	return _mm_setzero_pd () ;
+} /* acc2_zero */
+
+static inline acc2_t
+acc2_mac (acc2_t acc, double icoeff, const float * in)
+{	__m128d x = _mm_cvtps_pd (_mm_castsi128_ps (_mm_loadl_epi64 ((const __m128i *) in))) ;
+	return _mm_add_pd (acc, _mm_mul_pd (_mm_set1_pd (icoeff), x)) ;
+} /* acc2_mac */
+
+static inline void
+acc2_output (float * output, double scale, acc2_t left, acc2_t right)
+{	__m128 out = _mm_cvtpd_ps (_mm_mul_pd (_mm_set1_pd (scale), _mm_add_pd (left, right))) ;
+	_mm_storel_pi ((__m64 *) output, out) ;
+} /* acc2_output */
+
+static inline acc2_t
+acc2_load (const double * acc)
+{	return _mm_loadu_pd (acc) ;
+} /* acc2_load */
+
+static inline void
+acc2_store (double * acc, acc2_t v)
+{	_mm_storeu_pd (acc, v) ;
+} /* acc2_store */
+
+#elif defined (HAVE_NEON_INTRINSICS)
+
+typedef float64x2_t acc2_t ;
+
+static inline acc2_t
+acc2_zero (void)
+{	return vdupq_n_f64 (0.0) ;
+} /* acc2_zero */
+
+static inline acc2_t
+acc2_mac (acc2_t acc, double icoeff, const float * in)
+{	float64x2_t x = vcvt_f64_f32 (vld1_f32 (in)) ;
+	return vaddq_f64 (acc, vmulq_f64 (vdupq_n_f64 (icoeff), x)) ;
+} /* acc2_mac */
+
+static inline void
+acc2_output (float * output, double scale, acc2_t left, acc2_t right)
+{	vst1_f32 (output, vcvt_f32_f64 (vmulq_f64 (vdupq_n_f64 (scale), vaddq_f64 (left, right)))) ;
+} /* acc2_output */
+
+static inline acc2_t
+acc2_load (const double * acc)
+{	return vld1q_f64 (acc) ;
+} /* acc2_load */
+
+static inline void
+acc2_store (double * acc, acc2_t v)
+{	vst1q_f64 (acc, v) ;
+} /* acc2_store */
+
+#else
+
+typedef struct
+{	double v [2] ;
+} acc2_t ;
+
+static inline acc2_t
+acc2_zero (void)
+{	acc2_t acc = { { 0.0, 0.0 } } ;
+	return acc ;
+} /* acc2_zero */
+
+static inline acc2_t
+acc2_mac (acc2_t acc, double icoeff, const float * in)
+{	acc.v [0] += icoeff * in [0] ;
+	acc.v [1] += icoeff * in [1] ;
+	return acc ;
+} /* acc2_mac */
+
+static inline void
+acc2_output (float * output, double scale, acc2_t left, acc2_t right)
+{	output [0] = (float) (scale * (left.v [0] + right.v [0])) ;
+	output [1] = (float) (scale * (left.v [1] + right.v [1])) ;
+} /* acc2_output */
+
+static inline acc2_t
+acc2_load (const double * acc)
+{	acc2_t v = { { acc [0], acc [1] } } ;
+	return v ;
+} /* acc2_load */
+
+static inline void
+acc2_store (double * acc, acc2_t v)
+{	acc [0] = v.v [0] ;
+	acc [1] = v.v [1] ;
+} /* acc2_store */
+
+#endif
+
 /*----------------------------------------------------------------------------------------
 */
 
@@ -522,7 +630,8 @@ sinc_mono_vari_process (SRC_STATE *state, SRC_DATA *data)
 
 static inline void
 calc_output_stereo (SINC_FILTER *filter, int channels, increment_t increment, increment_t start_filter_index, double scale, float * output)
-{	double		fraction, left [2], right [2], icoeff ;
+{	double		fraction, icoeff ;
+	acc2_t		left, right ;
 	increment_t	filter_index, max_filter_index ;
 	int			data_index, coeff_count, indx ;
 
@@ -542,7 +651,7 @@ calc_output_stereo (SINC_FILTER *filter, int channels, increment_t increment, in
 		filter_index -= increment * steps ;
 		data_index += steps * 2;
 	}
-	left [0] = left [1] = 0.0 ;
+	left = acc2_zero () ;
 	while (filter_index >= MAKE_INCREMENT_T (0))
 	{	fraction = fp_to_double (filter_index) ;
 		indx = fp_to_int (filter_index) ;
@@ -550,8 +659,7 @@ calc_output_stereo (SINC_FILTER *filter, int channels, increment_t increment, in
 		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
 		assert (data_index >= 0 && data_index + 1 < filter->b_len) ;
 		assert (data_index + 1 < filter->b_end) ;
-		for (int ch = 0; ch < 2; ch++)
-			left [ch] += icoeff * filter->buffer [data_index + ch] ;
+		left = acc2_mac (left, icoeff, filter->buffer + data_index) ;
 
 		filter_index -= increment ;
 		data_index = data_index + 2 ;
@@ -563,7 +671,7 @@ calc_output_stereo (SINC_FILTER *filter, int channels, increment_t increment, in
 	filter_index = filter_index + coeff_count * increment ;
 	data_index = filter->b_current + channels * (1 + coeff_count) ;
 
-	right [0] = right [1] = 0.0 ;
+	right = acc2_zero () ;
 	do
 	{	fraction = fp_to_double (filter_index) ;
 		indx = fp_to_int (filter_index) ;
@@ -571,16 +679,14 @@ calc_output_stereo (SINC_FILTER *filter, int channels, increment_t increment, in
 		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
 		assert (data_index >= 0 && data_index + 1 < filter->b_len) ;
 		assert (data_index + 1 < filter->b_end) ;
-		for (int ch = 0; ch < 2; ch++)
-			right [ch] += icoeff * filter->buffer [data_index + ch] ;
+		right = acc2_mac (right, icoeff, filter->buffer + data_index) ;
 
 		filter_index -= increment ;
 		data_index = data_index - 2 ;
 		}
 	while (filter_index > MAKE_INCREMENT_T (0)) ;
 
-	for (int ch = 0; ch < 2; ch++)
-		output [ch] = (float) (scale * (left [ch] + right [ch])) ;
+	acc2_output (output, scale, left, right) ;
 } /* calc_output_stereo */
 
 SRC_ERROR
@@ -677,7 +783,8 @@ sinc_stereo_vari_process (SRC_STATE *state, SRC_DATA *data)
 
 static inline void
 calc_output_quad (SINC_FILTER *filter, int channels, increment_t increment, increment_t start_filter_index, double scale, float * output)
-{	double		fraction, left [4], right [4], icoeff ;
+{	double		fraction, icoeff ;
+	acc2_t		left [2], right [2] ;
 	increment_t	filter_index, max_filter_index ;
 	int			data_index, coeff_count, indx ;
 
@@ -697,7 +804,8 @@ calc_output_quad (SINC_FILTER *filter, int channels, increment_t increment, incr
 		filter_index -= increment * steps ;
 		data_index += steps * 4;
 	}
-	left [0] = left [1] = left [2] = left [3] = 0.0 ;
+	for (int ch = 0; ch < 2; ch++)
+		left [ch] = acc2_zero () ;
 	while (filter_index >= MAKE_INCREMENT_T (0))
 	{	fraction = fp_to_double (filter_index) ;
 		indx = fp_to_int (filter_index) ;
@@ -705,8 +813,8 @@ calc_output_quad (SINC_FILTER *filter, int channels, increment_t increment, incr
 		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
 		assert (data_index >= 0 && data_index + 3 < filter->b_len) ;
 		assert (data_index + 3 < filter->b_end) ;
-		for (int ch = 0; ch < 4; ch++)
-			left [ch] += icoeff * filter->buffer [data_index + ch] ;
+		for (int ch = 0; ch < 2; ch++)
+			left [ch] = acc2_mac (left [ch], icoeff, filter->buffer + data_index + 2 * ch) ;
 
 		filter_index -= increment ;
 		data_index = data_index + 4 ;
@@ -718,7 +826,8 @@ calc_output_quad (SINC_FILTER *filter, int channels, increment_t increment, incr
 	filter_index = filter_index + coeff_count * increment ;
 	data_index = filter->b_current + channels * (1 + coeff_count) ;
 
-	right [0] = right [1] = right [2] = right [3] = 0.0 ;
+	for (int ch = 0; ch < 2; ch++)
+		right [ch] = acc2_zero () ;
 	do
 	{	fraction = fp_to_double (filter_index) ;
 		indx = fp_to_int (filter_index) ;
@@ -726,8 +835,8 @@ calc_output_quad (SINC_FILTER *filter, int channels, increment_t increment, incr
 		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
 		assert (data_index >= 0 && data_index + 3 < filter->b_len) ;
 		assert (data_index + 3 < filter->b_end) ;
-		for (int ch = 0; ch < 4; ch++)
-			right [ch] += icoeff * filter->buffer [data_index + ch] ;
+		for (int ch = 0; ch < 2; ch++)
+			right [ch] = acc2_mac (right [ch], icoeff, filter->buffer + data_index + 2 * ch) ;
 
 
 		filter_index -= increment ;
@@ -735,8 +844,8 @@ calc_output_quad (SINC_FILTER *filter, int channels, increment_t increment, incr
 		}
 	while (filter_index > MAKE_INCREMENT_T (0)) ;
 
-	for (int ch = 0; ch < 4; ch++)
-		output [ch] = (float) (scale * (left [ch] + right [ch])) ;
+	for (int ch = 0; ch < 2; ch++)
+		acc2_output (output + 2 * ch, scale, left [ch], right [ch]) ;
 } /* calc_output_quad */
 
 SRC_ERROR
@@ -833,7 +942,8 @@ sinc_quad_vari_process (SRC_STATE *state, SRC_DATA *data)
 
 static inline void
 calc_output_hex (SINC_FILTER *filter, int channels, increment_t increment, increment_t start_filter_index, double scale, float * output)
-{	double		fraction, left [6], right [6], icoeff ;
+{	double		fraction, icoeff ;
+	acc2_t		left [3], right [3] ;
 	increment_t	filter_index, max_filter_index ;
 	int			data_index, coeff_count, indx ;
 
@@ -853,7 +963,8 @@ calc_output_hex (SINC_FILTER *filter, int channels, increment_t increment, incre
 		filter_index -= increment * steps ;
 		data_index += steps * 6;
 	}
-	left [0] = left [1] = left [2] = left [3] = left [4] = left [5] = 0.0 ;
+	for (int ch = 0; ch < 3; ch++)
+		left [ch] = acc2_zero () ;
 	while (filter_index >= MAKE_INCREMENT_T (0))
 	{	fraction = fp_to_double (filter_index) ;
 		indx = fp_to_int (filter_index) ;
@@ -861,8 +972,8 @@ calc_output_hex (SINC_FILTER *filter, int channels, increment_t increment, incre
 		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
 		assert (data_index >= 0 && data_index + 5 < filter->b_len) ;
 		assert (data_index + 5 < filter->b_end) ;
-		for (int ch = 0; ch < 6; ch++)
-			left [ch] += icoeff * filter->buffer [data_index + ch] ;
+		for (int ch = 0; ch < 3; ch++)
+			left [ch] = acc2_mac (left [ch], icoeff, filter->buffer + data_index + 2 * ch) ;
 
 		filter_index -= increment ;
 		data_index = data_index + 6 ;
@@ -874,7 +985,8 @@ calc_output_hex (SINC_FILTER *filter, int channels, increment_t increment, incre
 	filter_index = filter_index + coeff_count * increment ;
 	data_index = filter->b_current + channels * (1 + coeff_count) ;
 
-	right [0] = right [1] = right [2] = right [3] = right [4] = right [5] = 0.0 ;
+	for (int ch = 0; ch < 3; ch++)
+		right [ch] = acc2_zero () ;
 	do
 	{	fraction = fp_to_double (filter_index) ;
 		indx = fp_to_int (filter_index) ;
@@ -882,16 +994,16 @@ calc_output_hex (SINC_FILTER *filter, int channels, increment_t increment, incre
 		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
 		assert (data_index >= 0 && data_index + 5 < filter->b_len) ;
 		assert (data_index + 5 < filter->b_end) ;
-		for (int ch = 0; ch < 6; ch++)
-			right [ch] += icoeff * filter->buffer [data_index + ch] ;
+		for (int ch = 0; ch < 3; ch++)
+			right [ch] = acc2_mac (right [ch], icoeff, filter->buffer + data_index + 2 * ch) ;
 
 		filter_index -= increment ;
 		data_index = data_index - 6 ;
 		}
 	while (filter_index > MAKE_INCREMENT_T (0)) ;
 
-	for (int ch = 0; ch < 6; ch++)
-		output [ch] = (float) (scale * (left [ch] + right [ch])) ;
+	for (int ch = 0; ch < 3; ch++)
+		acc2_output (output + 2 * ch, scale, left [ch], right [ch]) ;
 } /* calc_output_hex */
 
 SRC_ERROR
@@ -992,7 +1104,7 @@ calc_output_multi (SINC_FILTER *filter, increment_t increment, increment_t start
 	/* The following line is 1999 ISO Standard C. If your compiler complains, get a better compiler. */
 	double		*left, *right ;
 	increment_t	filter_index, max_filter_index ;
-	int			data_index, coeff_count, indx ;
+	int			data_index, coeff_count, indx, ch ;
 
 	left = filter->left_calc ;
 	right = filter->right_calc ;
@@ -1024,7 +1136,9 @@ calc_output_multi (SINC_FILTER *filter, increment_t increment, increment_t start
 
 		assert (data_index >= 0 && data_index + channels - 1 < filter->b_len) ;
 		assert (data_index + channels - 1 < filter->b_end) ;
-		for (int ch = 0; ch < channels; ch++)
+		for (ch = 0; ch + 1 < channels; ch += 2)
+			acc2_store (left + ch, acc2_mac (acc2_load (left + ch), icoeff, filter->buffer + data_index + ch)) ;
+		if (ch < channels)
 			left [ch] += icoeff * filter->buffer [data_index + ch] ;
 
 		filter_index -= increment ;
@@ -1045,7 +1159,9 @@ calc_output_multi (SINC_FILTER *filter, increment_t increment, increment_t start
 		icoeff = filter->coeffs [indx] + fraction * (filter->coeffs [indx + 1] - filter->coeffs [indx]) ;
 		assert (data_index >= 0 && data_index + channels - 1 < filter->b_len) ;
 		assert (data_index + channels - 1 < filter->b_end) ;
-		for (int ch = 0; ch < channels; ch++)
+		for (ch = 0; ch + 1 < channels; ch += 2)
+			acc2_store (right + ch, acc2_mac (acc2_load (right + ch), icoeff, filter->buffer + data_index + ch)) ;
+		if (ch < channels)
 			right [ch] += icoeff * filter->buffer [data_index + ch] ;
 
 		filter_index -= increment ;
@@ -1053,7 +1169,7 @@ calc_output_multi (SINC_FILTER *filter, increment_t increment, increment_t start
 		}
 	while (filter_index > MAKE_INCREMENT_T (0)) ;
 
-	for(int ch = 0; ch < channels; ch++)
+	for (ch = 0; ch < channels; ch++)
 		output [ch] = (float) (scale * (left [ch] + right [ch])) ;
 
 	return ;
@@ -0,0 +1,305 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "loadgen.h"
+
+namespace
+{
+
+const struct
+{
+	const char *name;
+	double LoadSettings::*value;
+	double min, max;
+} realSettings[] =
+{
+	{ "seconds", &LoadSettings::seconds,     0.01, 86400 },
+	{ "notes",   &LoadSettings::noteRate,    0, 100000 },
+	{ "cc",      &LoadSettings::controlRate, 0, 10000 },
+	{ "bend",    &LoadSettings::bendRate,    0, 10000 },
+	{ "sysex",   &LoadSettings::sysexRate,   0, 1000 },
+	{ "fourop",  &LoadSettings::fourOpRatio, 0, 1 },
+	{ "drums",   &LoadSettings::drumRatio,   0, 1 },
+};
+
+const struct
+{
+	const char *name;
+	unsigned LoadSettings::*value;
+	double min, max;
+} intSettings[] =
+{
+	{ "seed",     &LoadSettings::seed,       0, 4294967295.0 },
+	{ "channels", &LoadSettings::channels,   1, 16 },
+	{ "poly",     &LoadSettings::polyphony,  1, 100000 },
+	{ "burst",    &LoadSettings::sysexBurst, 1, 1000 },
+};
+
+// xorshift, so that a seed gives the same stream with any compiler
+// (<random>'s distributions aren't the same everywhere)
+class Random
+{
+public:
+	Random(uint32_t seed)
+	{
+		m_state = seed * 0x9e3779b9u + 0x7f4a7c15u;
+		if (!m_state)
+			m_state = 1;
+	}
+
+	uint32_t next()
+	{
+		m_state ^= m_state << 13;
+		m_state ^= m_state >> 17;
+		m_state ^= m_state << 5;
+		return m_state;
+	}
+	// 0 to n-1
+	unsigned below(size_t n) { return (unsigned)(((uint64_t)next() * n) >> 32); }
+	// 0 to 1
+	double uniform() { return next() / 4294967296.0; }
+
+private:
+	uint32_t m_state;
+};
+
+// ----------------------------------------------------------------------------
+// time of the n-th of a series of events at 'rate' per second (offset by 'phase' events)
+uint32_t eventTime(unsigned n, double rate, double phase = 0)
+{
+	return (uint32_t)((n + phase) * songTicksPerSecond / rate);
+}
+
+// ----------------------------------------------------------------------------
+// Roland GS parameter set for a part, setting its drum map to what it already is
+// (parsed by the player, but changes nothing)
+std::vector<uint8_t> drumMapMessage(uint8_t channel)
+{
+	// parts 1-9 are channels 1-9 (part 0 is channel 10)
+	const uint8_t part = (channel == 9) ? 0 : (channel < 9) ? channel + 1 : channel;
+	const uint8_t address[3] = { 0x40, (uint8_t)(0x10 | part), 0x15 };
+	const uint8_t value = (channel == 9) ? 1 : 0;
+	const uint8_t checksum = (128 - (address[0] + address[1] + address[2] + value) % 128) & 0x7f;
+
+	return { 0x41, 0x10, 0x42, 0x12, address[0], address[1], address[2], value, checksum, 0xf7 };
+}
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+bool parseLoadSettings(LoadSettings& settings, const char *spec)
+{
+	LoadSettings parsed = settings;
+	const std::string text = spec;
+
+	for (size_t pos = 0; pos < text.size(); )
+	{
+		size_t next = text.find(',', pos);
+		if (next == std::string::npos)
+			next = text.size();
+		const std::string item = text.substr(pos, next - pos);
+		pos = next + 1;
+		if (item.empty())
+			continue;
+
+		const size_t equals = item.find('=');
+		if (equals == std::string::npos)
+			return false;
+		const std::string name = item.substr(0, equals);
+		const char *valueText = item.c_str() + equals + 1;
+		char *end;
+		const double value = strtod(valueText, &end);
+		if (end == valueText || *end)
+			return false;
+
+		bool found = false;
+		for (auto& setting : realSettings)
+		{
+			if (name != setting.name)
+				continue;
+			if (value < setting.min || value > setting.max)
+				return false;
+			parsed.*setting.value = value;
+			found = true;
+		}
+		for (auto& setting : intSettings)
+		{
+			if (name != setting.name)
+				continue;
+			if (value < setting.min || value > setting.max || value != floor(value))
+				return false;
+			parsed.*setting.value = (unsigned)value;
+			found = true;
+		}
+		if (!found)
+			return false;
+	}
+
+	settings = parsed;
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+bool parseLoadPath(LoadSettings& settings, const char *path)
+{
+	static const char prefix[] = "//LOADGEN";
+	for (unsigned i = 0; prefix[i]; i++)
+	{
+		if (toupper((unsigned char)path[i]) != prefix[i])
+			return false;
+	}
+	if (!path[9])
+		return true;
+	return path[9] == ':' && parseLoadSettings(settings, path + 10);
+}
+
+// ----------------------------------------------------------------------------
+std::string loadSettingsString(const LoadSettings& settings)
+{
+	char text[256];
+	snprintf(text, sizeof(text), "seed=%u,seconds=%g,channels=%u,notes=%g,poly=%u,cc=%g,bend=%g,sysex=%g,burst=%u,fourop=%g,drums=%g",
+		settings.seed, settings.seconds, settings.channels, settings.noteRate, settings.polyphony,
+		settings.controlRate, settings.bendRate, settings.sysexRate, settings.sysexBurst,
+		settings.fourOpRatio, settings.drumRatio);
+	return text;
+}
+
+// ----------------------------------------------------------------------------
+std::vector<SongEvent> makeLoad(const LoadSettings& settings, const OPLPatchSet *patches)
+{
+	Random random(settings.seed);
+	std::vector<SongEvent> events;
+	const uint32_t end = std::max(1u, (uint32_t)(settings.seconds * songTicksPerSecond));
+
+	const bool drums = settings.drumRatio > 0;
+	std::vector<uint8_t> melodic, channels;
+	for (uint8_t ch = 0; ch < std::min(settings.channels, 16u); ch++)
+	{
+		if (ch != 9)
+			melodic.push_back(ch);
+	}
+	channels = melodic;
+	if (drums)
+		channels.push_back(9);
+
+	// programs whose patches take one or two voices per note
+	std::vector<uint8_t> programs[2];
+	for (unsigned num = 0; num < 128; num++)
+	{
+		bool twoVoices = false;
+		if (patches)
+		{
+			auto patch = patches->find(num);
+			if (patch == patches->end())
+				continue;
+			twoVoices = patch->second.fourOp || patch->second.dualTwoOp;
+		}
+		programs[twoVoices].push_back(num);
+	}
+
+	// channel setup: the first ones get the two voice patches
+	const size_t numTwoVoices = (size_t)(settings.fourOpRatio * melodic.size() + 0.5);
+	for (size_t i = 0; i < channels.size(); i++)
+	{
+		const uint8_t ch = channels[i];
+		if (ch != 9)
+		{
+			const bool twoVoices = (i < numTwoVoices && !programs[1].empty()) || programs[0].empty();
+			const std::vector<uint8_t>& choice = programs[twoVoices];
+			const uint8_t program = choice.empty() ? 0 : choice[random.below(choice.size())];
+			events.push_back({ 0, (uint8_t)(0xc0 | ch), program, 0, 0, {} });
+		}
+		events.push_back({ 0, (uint8_t)(0xb0 | ch), 7, 100, 0, {} });
+		events.push_back({ 0, (uint8_t)(0xb0 | ch), 10, (uint8_t)(ch * 127 / 15), 0, {} });
+		events.push_back({ 0, (uint8_t)(0xb0 | ch), 11, 127, 0, {} });
+	}
+
+	// notes at a steady rate on random channels, lengths around the one giving the polyphony
+	if (settings.noteRate > 0 && !channels.empty())
+	{
+		const double length = settings.polyphony / settings.noteRate * songTicksPerSecond;
+		for (unsigned n = 0; ; n++)
+		{
+			const uint32_t time = eventTime(n, settings.noteRate);
+			if (time >= end)
+				break;
+
+			const bool drum = drums && (melodic.empty() || random.uniform() < settings.drumRatio);
+			const uint8_t ch = drum ? 9 : melodic[random.below(melodic.size())];
+			const uint8_t note = drum ? 35 + random.below(47) : 36 + random.below(60);
+			const uint8_t velocity = 64 + random.below(64);
+			const uint32_t duration = (uint32_t)(length * (0.5 + random.uniform()) + 0.5);
+			events.push_back({ time, (uint8_t)(0x90 | ch), note, velocity, std::max(1u, std::min(duration, end - time)), {} });
+		}
+	}
+
+	// controllers, each channel in turn
+	if (settings.controlRate > 0)
+	{
+		static const uint8_t controllers[] = { 1, 7, 10, 11, 91, 93 };
+		for (size_t i = 0; i < channels.size(); i++)
+		{
+			for (unsigned n = 0; ; n++)
+			{
+				const uint32_t time = eventTime(n, settings.controlRate, (double)i / channels.size());
+				if (time >= end)
+					break;
+
+				const uint8_t control = controllers[n % sizeof(controllers)];
+				// (keep volume and expression audible)
+				const uint8_t value = (control == 7 || control == 11) ? 80 + random.below(48) : random.below(128);
+				events.push_back({ time, (uint8_t)(0xb0 | channels[i]), control, value, 0, {} });
+			}
+		}
+	}
+
+	// pitch bend: a triangle wave over the whole range, one cycle every two seconds
+	if (settings.bendRate > 0)
+	{
+		static const uint32_t period = songTicksPerSecond * 2;
+		for (size_t i = 0; i < melodic.size(); i++)
+		{
+			for (unsigned n = 0; ; n++)
+			{
+				const uint32_t time = eventTime(n, settings.bendRate, (double)i / melodic.size());
+				if (time >= end)
+					break;
+
+				const uint32_t phase = (time + (uint32_t)(i * period / melodic.size())) % period;
+				const uint32_t value = std::min(phase, period - phase) * 16383 / (period / 2);
+				events.push_back({ time, (uint8_t)(0xe0 | melodic[i]), (uint8_t)(value & 0x7f), (uint8_t)(value >> 7), 0, {} });
+			}
+		}
+	}
+
+	// SysEx bursts: GS drum map settings and GM master volume (which the player ignores)
+	if (settings.sysexRate > 0 && !channels.empty())
+	{
+		for (unsigned n = 0; ; n++)
+		{
+			const uint32_t time = eventTime(n, settings.sysexRate);
+			if (time >= end)
+				break;
+
+			for (unsigned i = 0; i < settings.sysexBurst; i++)
+			{
+				SongEvent event = { time, 0xf0, 0, 0, 0, {} };
+				if (i & 1)
+					event.sysex = { 0x7f, 0x7f, 0x04, 0x01, 0x00, 0x7f, 0xf7 };
+				else
+					event.sysex = drumMapMessage(channels[random.below(channels.size())]);
+				events.push_back(event);
+			}
+		}
+	}
+
+	std::stable_sort(events.begin(), events.end(), [](const SongEvent& a, const SongEvent& b)
+	{
+		return a.time < b.time;
+	});
+	return events;
+}
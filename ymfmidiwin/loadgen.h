@@ -0,0 +1,40 @@
+#ifndef __LOADGEN_H
+#define __LOADGEN_H
+
+#include <string>
+
+#include "patches.h"
+#include "songgen.h"
+
+// synthetic MIDI load for stress and scaling tests: a reproducible stream (the same settings
+// always give the same events) that can be written in any song format with writeSong or
+// played straight into a player by opening "//LOADGEN:<settings>" as a song (see SequenceLoad).
+// <settings> is a list like "notes=1000,bend=100", the names are those in the comments below.
+struct LoadSettings
+{
+	uint32_t seed = 1;         // seed: for the random choices
+	double seconds = 10.0;     // seconds: length
+	unsigned channels = 16;    // channels: melodic notes use the first ones but 10 (which gets the drums)
+	double noteRate = 100.0;   // notes: note-ons per second, all channels together
+	unsigned polyphony = 32;   // poly: notes held at once on average (this sets the note lengths)
+	double controlRate = 0.0;  // cc: controller changes per second on each channel
+	double bendRate = 0.0;     // bend: pitch bend messages per second on each melodic channel
+	double sysexRate = 0.0;    // sysex: SysEx bursts per second
+	unsigned sysexBurst = 8;   // burst: messages in each burst
+	double fourOpRatio = 0.0;  // fourop: share of the melodic channels playing patches that take
+	                           //   two voices (4op or double 2op), if the bank has any
+	double drumRatio = 0.1;    // drums: share of the notes on the percussion channel
+};
+
+// parses <settings> into 'settings' (keeping the defaults for anything not given),
+// false if there's an unknown name or an invalid value
+bool parseLoadSettings(LoadSettings& settings, const char *spec);
+// the settings in the same form
+std::string loadSettingsString(const LoadSettings& settings);
+// same for a "//LOADGEN" or "//LOADGEN:<settings>" song path
+bool parseLoadPath(LoadSettings& settings, const char *path);
+
+// 'patches' is used to pick programs for the fourop ratio (without it any program may be used)
+std::vector<SongEvent> makeLoad(const LoadSettings& settings, const OPLPatchSet *patches = nullptr);
+
+#endif // __LOADGEN_H
@@ -41,15 +41,23 @@ extern "C" {
 #define ID_TRAY_LPF_OFF		1008
 #define ID_TRAY_LPF_LIGHT	1009
 #define ID_TRAY_LPF_STRONG	1010
-
-#define INTERNAL_SR 50000
+#define ID_TIMER_STATS		1
 
 #define LPF_CUTOFF_PRESET_OFF		0
 #define LPF_CUTOFF_PRESET_LIGHT		16000
 #define LPF_CUTOFF_PRESET_STRONG	8000
 
+#define WAV_STEMS_OFF		0
+#define WAV_STEMS_MULTI		1 // MIDIチャンネル毎のステレオを1つのマルチチャンネルWAVに出力
+#define WAV_STEMS_SPLIT		2 // MIDIチャンネル毎に別のWAVファイルに出力
+
+#include "bench.h"
+#include "golden.h"
+#include "loadgen.h"
 #include "console.h"
+#include "latencytest.h"
 #include "player.h"
+#include "profiler.h"
 #include <thread>
 
 #ifdef _CONSOLE
@@ -82,7 +90,13 @@ static int g_buffersizeNanoseconds = 100 * 1000 * 10;
 static int g_srconvtype = SRC_SINC_FASTEST;
 static int g_wavOutputMarginMillisecond = 1000;
 static bool g_wavOutputMarginAuto = true;
+static int g_wavBitsPerSample = 16;
+static bool g_wavDither = false;
+static int g_wavStems = WAV_STEMS_OFF;
 static int g_curLPFCutoff = 0;
+static int g_statsInterval = 0;
+static bool g_controlThread = false;
+static const char* g_tracePath = nullptr;
 
 #ifdef USE_SDL
 static void mainLoopSDL(OPLPlayer* player, int bufferSize, bool interactive);
@@ -105,6 +119,16 @@ std::string getUsageText()
 		"\n"
 		"supported song formats:  HMI, HMP, MID, MUS, RMI, XMI\n"
 		"supported patch formats: AD, OPL, OP2, TMB, WOPL, FMSYNTH.BIN\n"
+		"MIDI input (as song_path): //MIDIIN<port>, //MIDIIN:alsa[:<name>],\n"
+		"                           //MIDIIN:pipe:<path>, //MIDIIN:socket:<path>,\n"
+		"                           //MIDIIN:udp:[<addr>:]<port>\n"
+		"                           several ports separated by ',' (e.g. //MIDIIN0,1)\n"
+		"                           each get 16 channels and a share of the chips (see -n)\n"
+		"synthetic load (as song_path): //LOADGEN[:<name>=<value>,...] with seconds (10),\n"
+		"                           notes (per second, 100), poly (notes held, 32),\n"
+		"                           cc, bend (per second and channel, 0), sysex (bursts per\n"
+		"                           second, 0), burst (8), fourop (share of channels, 0),\n"
+		"                           drums (share of notes, 0.1), channels (16), seed (1)\n"
 		"\n"
 		"supported options:\n"
 		"  -h / --help             show this information and exit\n"
@@ -115,10 +139,38 @@ std::string getUsageText()
 		"  -s / --song <num>       select an individual song, if multiple in file\n"
 		"                            (default 1)\n"
 		"  -o / --out <path>       output to WAV file (implies -q and -1)\n"
+		"  --profile <path>        record profiling counters from the start and write\n"
+		"                            them to <path> as JSON at exit ('-' = stdout)\n"
+		"                            ([i] toggles them on the console display)\n"
+		"  --trace <path>          record a timeline of the player's work and write it\n"
+		"                            to <path> as Chrome trace JSON at exit ([t] writes\n"
+		"                            it at any time); view in ui.perfetto.dev\n"
+		"  --latency-test <num>    measure the MIDI IN to audio latency with <num> notes\n"
+		"                            on a simulated audio device, using the buffer size,\n"
+		"                            resampler, sleep time and latency options\n"
+		"                            (no song_path; patch_path may be given)\n"
+		"  --bench <path>          run the throughput benchmarks and write the results\n"
+		"                            to <path> as JSON ('-' = stdout); song files given\n"
+		"                            instead of song_path are benchmarked as well, a\n"
+		"                            //LOADGEN song replaces the default load\n"
+		"  --loadgen-write <path>  write the //LOADGEN song_path to <path> (MID, XMI,\n"
+		"                            MUS, HMI or HMP by extension) instead of playing it\n"
+		"  --golden-write <dir>    render the regression test cases and store them in\n"
+		"                            <dir> as the reference output\n"
+		"  --golden-check <dir>    render the regression test cases and compare them\n"
+		"                            with the reference output in <dir> (the DMXOPL\n"
+		"                            directory may be given instead of song_path)\n"
 		"\n"
 		"  -c / --chip <num>       set type of chip (1 = OPL, 2 = OPL2, 3 = OPL3; default 3)\n"
 		"  -n / --num <num>        set number of chips (default 1)\n"
 		"  -m / --mono             ignore MIDI panning information (OPL3 only)\n"
+		"  --drum-cache            play percussion from pre-rendered samples\n"
+		"                            (saves OPL voices for melodic parts)\n"
+		"  --reduce-voices <num>   play 4op and double 2op patches with one voice\n"
+		"                            while fewer than <num> voices are free\n"
+		"                            (default 0=never)\n"
+		"  --control-thread        run MIDI handling and voice allocation on their own\n"
+		"                            thread, apart from rendering (not with --drum-cache)\n"
 		"  -b / --buf <num>        set buffer size (0=minimum)\n"
 		"  --bufms <num(msec)>     set buffer size in milliseconds (0=minimum)\n"
 		"  -g / --gain <num>       set gain amount (default 1.0)\n"
@@ -127,11 +179,20 @@ std::string getUsageText()
 		"  --lpfilter <num>        set lowpass cutoff in Hz (default 16000, 0=disable)\n"
 		"\n"
 		"  -p / --ptime            time to enter sleep mode (msec; default 15000)\n"
+		"  --latency <num>         MIDI IN latency (msec; default 10)\n"
+		"                            events are played this long after they arrive,\n"
+		"                            keeping their original spacing\n"
+		"  --stats <num>           log DSP load, deadline misses, underruns and\n"
+		"                            MIDI IN FIFO usage every <num> seconds\n"
 		"\n"
 		"  --resampler <nearest|linear|sinc_fast|sinc_medium|sinc_best>\n"
 		"                          resampler type (default sinc_fast)\n"
 		"  --tail-time <num>       extra tail time to append to the WAV output\n"
-		"                          (msec; default auto)"
+		"                          (msec; default auto)\n"
+		"  --bits <16|24>          bits per sample of the WAV output (default 16)\n"
+		"  --dither                add TPDF dither to the WAV output\n"
+		"  --stems <multi|split>   render each MIDI channel to its own stereo track,\n"
+		"                          as one multichannel WAV or one WAV per channel"
 	);
 }
 void usage()
@@ -165,6 +226,21 @@ static const option options[] =
 	{"tail-time", 1, nullptr,  0 },
 	{"hpfilter",  1, nullptr,  0 },
 	{"lpfilter",  1, nullptr,  0 },
+	{"bits",      1, nullptr,  0 },
+	{"dither",    0, nullptr,  0 },
+	{"stems",     1, nullptr,  0 },
+	{"drum-cache", 0, nullptr, 0 },
+	{"reduce-voices", 1, nullptr, 0 },
+	{"control-thread", 0, nullptr, 0 },
+	{"latency",   1, nullptr,  0 },
+	{"latency-test", 1, nullptr, 0 },
+	{"bench",     1, nullptr,  0 },
+	{"golden-write", 1, nullptr, 0 },
+	{"loadgen-write", 1, nullptr, 0 },
+	{"golden-check", 1, nullptr, 0 },
+	{"profile",   1, nullptr,  0 },
+	{"stats",     1, nullptr,  0 },
+	{"trace",     1, nullptr,  0 },
 	{0}
 };
 
@@ -180,6 +256,27 @@ void quitPlayer(int)
 #endif
 }
 
+// ----------------------------------------------------------------------------
+// 再生中のプレーヤーへの操作は、オーディオスレッド側でブロックの区切りに適用させる
+static void postPlayerCommand(OPLPlayer* player, OPLPlayer::Command command, double value = 0)
+{
+	player->postCommand(command, value);
+	// スリープ中でもすぐ適用されるように起こす
+	if (g_hEventWakeUp) {
+		SetEvent(g_hEventWakeUp);
+	}
+}
+
+// ----------------------------------------------------------------------------
+static std::string formatRenderStats(const OPLPlayer::RenderStats& stats)
+{
+	char line[160];
+	sprintf_s(line, "load %5.1f%% (peak %5.1f%%), deadline misses %u, underruns %u, MIDI FIFO peak %u, dropped %u",
+		stats.load * 100, stats.peakLoad * 100, stats.deadlineMisses, stats.underruns,
+		stats.midiHighWater, stats.midiDropped);
+	return line;
+}
+
 // ----------------------------------------------------------------------------
 const char* shortPath(const char* path)
 {
@@ -212,7 +309,7 @@ BOOL WINAPI ConsoleHandler(DWORD ctrlType)
 	case CTRL_LOGOFF_EVENT:
 	case CTRL_SHUTDOWN_EVENT:
 		g_running = false;
-		return TRUE;   // Ƃʒm
+		return TRUE;   // 処理したことを通知
 	default:
 		return FALSE;
 	}
@@ -257,7 +354,7 @@ std::wstring GetFileVersionString() {
 #ifdef YMFMIDI_CONSOLE
 int StartTrayApplication()
 {
-	// st@CpX擾
+	// 実行ファイルパス取得
 	WCHAR szFilePath[MAX_PATH] = { 0 };
 	if (GetModuleFileNameW(NULL, szFilePath, MAX_PATH) == 0)
 		return -1;
@@ -269,18 +366,18 @@ int StartTrayApplication()
 	*(pathSepa + 1) = '\0';
 	wcscat_s(szFilePath, L"ymfmidiwin-synth.exe");
 
-	// R}hC擾iexej
-	// GetCommandLine()exe݂Ȃ̂ŉ͂Kv
+	// コマンドライン引数取得（exe名除く）
+	// GetCommandLine()はexe名込みなので解析が必要
 	LPWSTR cmdLine = GetCommandLineW();
 
-	// R}hCexeiargv[0]j
+	// コマンドラインからexe名を除去（argv[0]相当）
 	int argc;
 	LPWSTR* argv = CommandLineToArgvW(cmdLine, &argc);
 	if (!argv)
 		return -1;
 
-	// argv[0]͎st@CpXȂ̂ŁAR}hC쐬
-	// : argv[1] argv[2] ... A
+	// argv[0]は実行ファイルパスなので、それを除いたコマンドラインを作成
+	// 例: argv[1] argv[2] ... を連結
 	WCHAR szArgs[1024] = { 0 };
 	for (int i = 1; i < argc; i++)
 	{
@@ -290,7 +387,7 @@ int StartTrayApplication()
 	}
 	LocalFree(argv);
 
-	// CreateProcess̈pɃtR}hC쐬ist@CpX + j
+	// CreateProcessの引数用にフルコマンドラインを作成（実行ファイルパス + 引数）
 	WCHAR szCmdLine[2048] = { 0 };
 	swprintf_s(szCmdLine, 2048, L"\"%s\" %s", szFilePath, szArgs);
 
@@ -311,11 +408,11 @@ int StartTrayApplication()
 
 	if (!ret)
 	{
-		// G[
+		// エラー処理
 		return -1;
 	}
 
-	// VvZX̃nh͕svȂ̂ŕ
+	// 新プロセスのハンドルは不要なので閉じる
 	CloseHandle(pi.hProcess);
 	CloseHandle(pi.hThread);
 
@@ -328,7 +425,7 @@ HICON g_oldhIcon = nullptr;
 HICON g_oldhIconSleep = nullptr;
 void ReleaseOldTrayIcon(void)
 {
-	// ÂACR폜@gCACRւOɍ폜Ă͂Ȃ
+	// 古いアイコン削除　トレイアイコン差し替え前に削除してはいけない
 	if (g_oldhIcon) {
 		DestroyIcon(g_oldhIcon);
 		g_oldhIcon = nullptr;
@@ -346,7 +443,7 @@ void CreateTrayIcon(HWND hwnd)
 	int iconSizeX = GetSystemMetrics(SM_CXSMICON) * dpi / 96;
 	int iconSizeY = GetSystemMetrics(SM_CYSMICON) * dpi / 96;
 	if (g_lastIconDPI != dpi) {
-		// č쐬
+		// 再作成
 		g_oldhIcon = g_hIcon;
 		g_oldhIconSleep = g_hIconSleep;
 		g_hIcon = nullptr;
@@ -411,23 +508,23 @@ void UpdateTrayIcon(HWND hwnd)
 
 int RestartApplication()
 {
-	// st@CpX擾
+	// 実行ファイルパス取得
 	WCHAR szFilePath[MAX_PATH] = { 0 };
 	if (GetModuleFileNameW(NULL, szFilePath, MAX_PATH) == 0)
 		return -1;
 
-	// R}hC擾iexej
-	// GetCommandLine()exe݂Ȃ̂ŉ͂Kv
+	// コマンドライン引数取得（exe名除く）
+	// GetCommandLine()はexe名込みなので解析が必要
 	LPWSTR cmdLine = GetCommandLineW();
 
-	// R}hCexeiargv[0]j
+	// コマンドラインからexe名を除去（argv[0]相当）
 	int argc;
 	LPWSTR* argv = CommandLineToArgvW(cmdLine, &argc);
 	if (!argv)
 		return -1;
 
-	// argv[0]͎st@CpXȂ̂ŁAR}hC쐬
-	// : argv[1] argv[2] ... A
+	// argv[0]は実行ファイルパスなので、それを除いたコマンドラインを作成
+	// 例: argv[1] argv[2] ... を連結
 	WCHAR szArgs[1024] = { 0 };
 	for (int i = 1; i < argc; i++)
 	{
@@ -437,7 +534,7 @@ int RestartApplication()
 	}
 	LocalFree(argv);
 
-	// CreateProcess̈pɃtR}hC쐬ist@CpX + j
+	// CreateProcessの引数用にフルコマンドラインを作成（実行ファイルパス + 引数）
 	WCHAR szCmdLine[2048] = { 0 };
 	swprintf_s(szCmdLine, 2048, L"\"%s\" %s", szFilePath, szArgs);
 
@@ -458,11 +555,11 @@ int RestartApplication()
 
 	if (!ret)
 	{
-		// G[
+		// エラー処理
 		return -1;
 	}
 
-	// VvZX̃nh͕svȂ̂ŕ
+	// 新プロセスのハンドルは不要なので閉じる
 	CloseHandle(pi.hProcess);
 	CloseHandle(pi.hThread);
 
@@ -477,12 +574,12 @@ INT_PTR CALLBACK AboutDlgProc(HWND hDlg, UINT msg, WPARAM wParam, LPARAM)
 	{
 		g_dialoghWnd = hDlg;
 
-		// _CAÕtHg擾
+		// ダイアログのフォントを取得
 		HFONT hDlgFont = (HFONT)SendMessage(hDlg, WM_GETFONT, 0, 0);
 		if (hDlgFont) {
 			LOGFONT lf = {};
 			if (!g_hBoldFont && GetObject(hDlgFont, sizeof(LOGFONT), &lf)) {
-				lf.lfWeight = FW_BOLD; // ɕύX
+				lf.lfWeight = FW_BOLD; // 太字に変更
 				g_hBoldFont = CreateFontIndirect(&lf);
 				HWND hLabel = GetDlgItem(hDlg, IDC_TITLE_LABEL);
 				if (hLabel && g_hBoldFont)
@@ -580,6 +677,15 @@ LRESULT CALLBACK TrayWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 			else if (midiType == OPLPlayer::YamahaXG) {
 				AppendMenu(hMenu, MF_STRING | MF_GRAYED, 0, TEXT("[MODE] Yamaha XG"));
 			}
+			{
+				// 前回メニューを開いてからの負荷
+				// --statsの定期出力がある場合は、そちらの集計期間を崩さないようにリセットしない
+				const OPLPlayer::RenderStats stats = g_player->renderStats(g_statsInterval == 0);
+				char line[160];
+				sprintf_s(line, "[DSP] %.1f%% (peak %.1f%%), %u misses, %u underruns",
+					stats.load * 100, stats.peakLoad * 100, stats.deadlineMisses, stats.underruns);
+				AppendMenuA(hMenu, MF_STRING | MF_GRAYED, 0, line);
+			}
 			AppendMenu(hMenu, MF_SEPARATOR, 0, nullptr);
 			AppendMenu(hMenu, MF_POPUP, (UINT_PTR)hSubMenuLPF, TEXT("Low-pass Filter"));
 			AppendMenu(hMenu, MF_SEPARATOR, 0, nullptr);
@@ -590,7 +696,7 @@ LRESULT CALLBACK TrayWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 			AppendMenu(hMenu, MF_STRING, ID_TRAY_RESTART, TEXT("Restart"));
 			AppendMenu(hMenu, MF_STRING, ID_TRAY_EXIT, TEXT("Exit"));
 
-			// Ă΂Ȃƃj[
+			// これを呼ばないとメニューが即消える
 			SetForegroundWindow(hwnd);
 
 			TrackPopupMenu(
@@ -620,40 +726,40 @@ LRESULT CALLBACK TrayWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 		{
 		case ID_TRAY_MIDIPANIC:
 			if (g_player) {
-				g_player->panic();
+				postPlayerCommand(g_player, OPLPlayer::CommandPanic);
 			}
 			return 0;
 		case ID_TRAY_GM_RESET:
 			if (g_player) {
-				g_player->resetMIDI(OPLPlayer::GeneralMIDI);
+				postPlayerCommand(g_player, OPLPlayer::CommandResetMIDI, OPLPlayer::GeneralMIDI);
 			}
 			return 0;
 		case ID_TRAY_GS_RESET:
 			if (g_player) {
-				g_player->resetMIDI(OPLPlayer::RolandGS);
+				postPlayerCommand(g_player, OPLPlayer::CommandResetMIDI, OPLPlayer::RolandGS);
 			}
 			return 0;
 		case ID_TRAY_XG_RESET:
 			if (g_player) {
-				g_player->resetMIDI(OPLPlayer::YamahaXG);
+				postPlayerCommand(g_player, OPLPlayer::CommandResetMIDI, OPLPlayer::YamahaXG);
 			}
 			return 0;
 		case ID_TRAY_LPF_OFF:
 			if (g_player) {
 				g_curLPFCutoff = LPF_CUTOFF_PRESET_OFF;
-				g_player->setLPFilter(g_curLPFCutoff);
+				postPlayerCommand(g_player, OPLPlayer::CommandLPFilter, g_curLPFCutoff);
 			}
 			return 0;
 		case ID_TRAY_LPF_LIGHT:
 			if (g_player) {
 				g_curLPFCutoff = LPF_CUTOFF_PRESET_LIGHT;
-				g_player->setLPFilter(g_curLPFCutoff);
+				postPlayerCommand(g_player, OPLPlayer::CommandLPFilter, g_curLPFCutoff);
 			}
 			return 0;
 		case ID_TRAY_LPF_STRONG:
 			if (g_player) {
 				g_curLPFCutoff = LPF_CUTOFF_PRESET_STRONG;
-				g_player->setLPFilter(g_curLPFCutoff);
+				postPlayerCommand(g_player, OPLPlayer::CommandLPFilter, g_curLPFCutoff);
 			}
 			return 0;
 		case ID_TRAY_ABOUT:
@@ -671,6 +777,15 @@ LRESULT CALLBACK TrayWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 		}
 		break;
 
+	case WM_TIMER:
+		if (wParam == ID_TIMER_STATS) {
+			// 負荷統計をデバッグ出力へ
+			const std::string line = "ymfmidiwin: " + formatRenderStats(g_player->renderStats(true)) + "\n";
+			OutputDebugStringA(line.c_str());
+			return 0;
+		}
+		break;
+
 	case WM_DESTROY:
 		quitPlayer(0);
 		PostQuitMessage(0);
@@ -741,6 +856,141 @@ void ShowErrorMessage(const char* fmt, ...)
 #endif
 }
 
+// ----------------------------------------------------------------------------
+static bool isPatchFile(const char* path)
+{
+	const char* fileext = strrchr(path, '.');
+	return fileext && (_stricmp(fileext, ".wopl") == 0 || _stricmp(fileext, ".opl") == 0 || _stricmp(fileext, ".op2") == 0 || _stricmp(fileext, ".tmb") == 0 || _stricmp(fileext, ".ad") == 0 || _stricmp(fileext, ".bin") == 0 || _stricmp(fileext, ".dll") == 0);
+}
+
+#ifdef YMFMIDI_CONSOLE
+// ----------------------------------------------------------------------------
+static int runBenchmarkMode(const char* outPath, const char* patchPath, int numFiles, char** files)
+{
+	BenchSettings settings;
+	for (int i = 0; i < numFiles; i++) {
+		if (isPatchFile(files[i]))
+			patchPath = files[i];
+		else if (_strnicmp(files[i], "//LOADGEN", 9) == 0)
+			settings.loadPath = files[i];
+		else
+			settings.songs.push_back(files[i]);
+	}
+
+	// exeと同じ場所にあればそれを使う
+	std::string exePatchPath = GetExeDirectory() + "\\GENMIDI.wopl";
+	if (GetFileAttributesA(patchPath) == INVALID_FILE_ATTRIBUTES)
+		patchPath = exePatchPath.c_str();
+	settings.patchPath = patchPath;
+
+	FILE* file = stdout;
+	if (strcmp(outPath, "-") != 0 && fopen_s(&file, outPath, "w"))
+	{
+		ShowErrorMessage("couldn't open %s\n", outPath);
+		return 1;
+	}
+	const bool ok = runBenchmarks(file, settings);
+	if (file != stdout)
+		fclose(file);
+	return ok ? 0 : 1;
+}
+
+// ----------------------------------------------------------------------------
+static int runGoldenMode(const char* goldenDir, bool update, int numFiles, char** files)
+{
+	// カレントになければexeと同じ場所のものを使う
+	std::string patchDir = "DMXOPL";
+	if (numFiles > 0)
+		patchDir = files[0];
+	else if (GetFileAttributesA(patchDir.c_str()) == INVALID_FILE_ATTRIBUTES)
+		patchDir = GetExeDirectory() + "\\DMXOPL";
+
+	if (update)
+		CreateDirectoryA(goldenDir, nullptr);
+	return runGoldenTests(goldenDir, patchDir.c_str(), update) ? 0 : 1;
+}
+
+// ----------------------------------------------------------------------------
+static int runLoadWriteMode(const char* outPath, const char* songPath, const char* patchPath)
+{
+	LoadSettings settings;
+	if (!parseLoadPath(settings, songPath))
+	{
+		ShowErrorMessage("invalid load: %s\n", songPath);
+		return 1;
+	}
+
+	int format = 0;
+	const char* ext = strrchr(outPath, '.');
+	while (format < NumSongFormats && (!ext || _stricmp(ext + 1, songFormatName((SongFormat)format)) != 0))
+		format++;
+	if (format == NumSongFormats)
+	{
+		ShowErrorMessage("unsupported song format: %s\n", outPath);
+		return 1;
+	}
+
+	// 4opの割合に使う (なければexeと同じ場所のもの、それもなければ音色は何でもよい)
+	OPLPatchSet patches;
+	if (!OPLPatch::load(patches, patchPath))
+		OPLPatch::load(patches, (GetExeDirectory() + "\\GENMIDI.wopl").c_str());
+
+	const std::vector<SongEvent> events = makeLoad(settings, patches.empty() ? nullptr : &patches);
+	const std::vector<uint8_t> data = writeSong(events, (SongFormat)format);
+
+	FILE* file = nullptr;
+	if (fopen_s(&file, outPath, "wb") || fwrite(data.data(), 1, data.size(), file) != data.size())
+	{
+		if (file)
+			fclose(file);
+		ShowErrorMessage("couldn't write %s\n", outPath);
+		return 1;
+	}
+	fclose(file);
+
+	printf("%s: %u events, %.1f seconds (%s)\n", outPath, songEventCount(events), songLength(events),
+		loadSettingsString(settings).c_str());
+	return 0;
+}
+#endif
+
+// ----------------------------------------------------------------------------
+static void writeTrace()
+{
+	if (!g_tracePath)
+		return;
+
+	FILE* file = nullptr;
+	if (fopen_s(&file, g_tracePath, "w"))
+	{
+		ShowErrorMessage("couldn't open %s\n", g_tracePath);
+		return;
+	}
+	prof::writeTrace(file);
+	fclose(file);
+}
+
+// ----------------------------------------------------------------------------
+static void writeProfile(const char* path)
+{
+	if (!path)
+		return;
+	
+	if (strcmp(path, "-") == 0) {
+		prof::dump(stdout);
+		return;
+	}
+	
+	FILE* file = nullptr;
+	if (fopen_s(&file, path, "w"))
+	{
+		ShowErrorMessage("couldn't open %s\n", path);
+		return;
+	}
+	prof::dump(file);
+	fclose(file);
+}
+
 // ----------------------------------------------------------------------------
 int main(int argc, char **argv)
 {
@@ -762,7 +1012,16 @@ int main(int argc, char **argv)
 	int numChips = 1;
 	unsigned songNum = 0;
 	bool stereo = true;
-	int suspendTimeMilliseconds = 15000; // 15bŃTXyh
+	bool drumCache = false;
+	int voiceReduction = 0;
+	int suspendTimeMilliseconds = 15000; // 15秒でサスペンド
+	int inputLatencyMilliseconds = 10;
+	int latencyTestNotes = 0;
+	const char* benchPath = nullptr;
+	const char* goldenDir = nullptr;
+	const char* loadWritePath = nullptr;
+	bool goldenUpdate = false;
+	const char* profilePath = nullptr;
 
 #ifdef YMFMIDI_CONSOLE
 	wprintf((std::wstring(L"ymfmidi for Windows v") + GetFileVersionString() + std::wstring(L" - " __DATE__ "\n")).c_str());
@@ -868,7 +1127,7 @@ int main(int argc, char **argv)
 			break;
 
 		case 't':
-			// ^XNgC풓[h
+			// タスクトレイ常駐モード
 #ifdef YMFMIDI_CONSOLE
 			ShowErrorMessage("--tray option detected.\n");
 			ShowErrorMessage("Please use ymfmidi-synth.exe\n");
@@ -880,13 +1139,13 @@ int main(int argc, char **argv)
 			break;
 
 		case 'p':
-			// TXyh
+			// サスペンド時間
 			suspendTimeMilliseconds = atoi(optarg);
 			break;
 
 		case 0:
 			if (strcmp(options[optionindex].name, "resampler") == 0) {
-				// TvOϊ^Cv
+				// サンプリング変換タイプ
 				if (strcmp(optarg, "linear") == 0) {
 					g_srconvtype = SRC_LINEAR;
 				}
@@ -904,7 +1163,7 @@ int main(int argc, char **argv)
 				}
 			}
 			else if (strcmp(options[optionindex].name, "tail-time") == 0) {
-				// WAVõ͎̖}[W
+				// WAV出力時の末尾のマージン時間
 				if (strcmp(optarg, "auto") == 0) {
 					g_wavOutputMarginAuto = true;
 				}
@@ -915,7 +1174,7 @@ int main(int argc, char **argv)
 				}
 			}
 			else if (strcmp(options[optionindex].name, "hpfilter") == 0) {
-				// nCpXtB^
+				// ハイパスフィルタ
 				hpfilter = atof(optarg);
 				if (hpfilter < 0.0)
 				{
@@ -924,7 +1183,7 @@ int main(int argc, char **argv)
 				}
 			}
 			else if (strcmp(options[optionindex].name, "lpfilter") == 0) {
-				// [pXtB^
+				// ローパスフィルタ
 				lpfilter = atof(optarg);
 				if (lpfilter < 0.0)
 				{
@@ -932,8 +1191,123 @@ int main(int argc, char **argv)
 					exit(1);
 				}
 			}
+			else if (strcmp(options[optionindex].name, "bits") == 0) {
+				// WAV出力のビット数
+				g_wavBitsPerSample = atoi(optarg);
+				if (g_wavBitsPerSample != 16 && g_wavBitsPerSample != 24)
+				{
+					ShowErrorMessage("invalid bits per sample: %s\n", optarg);
+					exit(1);
+				}
+			}
+			else if (strcmp(options[optionindex].name, "dither") == 0) {
+				// WAV出力にディザをかける
+				g_wavDither = true;
+			}
+			else if (strcmp(options[optionindex].name, "stems") == 0) {
+				// MIDIチャンネル毎に分けてWAV出力
+				if (strcmp(optarg, "multi") == 0) {
+					g_wavStems = WAV_STEMS_MULTI;
+				}
+				else if (strcmp(optarg, "split") == 0) {
+					g_wavStems = WAV_STEMS_SPLIT;
+				}
+				else {
+					ShowErrorMessage("invalid stems mode: %s\n", optarg);
+					exit(1);
+				}
+			}
+			else if (strcmp(options[optionindex].name, "drum-cache") == 0) {
+				// ドラムをキャッシュしたサンプルで鳴らす
+				drumCache = true;
+			}
+			else if (strcmp(options[optionindex].name, "reduce-voices") == 0) {
+				// 空きボイスが少ないときは2ボイスの音色を1ボイスで鳴らす
+				voiceReduction = atoi(optarg);
+				if (voiceReduction < 0)
+				{
+					ShowErrorMessage("invalid voice reduction: %s\n", optarg);
+					exit(1);
+				}
+			}
+			else if (strcmp(options[optionindex].name, "control-thread") == 0) {
+				// MIDI処理を別スレッドで行う
+				g_controlThread = true;
+			}
+			else if (strcmp(options[optionindex].name, "latency") == 0) {
+				// MIDI INの遅延時間
+				inputLatencyMilliseconds = atoi(optarg);
+				if (inputLatencyMilliseconds < 0)
+				{
+					ShowErrorMessage("invalid latency: %s\n", optarg);
+					exit(1);
+				}
+			}
+			else if (strcmp(options[optionindex].name, "latency-test") == 0) {
+				// 遅延時間の測定
+#ifdef YMFMIDI_CONSOLE
+				latencyTestNotes = atoi(optarg);
+				if (latencyTestNotes < 1)
+				{
+					ShowErrorMessage("invalid number of notes: %s\n", optarg);
+					exit(1);
+				}
+				interactive = false;
+#else
+				MessageBoxW(NULL, L"Please use ymfmidiwin (console version) to measure the latency.", L"ymfmidiwin-synth", MB_OK | MB_ICONINFORMATION);
+				return 1;
+#endif
+			}
+			else if (strcmp(options[optionindex].name, "bench") == 0) {
+				// ベンチマーク
+#ifdef YMFMIDI_CONSOLE
+				benchPath = optarg;
+#else
+				MessageBoxW(NULL, L"Please use ymfmidiwin (console version) to run the benchmarks.", L"ymfmidiwin-synth", MB_OK | MB_ICONINFORMATION);
+				return 1;
+#endif
+			}
+			else if (strcmp(options[optionindex].name, "golden-write") == 0
+				|| strcmp(options[optionindex].name, "golden-check") == 0) {
+				// 回帰テスト (基準出力の作成/比較)
+#ifdef YMFMIDI_CONSOLE
+				goldenDir = optarg;
+				goldenUpdate = strcmp(options[optionindex].name, "golden-write") == 0;
+#else
+				MessageBoxW(NULL, L"Please use ymfmidiwin (console version) to run the regression tests.", L"ymfmidiwin-synth", MB_OK | MB_ICONINFORMATION);
+				return 1;
+#endif
+			}
+			else if (strcmp(options[optionindex].name, "loadgen-write") == 0) {
+				// 生成した負荷の曲ファイル出力
+#ifdef YMFMIDI_CONSOLE
+				loadWritePath = optarg;
+#else
+				MessageBoxW(NULL, L"Please use ymfmidiwin (console version) to write the load.", L"ymfmidiwin-synth", MB_OK | MB_ICONINFORMATION);
+				return 1;
+#endif
+			}
+			else if (strcmp(options[optionindex].name, "profile") == 0) {
+				// プロファイル結果の出力先
+				profilePath = optarg;
+				prof::setEnabled(true);
+			}
+			else if (strcmp(options[optionindex].name, "trace") == 0) {
+				// トレースの出力先
+				g_tracePath = optarg;
+				prof::setTracing(true);
+			}
+			else if (strcmp(options[optionindex].name, "stats") == 0) {
+				// 負荷統計の出力間隔
+				g_statsInterval = atoi(optarg);
+				if (g_statsInterval < 1)
+				{
+					ShowErrorMessage("invalid stats interval: %s\n", optarg);
+					exit(1);
+				}
+			}
 			else if (strcmp(options[optionindex].name, "bufms") == 0) {
-				// obt@TCY~bw
+				// バッファサイズミリ秒指定
 				uint64_t bufferSizeMilliseconds = atof(optarg);
 				if (bufferSizeMilliseconds < 0)
 				{
@@ -948,11 +1322,28 @@ int main(int argc, char **argv)
 	}
 
 #ifdef YMFMIDI_CONSOLE
-	if (optind >= argc) {
+	if (benchPath) {
+		// 引数は追加で測る曲ファイルとパッチファイル
+		return runBenchmarkMode(benchPath, patchPath, argc - optind, argv + optind);
+	}
+	if (goldenDir) {
+		// 引数はDMXOPLのディレクトリ
+		return runGoldenMode(goldenDir, goldenUpdate, argc - optind, argv + optind);
+	}
+	if (latencyTestNotes > 0) {
+		// MIDI INはテスト自身が送るので、引数はパッチファイル
+		songPath = "//MIDIIN:loopback";
+		if (optind < argc) {
+			patchPath = argv[optind];
+		}
+	}
+	else if (optind >= argc) {
 		usage();
 		return 1;
 	}
-	songPath = argv[optind];
+	else {
+		songPath = argv[optind];
+	}
 #else
 	if (optind >= argc) {
 		songPath = "//MIDIIN";
@@ -962,23 +1353,30 @@ int main(int argc, char **argv)
 	}
 #endif
 
-	if (optind + 1 < argc) {
+	if (g_controlThread && drumCache) {
+		ShowErrorMessage("--control-thread cannot be used with --drum-cache\n");
+		exit(1);
+	}
+
+	if (optind + 1 < argc && !latencyTestNotes) {
 		patchPath = argv[optind + 1];
 	}
 
-	{
-		const char* fileext = strrchr(songPath, '.');
-		if (fileext && (_stricmp(fileext, ".wopl") == 0 || _stricmp(fileext, ".opl") == 0 || _stricmp(fileext, ".op2") == 0 || _stricmp(fileext, ".tmb") == 0 || _stricmp(fileext, ".ad") == 0 || _stricmp(fileext, ".bin") == 0 || _stricmp(fileext, ".dll") == 0)) {
-			const char* tmp = patchPath;
-			patchPath = songPath;
-			songPath = tmp;
-		}
+	if (isPatchFile(songPath)) {
+		const char* tmp = patchPath;
+		patchPath = songPath;
+		songPath = tmp;
 	}
 #ifndef YMFMIDI_CONSOLE
 	if (_stricmp(songPath, "GENMIDI.wopl") == 0) {
 		songPath = "//MIDIIN";
 	}
 #endif
+#ifdef YMFMIDI_CONSOLE
+	if (loadWritePath) {
+		return runLoadWriteMode(loadWritePath, songPath, patchPath);
+	}
+#endif
 	
 	auto player = new OPLPlayer(numChips, chipType);
 	
@@ -992,7 +1390,7 @@ int main(int argc, char **argv)
 
 	const char* patchFileNameExt = strrchr(patchPath, '.');
 	if (patchFileNameExt && (_stricmp(patchFileNameExt, ".bin") == 0 || _stricmp(patchFileNameExt, ".dll") == 0)) {
-		// WinFMn̓h肭Ȃ̂GENMIDIǂށEEE
+		// WinFM系はドラムが上手く鳴らないのでGENMIDIから読む・・・
 		std::string path = GetExeDirectory();
 		path += "\\GENMIDI.op2";
 		if (!player->loadPatches(path.c_str()))
@@ -1000,9 +1398,9 @@ int main(int argc, char **argv)
 			std::string path = GetExeDirectory();
 			path += "\\GENMIDI.wopl";
 			player->loadPatches(path.c_str());
-			// sĂ
+			// 失敗しても無視
 		}
-		// ̌FMSYNTH.BINŏ㏑
+		// その後でFMSYNTH.BINで上書き
 		if (!player->loadPatches(patchPath))
 		{
 			ShowErrorMessage("couldn't load %s\n", patchPath);
@@ -1013,7 +1411,7 @@ int main(int argc, char **argv)
 	}
 	else if (!player->loadPatches(patchPath))
 	{
-		// exeƓꏊɂ΂g
+		// exeと同じ場所にあればそれを使う
 		std::string path = GetExeDirectory();
 		path += "\\GENMIDI.wopl";
 		if (!player->loadPatches(path.c_str()))
@@ -1034,9 +1432,12 @@ int main(int argc, char **argv)
 	player->setHPFilter(hpfilter);
 	player->setLPFilter(lpfilter);
 	player->setStereo(stereo);
+	player->setDrumCache(drumCache, wavPath == nullptr);
+	player->setVoiceReduction(voiceReduction);
 	if (songNum > 0)
 		player->setSongNum(songNum - 1);
 	player->setAutoSuspend(suspendTimeMilliseconds);
+	player->setInputLatency(inputLatencyMilliseconds);
 
 	g_curLPFCutoff = lpfilter;
 
@@ -1055,13 +1456,31 @@ int main(int argc, char **argv)
 
 	signal(SIGINT, quitPlayer);
 
-	if (wavPath) 
+	if (latencyTestNotes > 0)
 	{
-		if (memcmp(songPath, "//", 2) != 0) {
+		// WASAPIと同じバッファサイズの決め方
+		const uint64_t bufferTime = g_buffersizeNanoseconds != 0 ? g_buffersizeNanoseconds : (uint64_t)10000000 * bufferSize / sampleRate;
+		LatencyTestSettings settings;
+		settings.numNotes = latencyTestNotes;
+		settings.outputRate = sampleRate;
+		settings.bufferFrames = (uint32_t)(bufferTime * sampleRate / 10000000);
+		if (settings.bufferFrames < 1) settings.bufferFrames = 1;
+		settings.resampler = g_srconvtype;
+
+		const bool ok = runLatencyTest(player, settings);
+		writeProfile(profilePath);
+		writeTrace();
+		delete player;
+		return ok ? 0 : 1;
+	}
+	else if (wavPath) 
+	{
+		const bool loadgen = _strnicmp(songPath, "//LOADGEN", 9) == 0;
+		if (memcmp(songPath, "//", 2) != 0 || loadgen) {
 			char wavPathTmp[MAX_PATH] = { 0 };
 			if (strcmp(wavPath, ".") == 0) {
-				// ŖOt
-				strcpy_s(wavPathTmp, songPath);
+				// 自動で名前を付ける
+				strcpy_s(wavPathTmp, loadgen ? "loadgen" : songPath);
 				char* sepa = strrchr(wavPathTmp, '\\');
 				char* ext = strrchr(wavPathTmp, '.');
 				if (ext && ext > sepa) {
@@ -1092,6 +1511,8 @@ int main(int argc, char **argv)
 		}
 	}
 
+	writeProfile(profilePath);
+	writeTrace();
 	delete player;
 
 	return 0;
@@ -1154,7 +1575,7 @@ static void mainLoopSDL(OPLPlayer *player, int bufferSize, bool interactive)
 	if (interactive)
 	{
 		consolePos(2);
-		printf("\ncontrols: [p] pause, [r] restart, [tab] change view, [esc/q] quit\n");
+		printf("\ncontrols: [p] pause, [r] restart, [tab] view, [i] profile, [t] trace, [esc/q] quit\n");
 	}
 
 	SDL_PauseAudio(0);
@@ -1192,7 +1613,7 @@ static void mainLoopSDL(OPLPlayer *player, int bufferSize, bool interactive)
 			case 'r':
 				g_paused = false;
 				SDL_PauseAudio(0);
-				player->reset();
+				postPlayerCommand(player, OPLPlayer::CommandReset);
 				break;
 				
 			case 0x09:
@@ -1201,14 +1622,26 @@ static void mainLoopSDL(OPLPlayer *player, int bufferSize, bool interactive)
 				player->displayClear();
 				break;
 			
+			case 'i':
+				// プロファイル表示の切り替え
+				prof::setEnabled(!prof::enabled());
+				consolePos(5);
+				player->displayClear();
+				break;
+			
+			case 't':
+				// ここまでのトレースを書き出す
+				writeTrace();
+				break;
+			
 			case -'D':
 				if (player->songNum() > 0)
-					player->setSongNum(player->songNum() - 1);
+					postPlayerCommand(player, OPLPlayer::CommandSongNum, player->songNum() - 1);
 				break;
 
 			case -'C':
 				if (player->songNum() < player->numSongs() - 1)
-					player->setSongNum(player->songNum() + 1);
+					postPlayerCommand(player, OPLPlayer::CommandSongNum, player->songNum() + 1);
 				break;
 			}
 		}
@@ -1220,22 +1653,147 @@ static void mainLoopSDL(OPLPlayer *player, int bufferSize, bool interactive)
 #endif
 
 // ----------------------------------------------------------------------------
-static void mainLoopWAV(OPLPlayer *player, const char *path, bool interactive)
+// WAVヘッダのサイズ（3ch以上はWAVE_FORMAT_EXTENSIBLE）
+static unsigned wavHeaderSize(int nChannels)
+{
+	return nChannels > 2 ? 68 : 44;
+}
+
+// ----------------------------------------------------------------------------
+static void writeWAVHeader(FILE *wav, uint32_t sampleRate, int nChannels, uint32_t numSamples)
 {
-	FILE* wav;
-	if (fopen_s(&wav, path, "wb"))
+	const unsigned bytesPerSample = nChannels * (g_wavBitsPerSample / 8); // 1フレームのバイト数
+	const unsigned headerSize = wavHeaderSize(nChannels);
+	const unsigned fmtSize = headerSize - 28; // 16 or 40
+	const uint32_t byteRate = sampleRate * bytesPerSample;
+	const uint32_t dataSize = numSamples * bytesPerSample;
+	const uint32_t wavSize = dataSize + headerSize - 8;
+	
+	char header[68] = {0};
+	
+	header[0] = 'R';
+	header[1] = 'I';
+	header[2] = 'F';
+	header[3] = 'F';
+	header[4] = (char)(wavSize);
+	header[5] = (char)(wavSize >> 8);
+	header[6] = (char)(wavSize >> 16);
+	header[7] = (char)(wavSize >> 24);
+	header[8]  = 'W';
+	header[9]  = 'A';
+	header[10] = 'V';
+	header[11] = 'E';
+	
+	// format chunk
+	header[12] = 'f';
+	header[13] = 'm';
+	header[14] = 't';
+	header[15] = ' ';
+	header[16] = fmtSize; // chunk size
+	if (nChannels > 2)
 	{
-		ShowErrorMessage("couldn't open %s\n", path);
+		header[20] = (char)0xFE; // sample format (WAVE_FORMAT_EXTENSIBLE)
+		header[21] = (char)0xFF;
+	}
+	else
+	{
+		header[20] = 1;  // sample format (PCM)
+	}
+	header[22] = nChannels;
+	header[24] = (char)(sampleRate);
+	header[25] = (char)(sampleRate >> 8);
+	header[26] = (char)(sampleRate >> 16);
+	header[27] = (char)(sampleRate >> 24);
+	header[28] = (char)(byteRate);
+	header[29] = (char)(byteRate >> 8);
+	header[30] = (char)(byteRate >> 16);
+	header[31] = (char)(byteRate >> 24);
+	header[32] = (char)(bytesPerSample);      // bytes per sample (all channels)
+	header[33] = (char)(bytesPerSample >> 8);
+	header[34] = g_wavBitsPerSample; // bits per sample
+	
+	if (nChannels > 2)
+	{
+		// extension: valid bits, channel mask (0 = no speaker assignment), KSDATAFORMAT_SUBTYPE_PCM
+		static const uint8_t subtypePCM[16] = {
+			0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+			0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71
+		};
+		header[36] = 22; // extension size
+		header[38] = g_wavBitsPerSample;
+		memcpy(header + 44, subtypePCM, sizeof(subtypePCM));
+	}
+	
+	// data chunk
+	char *data = header + 20 + fmtSize;
+	data[0] = 'd';
+	data[1] = 'a';
+	data[2] = 't';
+	data[3] = 'a';
+	data[4] = (char)(dataSize);
+	data[5] = (char)(dataSize >> 8);
+	data[6] = (char)(dataSize >> 16);
+	data[7] = (char)(dataSize >> 24);
+	
+	fseek(wav, 0, SEEK_SET);
+	if (fwrite(header, 1, headerSize, wav) != headerSize)
+	{
+		ShowErrorMessage("writing WAV header failed\n");
 		exit(1);
 	}
+}
+
+// ----------------------------------------------------------------------------
+static void mainLoopWAV(OPLPlayer *player, const char *path, bool interactive)
+{
+	const int nChannels = player->stereo() ? 2 : 1;
+	const int numBuses = (g_wavStems != WAV_STEMS_OFF) ? OPLPlayer::numStems : 1; // MIDIチャンネル毎に分ける場合はステレオ x 16
+	const int srcChannels = nChannels * numBuses; // SR変換するチャンネル数
+	const int fileChannels = (g_wavStems == WAV_STEMS_SPLIT) ? nChannels : srcChannels; // 1ファイルのチャンネル数
+	const unsigned bytesPerSample = fileChannels * (g_wavBitsPerSample / 8); // 1フレームのバイト数
 	
-	printf("rendering %s...\n", path);
+	// 出力ファイル
+	struct WAVOutput
+	{
+		FILE *wav;
+		std::string path;
+		float peak;
+	};
+	std::vector<WAVOutput> outputs;
+	if (g_wavStems == WAV_STEMS_SPLIT)
+	{
+		// foo.wav -> foo_ch01.wav ... foo_ch16.wav
+		std::string base(path);
+		const size_t sepa = base.find_last_of("\\/");
+		const size_t ext = base.find_last_of('.');
+		if (ext != std::string::npos && (sepa == std::string::npos || ext > sepa))
+			base.resize(ext);
+		for (int i = 0; i < numBuses; i++)
+		{
+			char suffix[16];
+			sprintf_s(suffix, "_ch%02d.wav", i + 1);
+			outputs.push_back({ nullptr, base + suffix, 0.0f });
+		}
+	}
+	else
+	{
+		outputs.push_back({ nullptr, path, 0.0f });
+	}
 	
-	fseek(wav, 44, SEEK_SET);
+	for (auto& output : outputs)
+	{
+		if (fopen_s(&output.wav, output.path.c_str(), "wb"))
+		{
+			ShowErrorMessage("couldn't open %s\n", output.path.c_str());
+			exit(1);
+		}
+		
+		printf("rendering %s...\n", output.path.c_str());
+		
+		fseek(output.wav, wavHeaderSize(fileChannels), SEEK_SET);
+	}
 	
 	uint32_t numSamples = 0;
-	const int nChannels = player->stereo() ? 2 : 1;
-	const unsigned bytesPerSample = nChannels * 2;
 	const uint32_t sampleRate = player->sampleRate();
 	const int displayStep = sampleRate / 10;
 
@@ -1243,20 +1801,26 @@ static void mainLoopWAV(OPLPlayer *player, const char *path, bool interactive)
 	int err = 0;
 	SRC_STATE* src = src_new(
 		g_srconvtype,
-		player->stereo() ? 2 : 1,
+		srcChannels,
 		&err);
 
-	double ratio = (double)sampleRate / INTERNAL_SR;
+	// プレーヤーはOPLのネイティブレートで出力し、SR変換はlibsamplerateの1段だけにする
+	const uint32_t internalRate = player->nativeSampleRate();
+	double ratio = (double)sampleRate / internalRate;
 
-	player->setSampleRate(INTERNAL_SR); // OPL original rate
+	player->setSampleRate(internalRate); // OPL original rate
+	player->setStemMode(g_wavStems != WAV_STEMS_OFF);
 
+	const int frameSize = numBuses * 2; // generate()の出力は常にステレオ
 	const int inBufferSamples = 4096;
-	const int outBufferSamples = inBufferSamples * ratio + 64; // }[WtĂ
-	std::vector<float> in(inBufferSamples * nChannels);
-	std::vector<float> out(outBufferSamples * nChannels);
-	std::vector<uint16_t> out16(outBufferSamples * nChannels);
-
-	// TvOϊP̂߂ɖf[^荞ł
+	const int outBufferSamples = inBufferSamples * ratio + 64; // マージン付けておく
+	std::vector<float> in(inBufferSamples * frameSize);
+	std::vector<float> out(outBufferSamples * srcChannels);
+	std::vector<float> outFile(outBufferSamples * fileChannels);
+	std::vector<uint8_t> outPCM(outBufferSamples * bytesPerSample);
+	dsp::Dither dither;
+
+	// サンプリング変換改善のために無音データを放り込んでおく
 	{
 		SRC_DATA d{};
 		for (int i = 0; i < inBufferSamples; i++) {
@@ -1270,43 +1834,61 @@ static void mainLoopWAV(OPLPlayer *player, const char *path, bool interactive)
 	}
 
 	const int outwavMaxAmpitude = 32767;
-	const float noSoundThreshold = 1.0f / outwavMaxAmpitude; // ƌ􂷉
+	const float noSoundThreshold = 1.0f / outwavMaxAmpitude; // 無音と見做す音量
 	int lastDispPos = 0;
-	int extendSamples = g_wavOutputMarginAuto ? (INTERNAL_SR * 5) : (int)((int64_t)g_wavOutputMarginMillisecond * INTERNAL_SR / 1000); // w肵Ԃ̂΂BŖT̂5bȓ
+	int extendSamples = g_wavOutputMarginAuto ? (internalRate * 5) : (int)((int64_t)g_wavOutputMarginMillisecond * internalRate / 1000); // 指定した時間のばす。自動で末尾を探すのは5秒以内
 	int zeroCounter = 0;
 	bool endOutput = false;
 	while ((!player->atEnd() || extendSamples > 0) && g_running && !endOutput)
 	{
-		uint32_t inBufferCount = 0;
-		for (int i = 0; i < inBufferSamples; i++) {
-			in[i * 2] = in[i * 2 + 1] = 0;
-			float* data = in.data() + i * 2;
-			player->generate(data, 1);
-			inBufferCount++;
-			if (player->atEnd() || !g_running) {
+		// ブロック単位で生成
+		uint32_t inBufferCount = inBufferSamples;
+		if (g_wavStems != WAV_STEMS_OFF)
+			player->generateStems(in.data(), inBufferSamples);
+		else
+			player->generate(in.data(), inBufferSamples);
+		if (player->atEnd() || !g_running) {
+			// 余韻は曲の終わったフレームから数える (それより前はブロックの途中でも曲の一部)
+			const int endFrame = player->atEnd() ? (int)player->framesBeforeEnd() : 0;
+			for (int i = endFrame; i < inBufferSamples; i++) {
+				const float* data = in.data() + i * frameSize;
 				if (extendSamples > 0) {
 					extendSamples--;
 				}
 				else {
 					endOutput = true;
+					inBufferCount = i;
 					break;
 				}
-				if (-noSoundThreshold <= data[0] && data[0] <= noSoundThreshold &&
-					-noSoundThreshold <= data[1] && data[1] <= noSoundThreshold) {
+				bool noSound = true;
+				for (int j = 0; j < frameSize; j++) {
+					if (data[j] < -noSoundThreshold || noSoundThreshold < data[j]) {
+						noSound = false;
+						break;
+					}
+				}
+				if (noSound) {
 					zeroCounter++;
 				}
 				else {
 					zeroCounter = 0;
 				}
-				if (g_wavOutputMarginAuto && zeroCounter >= INTERNAL_SR / 10) {
-					// INTERNAL_SR / 10 Tv = 0.1bȂIƌ
+				if (g_wavOutputMarginAuto && zeroCounter >= internalRate / 10) {
+					// internalRate / 10 サンプル = 0.1秒無音なら終了と見做す
 					endOutput = true;
+					inBufferCount = i + 1;
 					break;
 				}
 			}
 		}
+		if (nChannels == 1) {
+			// モノラルは左チャンネルだけ使う
+			for (uint32_t i = 0; i < inBufferCount * numBuses; i++) {
+				in[i] = in[i * 2];
+			}
+		}
 
-		// --- SR ϊ ---
+		// --- SR 変換 ---
 		SRC_DATA d{};
 		d.data_in = in.data();
 		d.input_frames = min(inBufferSamples, inBufferCount);
@@ -1314,21 +1896,42 @@ static void mainLoopWAV(OPLPlayer *player, const char *path, bool interactive)
 		d.output_frames = outBufferSamples;
 		d.src_ratio = ratio;
 
-		src_process(src, &d);
+		{
+			prof::Scope profile(prof::StageResample);
+			src_process(src, &d);
+		}
 
 		const int gensamples = d.output_frames_gen;
-		const int count = d.output_frames_gen * nChannels;
-		for (int i = 0; i < count; i++) {
-			float f1 = out[i] * outwavMaxAmpitude;
-			if (f1 < -outwavMaxAmpitude) f1 = -outwavMaxAmpitude;
-			if (f1 > +outwavMaxAmpitude) f1 = +outwavMaxAmpitude;
-			out16[i] = (uint16_t)round(f1);
-		}
+		const int count = d.output_frames_gen * fileChannels;
+		for (int k = 0; k < (int)outputs.size(); k++) {
+			auto& output = outputs[k];
+			const float* data = out.data();
+			if (outputs.size() > 1) {
+				// k番目のバスだけ取り出す
+				for (int i = 0; i < gensamples; i++) {
+					for (int j = 0; j < fileChannels; j++) {
+						outFile[i * fileChannels + j] = out[(i * numBuses + k) * fileChannels + j];
+					}
+				}
+				data = outFile.data();
+			}
+			for (int i = 0; i < count; i++) {
+				output.peak = max(output.peak, fabsf(data[i]));
+			}
 
-		if (fwrite(out16.data(), bytesPerSample, gensamples, wav) != gensamples)
-		{
-			ShowErrorMessage("writing WAV data failed\n");
-			exit(1);
+			if (g_wavBitsPerSample == 24) {
+				dsp::toInt24(data, outPCM.data(), count, g_wavDither ? &dither : nullptr);
+			}
+			else {
+				dsp::toInt16(data, reinterpret_cast<int16_t*>(outPCM.data()), count, g_wavDither ? &dither : nullptr);
+			}
+
+			prof::Scope profile(prof::StageSink);
+			if (fwrite(outPCM.data(), bytesPerSample, gensamples, output.wav) != gensamples)
+			{
+				ShowErrorMessage("writing WAV data failed\n");
+				exit(1);
+			}
 		}
 		numSamples += gensamples;
 
@@ -1351,65 +1954,17 @@ static void mainLoopWAV(OPLPlayer *player, const char *path, bool interactive)
 	}
 	
 	// fill in the rendered sample size and write the header
-	const uint32_t byteRate = sampleRate * bytesPerSample;
-	const uint32_t dataSize = numSamples * bytesPerSample;
-	const uint32_t wavSize = dataSize + 36;
-	
-	char header[44] = {0};
-	
-	header[0] = 'R';
-	header[1] = 'I';
-	header[2] = 'F';
-	header[3] = 'F';
-	header[4] = (char)(wavSize);
-	header[5] = (char)(wavSize >> 8);
-	header[6] = (char)(wavSize >> 16);
-	header[7] = (char)(wavSize >> 24);
-	header[8]  = 'W';
-	header[9]  = 'A';
-	header[10] = 'V';
-	header[11] = 'E';
-	
-	// format chunk
-	header[12] = 'f';
-	header[13] = 'm';
-	header[14] = 't';
-	header[15] = ' ';
-	header[16] = 16; // chunk size
-	header[20] = 1;  // sample format (PCM)
-	if (bytesPerSample == 4)
-		header[22] = 2;  // stereo
-	else
-		header[22] = 1;  // mono
-	header[24] = (char)(sampleRate);
-	header[25] = (char)(sampleRate >> 8);
-	header[26] = (char)(sampleRate >> 16);
-	header[27] = (char)(sampleRate >> 24);
-	header[28] = (char)(byteRate);
-	header[29] = (char)(byteRate >> 8);
-	header[30] = (char)(byteRate >> 16);
-	header[31] = (char)(byteRate >> 24);
-	header[32] = 4;  // bytes per sample
-	header[34] = 16; // bits per sample
-	
-	// data chunk
-	header[36] = 'd';
-	header[37] = 'a';
-	header[38] = 't';
-	header[39] = 'a';
-	header[40] = (char)(dataSize);
-	header[41] = (char)(dataSize >> 8);
-	header[42] = (char)(dataSize >> 16);
-	header[43] = (char)(dataSize >> 24);
-	
-	fseek(wav, 0, SEEK_SET);
-	if (fwrite(header, 1, sizeof(header), wav) != sizeof(header))
+	for (auto& output : outputs)
 	{
-		ShowErrorMessage("writing WAV header failed\n");
-		exit(1);
+		writeWAVHeader(output.wav, sampleRate, fileChannels, numSamples);
+		fclose(output.wav);
+		
+		if (outputs.size() > 1 && output.peak < noSoundThreshold)
+		{
+			// 使われていないチャンネルのファイルは消す
+			remove(output.path.c_str());
+		}
 	}
-	
-	fclose(wav);
 }
 
 #ifndef USE_SDL
@@ -1438,7 +1993,7 @@ public:
 		return E_NOINTERFACE;
 	}
 
-	// foCXύX
+	// 既定デバイス変更
 	HRESULT STDMETHODCALLTYPE OnDefaultDeviceChanged(
 		EDataFlow flow,
 		ERole role,
@@ -1450,7 +2005,7 @@ public:
 		return S_OK;
 	}
 
-	// gpłK{
+	// 未使用でも実装必須
 	HRESULT STDMETHODCALLTYPE OnDeviceAdded(LPCWSTR) override { return S_OK; }
 	HRESULT STDMETHODCALLTYPE OnDeviceRemoved(LPCWSTR) override { return S_OK; }
 	HRESULT STDMETHODCALLTYPE OnDeviceStateChanged(LPCWSTR, DWORD) override { return S_OK; }
@@ -1460,7 +2015,7 @@ public:
 // ----------------------------------------------------------------------------
 void StartWasapiAudio(OPLPlayer *player)
 {
-	// --- WASAPI  ---
+	// --- WASAPI 初期化 ---
 	IMMDeviceEnumerator* enumerator = nullptr;
 	IMMDevice* device = nullptr;
 	IAudioClient* audioClient = nullptr;
@@ -1551,7 +2106,7 @@ void StartWasapiAudio(OPLPlayer *player)
 			goto finalize;
 		}
 		else {
-			double ratio = (double)mixFmt->nSamplesPerSec / INTERNAL_SR;
+			double ratio = (double)mixFmt->nSamplesPerSec / player->sampleRate();
 
 			// --- FIFO ---
 			std::vector<float> fifo;
@@ -1580,18 +2135,28 @@ void StartWasapiAudio(OPLPlayer *player)
 			DWORD taskIndex = 0;
 			hAvrt = AvSetMmThreadCharacteristicsW(L"Pro Audio", &taskIndex);
 
+			// 負荷統計: デバイス周期ごとの処理時間と、デバイスのバッファが空になった回数
+			REFERENCE_TIME devicePeriod = 0;
+			audioClient->GetDevicePeriod(&devicePeriod, nullptr);
+			const double periodSeconds = devicePeriod / 10000000.0;
+			LARGE_INTEGER perfFreq, cycleStart;
+			QueryPerformanceFrequency(&perfFreq);
+			bool cycleStarted = false;
+			bool outputStarted = false;
+
 			while (g_running && !g_restart)
 			{
 				if (g_paused)
 				{
 					Sleep(100);
+					cycleStarted = outputStarted = false;
 					continue;
 				}
 
 				int sampleremain = fifosamples - fifo.size() / mixFmt->nChannels;
 				if (sampleremain > 0)
 				{
-					// --- g` ---
+					// --- 波形生成 ---
 					int samples = min(inBufferSamples, sampleremain);
 					player->generate(reinterpret_cast<float*>(in.data()), samples);
 
@@ -1603,13 +2168,13 @@ void StartWasapiAudio(OPLPlayer *player)
 						if (g_sleeping) {
 							g_sleeping = false;
 							PostMessage(g_hWnd, WM_USER_UPDATETRAYICON, 0, 0);
-							hr = audioClient->Reset(); // o̓obt@Zbg
+							hr = audioClient->Reset(); // 出力バッファリセット
 							if (FAILED(hr)) {
 								Sleep(1000);
 								g_restart = true;
 								goto finalize;
 							}
-							hr = audioClient->Start(); // o͂ĊJ
+							hr = audioClient->Start(); // 出力を再開する
 							if (FAILED(hr)) {
 								Sleep(1000);
 								g_restart = true;
@@ -1617,7 +2182,7 @@ void StartWasapiAudio(OPLPlayer *player)
 							}
 							hAvrt = AvSetMmThreadCharacteristicsW(L"Pro Audio", &taskIndex);
 
-							// obt@0Ŗ߂Ă
+							// バッファを0で埋めておく
 							UINT32 initPadding = 0;
 							hr = audioClient->GetCurrentPadding(&initPadding);
 							if (FAILED(hr)) {
@@ -1645,7 +2210,7 @@ void StartWasapiAudio(OPLPlayer *player)
 							}
 						}
 
-						// --- SR ϊ ---
+						// --- SR 変換 ---
 						SRC_DATA d{};
 						d.data_in = in.data();
 						d.input_frames = samples;
@@ -1653,7 +2218,10 @@ void StartWasapiAudio(OPLPlayer *player)
 						d.output_frames = outBufferSamples;
 						d.src_ratio = ratio;
 
-						src_process(srconv, &d);
+						{
+							prof::Scope profile(prof::StageResample);
+							src_process(srconv, &d);
+						}
 
 						fifo.insert(
 							fifo.end(),
@@ -1665,7 +2233,7 @@ void StartWasapiAudio(OPLPlayer *player)
 						if (!g_sleeping) {
 							g_sleeping = true;
 							PostMessage(g_hWnd, WM_USER_UPDATETRAYICON, 0, 0);
-							hr = audioClient->Stop(); // o͂~
+							hr = audioClient->Stop(); // 出力を停止する
 							if (FAILED(hr)) {
 								Sleep(1000);
 								g_restart = true;
@@ -1675,16 +2243,17 @@ void StartWasapiAudio(OPLPlayer *player)
 								AvRevertMmThreadCharacteristics(hAvrt);
 								hAvrt = nullptr;
 							}
-							// obt@قږ܂ĂԂƂĂ@ĊJ̒x
+							// バッファがほぼ埋まっている状態としておく　再開時の遅延回避
 							fifo.assign(fifosamples * mixFmt->nChannels * 19 / 20, 0);
+							cycleStarted = outputStarted = false;
 						}
 						if (g_hEventWakeUp && player->getSequencerWakeupEvent()) {
-							// CxgIuWFNgőҋ@\
+							// イベントオブジェクトで待機可能
 							HANDLE handles[] = { g_hEventWakeUp, (HANDLE)player->getSequencerWakeupEvent() };
 							WaitForMultipleObjects(sizeof(handles) / sizeof(handles[0]), handles, FALSE, INFINITE);
 						}
 						else {
-							// |[Oőҋ@
+							// ポーリングで待機
 							Sleep(100);
 						}
 						continue;
@@ -1696,7 +2265,7 @@ void StartWasapiAudio(OPLPlayer *player)
 					continue;
 				}
 
-				// --- WASAPI o ---
+				// --- WASAPI 出力 ---
 				UINT32 padding = 0;
 				hr = audioClient->GetCurrentPadding(&padding);
 				if (FAILED(hr)) {
@@ -1707,8 +2276,19 @@ void StartWasapiAudio(OPLPlayer *player)
 
 				UINT32 framesAvailable = bufferFrames - padding;
 
-				if (framesAvailable < bufferFrames / 2 && WaitForSingleObject(hAudioEvent, 200) == WAIT_TIMEOUT) {
-					continue;
+				if (framesAvailable < bufferFrames / 2) {
+					// 前の周期の処理時間
+					LARGE_INTEGER now;
+					QueryPerformanceCounter(&now);
+					if (cycleStarted)
+						player->reportOutputCycle((double)(now.QuadPart - cycleStart.QuadPart) / perfFreq.QuadPart, periodSeconds);
+
+					if (WaitForSingleObject(hAudioEvent, 200) == WAIT_TIMEOUT) {
+						cycleStarted = false;
+						continue;
+					}
+					QueryPerformanceCounter(&cycleStart);
+					cycleStarted = true;
 				}
 
 				padding = 0;
@@ -1719,6 +2299,11 @@ void StartWasapiAudio(OPLPlayer *player)
 					goto finalize;
 				}
 
+				if (padding == 0 && outputStarted) {
+					// 再生が追いつき、デバイスのバッファが空になっていた
+					player->reportUnderrun();
+				}
+
 				framesAvailable = bufferFrames - padding;
 
 				UINT32 fifoFrames = (UINT32)(fifo.size() / mixFmt->nChannels);
@@ -1726,6 +2311,7 @@ void StartWasapiAudio(OPLPlayer *player)
 
 				if (framesToWrite > 0)
 				{
+					prof::Scope profile(prof::StageSink);
 					BYTE* data = nullptr;
 					hr = renderClient->GetBuffer(framesToWrite, &data);
 					if (FAILED(hr)) {
@@ -1742,6 +2328,7 @@ void StartWasapiAudio(OPLPlayer *player)
 						g_restart = true;
 						goto finalize;
 					}
+					outputStarted = true;
 
 					fifo.erase(
 						fifo.begin(),
@@ -1786,6 +2373,8 @@ void AudioThread()
 	auto player = g_player;
 	if (!player) return;
 
+	prof::setThreadName("audio");
+
 	if (FAILED(CoInitialize(nullptr))) return;
 
 	do {
@@ -1806,9 +2395,12 @@ static void mainLoopWASAPI(OPLPlayer* player, int bufferSize, bool interactive,
 
 	g_player = player;
 
-	std::thread audio(AudioThread);
+	// プレーヤーはOPLのネイティブレートで出力し、SR変換はlibsamplerateの1段だけにする
+	player->setSampleRate(player->nativeSampleRate());
+	if (g_controlThread)
+		player->setControlThread(true);
 
-	player->setSampleRate(INTERNAL_SR); // OPL original rate
+	std::thread audio(AudioThread);
 
 #ifndef YMFMIDI_CONSOLE
 	if (traymode) {
@@ -1819,9 +2411,12 @@ static void mainLoopWASAPI(OPLPlayer* player, int bufferSize, bool interactive,
 			return;
 
 		ShowWindow(hwnd, SW_HIDE);
+		if (g_statsInterval) {
+			SetTimer(hwnd, ID_TIMER_STATS, g_statsInterval * 1000, nullptr);
+		}
 		if (RegisterTrayIcon(hwnd)) {
 #ifdef YMFMIDI_CONSOLE
-			// R\[
+			// コンソールを消す
 			FreeConsole();
 #endif
 		}
@@ -1833,11 +2428,12 @@ static void mainLoopWASAPI(OPLPlayer* player, int bufferSize, bool interactive,
 	if (interactive && !traymode)
 	{
 		consolePos(2);
-		printf("\ncontrols: [p] pause, [r] restart, [tab] change view, [esc/q] quit\n");
+		printf("\ncontrols: [p] pause, [r] restart, [tab] view, [i] profile, [t] trace, [esc/q] quit\n");
 	}
 
 	unsigned displayType = 0;
 	bool updateOnce = true;
+	ULONGLONG nextStats = GetTickCount64() + g_statsInterval * 1000;
 	while (g_running)
 	{
 #ifndef YMFMIDI_CONSOLE
@@ -1885,7 +2481,7 @@ static void mainLoopWASAPI(OPLPlayer* player, int bufferSize, bool interactive,
 
 				case 'r':
 					g_paused = false;
-					player->reset();
+					postPlayerCommand(player, OPLPlayer::CommandReset);
 					updateOnce = true;
 					break;
 
@@ -1896,19 +2492,48 @@ static void mainLoopWASAPI(OPLPlayer* player, int bufferSize, bool interactive,
 					updateOnce = true;
 					break;
 
+				case 'i':
+					// プロファイル表示の切り替え
+					prof::setEnabled(!prof::enabled());
+					consolePos(5);
+					player->displayClear();
+					updateOnce = true;
+					break;
+
+				case 't':
+					// ここまでのトレースを書き出す
+					writeTrace();
+					break;
+
 				case -'D':
 					if (player->songNum() > 0)
-						player->setSongNum(player->songNum() - 1);
+						postPlayerCommand(player, OPLPlayer::CommandSongNum, player->songNum() - 1);
 					updateOnce = true;
 					break;
 
 				case -'C':
 					if (player->songNum() < player->numSongs() - 1)
-						player->setSongNum(player->songNum() + 1);
+						postPlayerCommand(player, OPLPlayer::CommandSongNum, player->songNum() + 1);
 					updateOnce = true;
 					break;
 				}
 			}
+
+			if (g_statsInterval && GetTickCount64() >= nextStats)
+			{
+				// 負荷統計の定期出力
+				nextStats += g_statsInterval * 1000;
+				const std::string line = formatRenderStats(player->renderStats(true));
+				if (interactive)
+				{
+					consolePos(4);
+					printf("%-79.79s", line.c_str());
+				}
+				else
+				{
+					printf("%s\n", line.c_str());
+				}
+			}
 			Sleep(10);
 		}
 	}
@@ -1917,7 +2542,7 @@ static void mainLoopWASAPI(OPLPlayer* player, int bufferSize, bool interactive,
 	if (traymode) {
 		g_hWnd = nullptr;
 
-		// gC폜
+		// トレイ削除
 		NOTIFYICONDATA nid{};
 		nid.cbSize = sizeof(nid);
 		nid.hWnd = hwnd;
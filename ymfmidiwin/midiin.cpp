@@ -0,0 +1,246 @@
+#include "midiin.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// ----------------------------------------------------------------------------
+uint64_t midiTickCount()
+{
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// ----------------------------------------------------------------------------
+MidiInDevice::MidiInDevice()
+{
+#ifdef _WIN32
+    m_wakeupEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+#endif
+    m_wakeupTarget = m_wakeupEvent;
+    resetTime();
+}
+
+// ----------------------------------------------------------------------------
+MidiInDevice::~MidiInDevice()
+{
+#ifdef _WIN32
+    if (m_wakeupEvent) {
+        CloseHandle(m_wakeupEvent);
+        m_wakeupEvent = nullptr;
+    }
+#endif
+}
+
+// ----------------------------------------------------------------------------
+MidiInDevice* MidiInDevice::create(const char *spec)
+{
+    if (!strncmp(spec, "alsa", 4) && (spec[4] == '\0' || spec[4] == ':'))
+        return createMidiInALSA(spec[4] ? spec + 5 : "");
+    if (!strncmp(spec, "pipe:", 5))
+        return createMidiInPipe(spec + 5);
+    if (!strncmp(spec, "socket:", 7))
+        return createMidiInSocket(spec + 7);
+    if (!strncmp(spec, "udp:", 4))
+        return createMidiInUDP(spec + 4);
+    if (!strncmp(spec, "loopback", 8) && (spec[8] == '\0' || spec[8] == ':'))
+        return createMidiInLoopback(spec[8] ? atoi(spec + 9) : 0);
+
+#ifdef _WIN32
+    return createMidiInWinMM(atoi(spec));
+#else
+    return createMidiInALSA("");
+#endif
+}
+
+// ----------------------------------------------------------------------------
+void MidiInDevice::pushMessage(uint32_t data, uint32_t timestamp)
+{
+    MidiMessage msg;
+    msg.data = data;
+    msg.timestamp = timestamp;
+    m_fifo.push(msg);
+}
+
+// ----------------------------------------------------------------------------
+void MidiInDevice::pushSysEx(const uint8_t *data, size_t size, uint32_t timestamp)
+{
+    if (m_fifo.full())
+    {
+        // no room for the marker, so drop the SysEx too (a slot without its marker would have
+        // the position of the next message that fits). pushing the marker just counts it
+        pushMessage(0xf0, timestamp);
+        return;
+    }
+
+    // sysexの位置が分かるように入れておく
+    // (marker only if the SysEx itself fit, so a dropped one doesn't leave a dangling marker)
+    if (m_sysexRing.push(data, size, timestamp, m_fifo.writePosition()))
+        pushMessage(0xf0, timestamp);
+}
+
+// ----------------------------------------------------------------------------
+void MidiInDevice::resetParser()
+{
+    m_status = 0;
+    m_dataCount = 0;
+    m_inSysEx = false;
+    m_sysexSize = 0;
+}
+
+// ----------------------------------------------------------------------------
+void MidiInDevice::pushBytes(const uint8_t *data, size_t size, uint32_t timestamp)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        const uint8_t byte = data[i];
+
+        if (byte >= 0xf8)
+        {
+            // realtime messages can appear anywhere and aren't used
+            continue;
+        }
+
+        if (byte == 0xf0)
+        {
+            m_inSysEx = true;
+            m_sysex[0] = byte;
+            m_sysexSize = 1;
+            m_status = 0;
+            continue;
+        }
+
+        if (m_inSysEx)
+        {
+            if (byte == 0xf7 || byte < 0x80)
+            {
+                // one byte past the slot size marks it as too long, pushSysEx() then drops it
+                if (m_sysexSize <= sizeof(m_sysex))
+                {
+                    if (m_sysexSize < sizeof(m_sysex))
+                        m_sysex[m_sysexSize] = byte;
+                    m_sysexSize++;
+                }
+                if (byte == 0xf7)
+                {
+                    pushSysEx(m_sysex, m_sysexSize, timestamp);
+                    m_inSysEx = false;
+                }
+                continue;
+            }
+            // any other status byte ends an unterminated SysEx (drop it)
+            m_inSysEx = false;
+        }
+
+        if (byte & 0x80)
+        {
+            // system common messages cancel running status, and aren't used either
+            m_status = (byte < 0xf0) ? byte : 0;
+            m_dataCount = 0;
+            continue;
+        }
+
+        if (!m_status)
+            continue; // data byte without status
+
+        m_data[m_dataCount++] = byte;
+
+        const unsigned length = ((m_status >> 4) == 12 || (m_status >> 4) == 13) ? 1 : 2;
+        if (m_dataCount == length)
+        {
+            pushMessage(m_status | (m_data[0] << 8) | ((length > 1 ? m_data[1] : 0) << 16), timestamp);
+            m_dataCount = 0;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+void MidiInDevice::wakeup()
+{
+#ifdef _WIN32
+    SetEvent(m_wakeupTarget);
+#endif
+}
+
+// ----------------------------------------------------------------------------
+uint64_t MidiClockEstimator::update(uint64_t remote, uint64_t local)
+{
+    int64_t x = (int64_t)(remote - m_remoteBase);
+
+    // start over with the first packet, or when the sender's clock jumped (e.g. it was restarted)
+    if (!m_started || x < m_lastRemote - WindowLength || x > m_lastRemote + 60 * WindowLength)
+    {
+        m_started = true;
+        m_remoteBase = remote;
+        m_localBase = local;
+        x = 0;
+        m_numWindows = m_nextWindow = 0;
+        m_current.x = m_current.offset = 0;
+        m_currentStart = 0;
+        m_intercept = m_slope = 0;
+    }
+    m_lastRemote = x;
+
+    const double offset = (double)(int64_t)(local - m_localBase) - x;
+
+    if (x - m_currentStart >= WindowLength)
+    {
+        // one window done, start the next one
+        m_windows[m_nextWindow] = m_current;
+        m_nextWindow = (m_nextWindow + 1) % WindowCount;
+        if (m_numWindows < WindowCount)
+            m_numWindows++;
+
+        m_current.x = (double)x;
+        m_current.offset = offset;
+        m_currentStart = x;
+    }
+    else if (offset < m_current.offset)
+    {
+        m_current.x = (double)x;
+        m_current.offset = offset;
+    }
+    fit();
+
+    // a packet can't have been sent later than it arrived
+    double predicted = m_intercept + m_slope * x;
+    if (predicted > offset)
+        predicted = offset;
+
+    return m_localBase + x + (int64_t)llround(predicted);
+}
+
+// ----------------------------------------------------------------------------
+void MidiClockEstimator::fit()
+{
+    // (the minimum of the window in progress counts too, even if it may still go down)
+    const unsigned n = m_numWindows + 1;
+    double meanX = m_current.x, meanOffset = m_current.offset;
+    for (unsigned i = 0; i < m_numWindows; i++)
+    {
+        meanX += m_windows[i].x;
+        meanOffset += m_windows[i].offset;
+    }
+    meanX /= n;
+    meanOffset /= n;
+
+    double sxx = (m_current.x - meanX) * (m_current.x - meanX);
+    double sxo = (m_current.x - meanX) * (m_current.offset - meanOffset);
+    for (unsigned i = 0; i < m_numWindows; i++)
+    {
+        const double dx = m_windows[i].x - meanX;
+        sxx += dx * dx;
+        sxo += dx * (m_windows[i].offset - meanOffset);
+    }
+
+    // anything beyond +/-1000 ppm is measurement noise, not a real clock
+    m_slope = (sxx > 0) ? sxo / sxx : 0;
+    if (m_slope > 0.001) m_slope = 0.001;
+    if (m_slope < -0.001) m_slope = -0.001;
+    m_intercept = meanOffset - m_slope * meanX;
+}
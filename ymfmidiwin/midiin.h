@@ -0,0 +1,398 @@
+#ifndef __MIDIIN_H
+#define __MIDIIN_H
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// realtime MIDI input, independent of the OS MIDI API.
+// a backend (see midiin_*.cpp) receives data on its own thread and pushes it
+// into the FIFOs below, which the sequencer then drains from the audio thread.
+
+struct MidiMessage
+{
+    uint32_t data;      // status | data1 | data2
+    uint32_t timestamp; // ms (or see MidiInDevice::timestampRate())
+};
+
+struct MidiSysEx
+{
+    std::vector<uint8_t> data; // including the opening 0xF0 (unless continued from a previous chunk)
+    uint32_t timestamp;
+};
+
+// single producer / single consumer ring of short messages.
+// a full ring drops new messages instead of overwriting unread ones
+class MidiFifo
+{
+public:
+    static constexpr size_t Capacity = 4096;
+
+    bool push(const MidiMessage& msg)
+    {
+        size_t w = writeIndex.load(std::memory_order_relaxed);
+        size_t r = readIndex.load(std::memory_order_acquire);
+        if (w - r >= Capacity)
+        {
+            overflows.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        buffer[w % Capacity] = msg;
+        writeIndex.store(w + 1, std::memory_order_release);
+
+        const uint32_t depth = (uint32_t)(w + 1 - r);
+        if (depth > highWater.load(std::memory_order_relaxed))
+            highWater.store(depth, std::memory_order_relaxed);
+        return true;
+    }
+
+    size_t popAll(std::vector<MidiMessage>& out)
+    {
+        size_t r = readIndex.load(std::memory_order_relaxed);
+        size_t w = writeIndex.load(std::memory_order_acquire);
+
+        size_t count = w - r;
+        if (count == 0) return 0;
+
+        out.reserve(out.size() + count);
+
+        for (size_t i = 0; i < count; ++i)
+            out.push_back(buffer[(r + i) % Capacity]);
+
+        readIndex.store(w, std::memory_order_release);
+        return count;
+    }
+
+    // 'position' receives the running index of the message (see writePosition())
+    size_t popOne(MidiMessage& out, size_t *position = nullptr)
+    {
+        size_t r = readIndex.load(std::memory_order_relaxed);
+        size_t w = writeIndex.load(std::memory_order_acquire);
+
+        size_t count = w - r;
+        if (count == 0) return 0;
+
+        out = buffer[r % Capacity];
+        if (position) *position = r;
+        readIndex.store(r + 1, std::memory_order_release);
+
+        return 1;
+    }
+
+    uint32_t getNextTimestamp()
+    {
+        size_t r = readIndex.load(std::memory_order_relaxed);
+        size_t w = writeIndex.load(std::memory_order_acquire);
+
+        size_t count = w - r;
+        if (count == 0) return UINT_MAX;
+
+        return buffer[r % Capacity].timestamp;
+    }
+
+    uint32_t getMessageCount()
+    {
+        size_t r = readIndex.load(std::memory_order_relaxed);
+        size_t w = writeIndex.load(std::memory_order_acquire);
+
+        return w - r;
+    }
+
+    // producer side: running index the next pushed message will get
+    size_t writePosition() const
+    {
+        return writeIndex.load(std::memory_order_relaxed);
+    }
+
+    // producer side: whether the next push would be dropped
+    // (only the consumer makes room, so a false answer holds until the next push)
+    bool full() const
+    {
+        size_t w = writeIndex.load(std::memory_order_relaxed);
+        size_t r = readIndex.load(std::memory_order_acquire);
+        return w - r >= Capacity;
+    }
+
+    // number of messages dropped because the ring was full
+    uint32_t getOverflowCount() const
+    {
+        return overflows.load(std::memory_order_relaxed);
+    }
+
+    // most messages that were waiting at once (since the last reset)
+    uint32_t getHighWater(bool reset = false)
+    {
+        return reset ? highWater.exchange(0, std::memory_order_relaxed) : highWater.load(std::memory_order_relaxed);
+    }
+
+private:
+    MidiMessage buffer[Capacity];
+    std::atomic<size_t> writeIndex{ 0 };
+    std::atomic<size_t> readIndex{ 0 };
+    std::atomic<uint32_t> overflows{ 0 };
+    std::atomic<uint32_t> highWater{ 0 };
+};
+
+// single producer / single consumer ring of preallocated SysEx slots.
+// nothing is allocated or locked on either side; a message that doesn't fit
+// (ring full or longer than a slot) is dropped and counted.
+// each slot remembers the MidiFifo position of the 0xF0 marker pushed with it,
+// so the consumer can tell which marker a SysEx belongs to even if either ring dropped something
+class SysExRing
+{
+public:
+    static constexpr size_t SlotCount = 64;
+    static constexpr size_t SlotSize = 1024;
+
+    bool push(const uint8_t *data, size_t size, uint32_t timestamp, size_t position)
+    {
+        size_t w = writeIndex.load(std::memory_order_relaxed);
+        size_t r = readIndex.load(std::memory_order_acquire);
+        if (w - r >= SlotCount || size > SlotSize)
+        {
+            overflows.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        Slot& slot = slots[w % SlotCount];
+        memcpy(slot.data, data, size);
+        slot.size = size;
+        slot.timestamp = timestamp;
+        slot.position = position;
+        writeIndex.store(w + 1, std::memory_order_release);
+        return true;
+    }
+
+    // copy out the SysEx whose marker was at 'position', discarding older unclaimed ones.
+    // out.data keeps its capacity, so this doesn't allocate once it has grown to SlotSize
+    bool pop(size_t position, MidiSysEx& out)
+    {
+        size_t r = readIndex.load(std::memory_order_relaxed);
+        size_t w = writeIndex.load(std::memory_order_acquire);
+
+        for (; r != w; r++)
+        {
+            const Slot& slot = slots[r % SlotCount];
+            if (slot.position > position)
+                break; // belongs to a later marker (this one's SysEx was dropped)
+
+            if (slot.position == position)
+            {
+                out.data.assign(slot.data, slot.data + slot.size);
+                out.timestamp = slot.timestamp;
+                readIndex.store(r + 1, std::memory_order_release);
+                return true;
+            }
+        }
+
+        readIndex.store(r, std::memory_order_release);
+        return false;
+    }
+
+    // number of SysEx messages dropped
+    uint32_t getOverflowCount() const
+    {
+        return overflows.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Slot
+    {
+        uint8_t data[SlotSize];
+        size_t size;
+        uint32_t timestamp;
+        size_t position;
+    };
+
+    Slot slots[SlotCount];
+    std::atomic<size_t> writeIndex{ 0 };
+    std::atomic<size_t> readIndex{ 0 };
+    std::atomic<uint32_t> overflows{ 0 };
+};
+
+// milliseconds from an arbitrary fixed point (monotonic)
+uint64_t midiTickCount();
+
+class MidiInDevice
+{
+public:
+    virtual ~MidiInDevice();
+
+    // create a backend from a port spec:
+    //   "<num>"          Windows MIDI IN port number (default on Windows)
+    //   "alsa[:<name>]"  ALSA sequencer virtual port (default on Linux)
+    //   "pipe:<path>"    raw MIDI bytes from a named pipe (Windows: \\.\pipe\<path>) or FIFO
+    //   "socket:<path>"  raw MIDI bytes from a UNIX domain stream socket
+    //   "udp:[<addr>:]<port>"  network MIDI over UDP (default address 127.0.0.1)
+    //   "loopback[:<num>]"  fed from within the process (see MidiInLoopback)
+    // returns nullptr if the backend isn't available on this platform
+    static MidiInDevice* create(const char *spec);
+
+    virtual bool open() = 0;
+    virtual void close() = 0;
+    virtual std::string getName() const = 0;
+    // timestamp units per second
+    virtual uint32_t timestampRate() const { return 1000; }
+
+    /// 呼び出した時点までのMIDIメッセージを取得
+    size_t fetchMessages(std::vector<MidiMessage>& out)
+    {
+        return m_fifo.popAll(out);
+    }
+    size_t fetchOneMessage(MidiMessage& out)
+    {
+        return m_fifo.popOne(out, &m_lastPosition);
+    }
+    uint32_t getNextTimestamp()
+    {
+        return m_fifo.getNextTimestamp();
+    }
+    uint32_t getMessageCount()
+    {
+        return m_fifo.getMessageCount();
+    }
+    // get the SysEx for a 0xF0 marker just returned by fetchOneMessage()
+    bool fetchSysEx(MidiSysEx& out)
+    {
+        return m_sysexRing.pop(m_lastPosition, out);
+    }
+
+    // messages lost because the consumer fell behind
+    uint32_t getDroppedMessages() const
+    {
+        return m_fifo.getOverflowCount();
+    }
+    uint32_t getDroppedSysEx() const
+    {
+        return m_sysexRing.getOverflowCount();
+    }
+    // most messages waiting in the FIFO at once (since the last reset)
+    uint32_t getHighWater(bool reset = false)
+    {
+        return m_fifo.getHighWater(reset);
+    }
+
+    // Windows: event handle signaled when new data arrives (nullptr elsewhere)
+    void* getWakeupEvent()
+    {
+        return m_wakeupTarget;
+    }
+    // signal another device's wakeup event instead, to wait on several devices at once
+    void shareWakeupEvent(MidiInDevice& other)
+    {
+        m_wakeupTarget = other.m_wakeupTarget;
+    }
+
+protected:
+    MidiInDevice();
+
+    // called from the backend's receive thread
+    void pushMessage(uint32_t data, uint32_t timestamp);
+    void pushSysEx(const uint8_t *data, size_t size, uint32_t timestamp);
+    // parse a raw MIDI byte stream (running status, realtime bytes and SysEx are handled)
+    void pushBytes(const uint8_t *data, size_t size, uint32_t timestamp);
+    void resetParser();
+    void wakeup();
+
+    // timestamp for backends without their own clock (ms since resetTime())
+    void resetTime() { m_timeBase = midiTickCount(); }
+    uint32_t currentTime() const { return (uint32_t)(midiTickCount() - m_timeBase); }
+
+private:
+    MidiFifo m_fifo;
+    SysExRing m_sysexRing;
+    size_t m_lastPosition = 0; // of the message last returned by fetchOneMessage()
+
+    void *m_wakeupEvent = nullptr;
+    void *m_wakeupTarget = nullptr;
+    uint64_t m_timeBase = 0;
+
+    // raw byte stream parser state
+    uint8_t m_status = 0;
+    uint8_t m_data[2] = { 0 };
+    unsigned m_dataCount = 0;
+    uint8_t m_sysex[SysExRing::SlotSize];
+    size_t m_sysexSize = 0;
+    bool m_inSysEx = false;
+};
+
+// in-process input, fed by send() from one thread at a time (e.g. test and measurement tools).
+// timestamps are whatever clock the sender uses, in microseconds
+class MidiInLoopback : public MidiInDevice
+{
+public:
+    static constexpr int MaxDevices = 16;
+
+    MidiInLoopback(int num) : m_num(num) {}
+    ~MidiInLoopback() {
+        close();
+    }
+
+    bool open();
+    void close();
+    std::string getName() const;
+    uint32_t timestampRate() const { return 1000000; }
+
+    // raw MIDI bytes (running status within one call)
+    void send(const uint8_t *data, size_t size, uint32_t timestamp);
+
+    // the opened device with the given number, nullptr if there is none
+    static MidiInLoopback* find(int num);
+
+private:
+    int m_num;
+    bool m_open = false;
+};
+
+// maps a remote sender's clock onto the local one (both in microseconds) for network input.
+// the offset follows the smallest transit time seen (the packets that were delayed least),
+// and the rate difference of the two clocks is a least squares fit over those minimums,
+// one per second over the last WindowCount seconds
+class MidiClockEstimator
+{
+public:
+    static constexpr unsigned WindowCount = 16;
+    static constexpr int64_t WindowLength = 1000000;
+
+    void reset() { m_started = false; }
+
+    // add a packet sent at remote time 'remote' and received at local time 'local',
+    // returns the local time it was (most likely) sent at
+    uint64_t update(uint64_t remote, uint64_t local);
+
+    // estimated rate difference of the remote clock in ppm
+    double drift() const { return -m_slope * 1e6; }
+
+private:
+    struct Point
+    {
+        double x, offset;
+    };
+
+    void fit();
+
+    bool m_started = false;
+    uint64_t m_remoteBase = 0, m_localBase = 0;
+    int64_t m_lastRemote = 0;
+
+    Point m_windows[WindowCount];
+    unsigned m_numWindows = 0, m_nextWindow = 0;
+    Point m_current; // minimum of the window in progress
+    int64_t m_currentStart = 0;
+
+    double m_intercept = 0, m_slope = 0;
+};
+
+// backends, each returns nullptr if unavailable on this platform
+MidiInDevice* createMidiInWinMM(int portnum);
+MidiInDevice* createMidiInALSA(const char *name);
+MidiInDevice* createMidiInPipe(const char *path);
+MidiInDevice* createMidiInSocket(const char *path);
+MidiInDevice* createMidiInUDP(const char *address);
+MidiInDevice* createMidiInLoopback(int num);
+
+#endif // __MIDIIN_H
@@ -0,0 +1,139 @@
+#include "midiin.h"
+
+// MIDIIN_NO_ALSA: the headers may be there without the library (see CMakeLists.txt)
+#if defined(__linux__) && defined(__has_include) && !defined(MIDIIN_NO_ALSA)
+#if __has_include(<alsa/asoundlib.h>)
+#define MIDIIN_HAVE_ALSA
+#endif
+#endif
+
+#ifdef MIDIIN_HAVE_ALSA
+
+#include <alsa/asoundlib.h>
+#include <poll.h>
+#include <thread>
+
+// link with -lasound
+
+class MidiInDeviceALSA : public MidiInDevice
+{
+public:
+    MidiInDeviceALSA(const char *name) : m_name(*name ? name : "ymfmidi") {}
+    ~MidiInDeviceALSA() {
+        close();
+    }
+
+    bool open()
+    {
+        if (m_seq) {
+            close();
+        }
+
+        if (snd_seq_open(&m_seq, "default", SND_SEQ_OPEN_INPUT, SND_SEQ_NONBLOCK) < 0) {
+            m_seq = nullptr;
+            return false;
+        }
+        snd_seq_set_client_name(m_seq, m_name.c_str());
+
+        m_port = snd_seq_create_simple_port(m_seq, m_name.c_str(),
+            SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
+            SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_SYNTHESIZER | SND_SEQ_PORT_TYPE_APPLICATION);
+        if (m_port < 0 || snd_midi_event_new(sizeof(m_buffer), &m_decoder) < 0) {
+            snd_seq_close(m_seq);
+            m_seq = nullptr;
+            m_decoder = nullptr;
+            return false;
+        }
+        snd_midi_event_no_status(m_decoder, 1);
+
+        resetTime();
+        resetParser();
+        m_running = true;
+        m_thread = std::thread(&MidiInDeviceALSA::receive, this);
+        return true;
+    }
+
+    void close()
+    {
+        if (!m_seq)
+            return;
+
+        m_running = false;
+        if (m_thread.joinable())
+            m_thread.join();
+
+        snd_midi_event_free(m_decoder);
+        m_decoder = nullptr;
+        snd_seq_close(m_seq);
+        m_seq = nullptr;
+    }
+
+    std::string getName() const
+    {
+        if (m_seq)
+            return "ALSA " + std::to_string(snd_seq_client_id(m_seq)) + ":" + std::to_string(m_port) + " " + m_name;
+        return "ALSA " + m_name;
+    }
+
+private:
+    // ----------------------------------------------------------
+    // receive thread
+    // ----------------------------------------------------------
+    void receive()
+    {
+        const int count = snd_seq_poll_descriptors_count(m_seq, POLLIN);
+        std::vector<struct pollfd> fds(count);
+        snd_seq_poll_descriptors(m_seq, fds.data(), count, POLLIN);
+
+        while (m_running)
+        {
+            // wake up periodically to check whether we've been closed
+            if (poll(fds.data(), count, 100) <= 0)
+                continue;
+
+            snd_seq_event_t *ev;
+            while (snd_seq_event_input(m_seq, &ev) >= 0)
+            {
+                // SysEx comes in chunks of any length: the parser assembles them and
+                // counts the ones too long for the FIFO as dropped, as on the other backends
+                if (ev->type == SND_SEQ_EVENT_SYSEX) {
+                    pushBytes(static_cast<const uint8_t*>(ev->data.ext.ptr), ev->data.ext.len, currentTime());
+                    continue;
+                }
+
+                long size = snd_midi_event_decode(m_decoder, m_buffer, sizeof(m_buffer), ev);
+                if (size > 0)
+                    pushBytes(m_buffer, size, currentTime());
+            }
+
+            wakeup();
+        }
+    }
+
+    std::string m_name;
+
+    snd_seq_t *m_seq = nullptr;
+    snd_midi_event_t *m_decoder = nullptr;
+    int m_port = -1;
+
+    std::thread m_thread;
+    std::atomic<bool> m_running{ false };
+
+    uint8_t m_buffer[16]; // channel and system messages (SysEx bypasses the decoder)
+};
+
+// ----------------------------------------------------------------------------
+MidiInDevice* createMidiInALSA(const char *name)
+{
+    return new MidiInDeviceALSA(name);
+}
+
+#else
+
+// ----------------------------------------------------------------------------
+MidiInDevice* createMidiInALSA(const char*)
+{
+    return nullptr;
+}
+
+#endif // MIDIIN_HAVE_ALSA
@@ -0,0 +1,57 @@
+#include "midiin.h"
+
+static std::atomic<MidiInLoopback*> g_loopback[MidiInLoopback::MaxDevices];
+
+// ----------------------------------------------------------------------------
+bool MidiInLoopback::open()
+{
+    if (m_num < 0 || m_num >= MaxDevices)
+        return false;
+
+    // only one device per number can be open at a time
+    MidiInLoopback *expected = nullptr;
+    if (!m_open && !g_loopback[m_num].compare_exchange_strong(expected, this))
+        return false;
+
+    m_open = true;
+    resetParser();
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+void MidiInLoopback::close()
+{
+    if (!m_open)
+        return;
+
+    g_loopback[m_num] = nullptr;
+    m_open = false;
+}
+
+// ----------------------------------------------------------------------------
+std::string MidiInLoopback::getName() const
+{
+    return "loopback " + std::to_string(m_num);
+}
+
+// ----------------------------------------------------------------------------
+void MidiInLoopback::send(const uint8_t *data, size_t size, uint32_t timestamp)
+{
+    pushBytes(data, size, timestamp);
+    resetParser();
+    wakeup();
+}
+
+// ----------------------------------------------------------------------------
+MidiInLoopback* MidiInLoopback::find(int num)
+{
+    if (num < 0 || num >= MaxDevices)
+        return nullptr;
+    return g_loopback[num];
+}
+
+// ----------------------------------------------------------------------------
+MidiInDevice* createMidiInLoopback(int num)
+{
+    return new MidiInLoopback(num);
+}
@@ -0,0 +1,290 @@
+#include "midiin.h"
+
+#include <thread>
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+// raw MIDI bytes from a named pipe (\\.\pipe\<name>).
+// one client at a time; the pipe is re-listened to when the client disconnects
+class MidiInDevicePipe : public MidiInDevice
+{
+public:
+    MidiInDevicePipe(const char *path) : m_path(path)
+    {
+        if (m_path.compare(0, 9, "\\\\.\\pipe\\") != 0)
+            m_path = "\\\\.\\pipe\\" + m_path;
+    }
+    ~MidiInDevicePipe() {
+        close();
+    }
+
+    bool open()
+    {
+        if (m_pipe != INVALID_HANDLE_VALUE) {
+            close();
+        }
+
+        m_pipe = CreateNamedPipeA(m_path.c_str(),
+            PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED,
+            PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+            1, 0, sizeof(m_buffer), 0, nullptr);
+        if (m_pipe == INVALID_HANDLE_VALUE)
+            return false;
+
+        m_stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        m_ioEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+        resetTime();
+        resetParser();
+        m_thread = std::thread(&MidiInDevicePipe::receive, this);
+        return true;
+    }
+
+    void close()
+    {
+        if (m_pipe == INVALID_HANDLE_VALUE)
+            return;
+
+        SetEvent(m_stopEvent);
+        if (m_thread.joinable())
+            m_thread.join();
+
+        CloseHandle(m_pipe);
+        CloseHandle(m_stopEvent);
+        CloseHandle(m_ioEvent);
+        m_pipe = INVALID_HANDLE_VALUE;
+        m_stopEvent = m_ioEvent = nullptr;
+    }
+
+    std::string getName() const
+    {
+        return "pipe " + m_path;
+    }
+
+private:
+    // ----------------------------------------------------------
+    // wait for an overlapped operation, false if stopped/failed
+    // ----------------------------------------------------------
+    bool wait(OVERLAPPED& ov, DWORD& bytes)
+    {
+        HANDLE handles[2] = { m_ioEvent, m_stopEvent };
+        if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0) {
+            CancelIo(m_pipe);
+            GetOverlappedResult(m_pipe, &ov, &bytes, TRUE);
+            return false;
+        }
+        return GetOverlappedResult(m_pipe, &ov, &bytes, FALSE) != FALSE;
+    }
+
+    void receive()
+    {
+        while (WaitForSingleObject(m_stopEvent, 0) != WAIT_OBJECT_0)
+        {
+            OVERLAPPED ov = {};
+            ov.hEvent = m_ioEvent;
+            ResetEvent(m_ioEvent);
+
+            DWORD bytes = 0;
+            if (!ConnectNamedPipe(m_pipe, &ov))
+            {
+                const DWORD err = GetLastError();
+                if (err == ERROR_IO_PENDING) {
+                    if (!wait(ov, bytes))
+                        continue;
+                }
+                else if (err != ERROR_PIPE_CONNECTED) {
+                    break;
+                }
+            }
+
+            resetParser();
+            for (;;)
+            {
+                ResetEvent(m_ioEvent);
+                if (!ReadFile(m_pipe, m_buffer, sizeof(m_buffer), nullptr, &ov)
+                    && GetLastError() != ERROR_IO_PENDING)
+                    break;
+                if (!wait(ov, bytes) || bytes == 0)
+                    break;
+
+                pushBytes(m_buffer, bytes, currentTime());
+                wakeup();
+            }
+            DisconnectNamedPipe(m_pipe);
+        }
+    }
+
+    std::string m_path;
+
+    HANDLE m_pipe = INVALID_HANDLE_VALUE;
+    HANDLE m_stopEvent = nullptr;
+    HANDLE m_ioEvent = nullptr;
+
+    std::thread m_thread;
+
+    uint8_t m_buffer[1024];
+};
+
+// ----------------------------------------------------------------------------
+MidiInDevice* createMidiInPipe(const char *path)
+{
+    return new MidiInDevicePipe(path);
+}
+
+// ----------------------------------------------------------------------------
+MidiInDevice* createMidiInSocket(const char*)
+{
+    return nullptr;
+}
+
+#else
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// raw MIDI bytes from a FIFO (created if it doesn't exist yet) or a UNIX domain stream socket.
+// sockets accept one client at a time; the running status is reset between clients
+class MidiInDevicePipe : public MidiInDevice
+{
+public:
+    MidiInDevicePipe(const char *path, bool socket) : m_path(path), m_socket(socket) {}
+    ~MidiInDevicePipe() {
+        close();
+    }
+
+    bool open()
+    {
+        if (m_fd >= 0) {
+            close();
+        }
+
+        if (m_socket)
+        {
+            struct sockaddr_un addr = {};
+            addr.sun_family = AF_UNIX;
+            if (m_path.size() >= sizeof(addr.sun_path))
+                return false;
+            strcpy(addr.sun_path, m_path.c_str());
+
+            m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (m_fd < 0)
+                return false;
+            unlink(m_path.c_str());
+            if (bind(m_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(m_fd, 1) < 0) {
+                ::close(m_fd);
+                m_fd = -1;
+                return false;
+            }
+        }
+        else
+        {
+            if (mkfifo(m_path.c_str(), 0666) < 0 && errno != EEXIST)
+                return false;
+            // opening read/write keeps the FIFO from reporting EOF whenever a writer closes it
+            m_fd = ::open(m_path.c_str(), O_RDWR | O_NONBLOCK);
+            if (m_fd < 0)
+                return false;
+        }
+
+        resetTime();
+        resetParser();
+        m_running = true;
+        m_thread = std::thread(&MidiInDevicePipe::receive, this);
+        return true;
+    }
+
+    void close()
+    {
+        if (m_fd < 0)
+            return;
+
+        m_running = false;
+        if (m_thread.joinable())
+            m_thread.join();
+
+        ::close(m_fd);
+        m_fd = -1;
+        if (m_socket)
+            unlink(m_path.c_str());
+    }
+
+    std::string getName() const
+    {
+        return (m_socket ? "socket " : "pipe ") + m_path;
+    }
+
+private:
+    // ----------------------------------------------------------
+    // receive thread
+    // ----------------------------------------------------------
+    void receive()
+    {
+        int client = -1;
+
+        while (m_running)
+        {
+            struct pollfd pfd = {};
+            pfd.fd = (client >= 0) ? client : m_fd;
+            pfd.events = POLLIN;
+
+            // wake up periodically to check whether we've been closed
+            if (poll(&pfd, 1, 100) <= 0)
+                continue;
+
+            if (m_socket && client < 0)
+            {
+                client = accept(m_fd, nullptr, nullptr);
+                resetParser();
+                continue;
+            }
+
+            const ssize_t size = read(pfd.fd, m_buffer, sizeof(m_buffer));
+            if (size > 0)
+            {
+                pushBytes(m_buffer, size, currentTime());
+                wakeup();
+            }
+            else if (m_socket && (size == 0 || errno != EAGAIN))
+            {
+                // client went away, wait for the next one
+                ::close(client);
+                client = -1;
+            }
+        }
+
+        if (client >= 0)
+            ::close(client);
+    }
+
+    std::string m_path;
+    bool m_socket;
+    int m_fd = -1;
+
+    std::thread m_thread;
+    std::atomic<bool> m_running{ false };
+
+    uint8_t m_buffer[1024];
+};
+
+// ----------------------------------------------------------------------------
+MidiInDevice* createMidiInPipe(const char *path)
+{
+    return new MidiInDevicePipe(path, false);
+}
+
+// ----------------------------------------------------------------------------
+MidiInDevice* createMidiInSocket(const char *path)
+{
+    return new MidiInDevicePipe(path, true);
+}
+
+#endif // _WIN32
@@ -0,0 +1,180 @@
+#include "midiin.h"
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef SOCKET socket_t;
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int socket_t;
+#define INVALID_SOCKET (-1)
+#define closesocket ::close
+#endif
+
+// network MIDI input over UDP.
+// a datagram is either plain MIDI bytes, played as they arrive, or a timestamped packet:
+//   offset 0:  "YMID"
+//   offset 4:  sender time in microseconds (uint64, little endian)
+//   offset 12: MIDI bytes (running status may be used within the packet)
+// sender times are mapped onto the local clock by MidiClockEstimator, which removes
+// network jitter and follows the drift between the two clocks
+class MidiInDeviceUDP : public MidiInDevice
+{
+public:
+    MidiInDeviceUDP(const char *address)
+    {
+        const char *colon = strrchr(address, ':');
+        if (colon)
+        {
+            m_host.assign(address, colon - address);
+            m_port = atoi(colon + 1);
+        }
+        else
+        {
+            m_host = "127.0.0.1";
+            m_port = atoi(address);
+        }
+    }
+    ~MidiInDeviceUDP() {
+        close();
+    }
+
+    bool open()
+    {
+        if (m_socket != INVALID_SOCKET) {
+            close();
+        }
+
+#ifdef _WIN32
+        WSADATA wsaData;
+        if (WSAStartup(MAKEWORD(2, 2), &wsaData))
+            return false;
+#endif
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)m_port);
+        if (inet_pton(AF_INET, m_host.c_str(), &addr.sin_addr) != 1)
+            return closeSocket();
+
+        m_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (m_socket == INVALID_SOCKET)
+            return closeSocket();
+        if (bind(m_socket, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+            return closeSocket();
+
+        m_localBase = localTime();
+        m_clock.reset();
+        resetParser();
+        m_running = true;
+        m_thread = std::thread(&MidiInDeviceUDP::receive, this);
+        return true;
+    }
+
+    void close()
+    {
+        if (m_socket == INVALID_SOCKET)
+            return;
+
+        m_running = false;
+        if (m_thread.joinable())
+            m_thread.join();
+
+        closeSocket();
+    }
+
+    std::string getName() const
+    {
+        return "udp " + m_host + ":" + std::to_string(m_port);
+    }
+
+    uint32_t timestampRate() const
+    {
+        return 1000000;
+    }
+
+private:
+    static uint64_t localTime()
+    {
+        using namespace std::chrono;
+        return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    bool closeSocket()
+    {
+        if (m_socket != INVALID_SOCKET)
+            closesocket(m_socket);
+        m_socket = INVALID_SOCKET;
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return false;
+    }
+
+    // ----------------------------------------------------------
+    // receive thread
+    // ----------------------------------------------------------
+    void receive()
+    {
+        while (m_running)
+        {
+            // wake up periodically to check whether we've been closed
+            fd_set fds;
+            FD_ZERO(&fds);
+            FD_SET(m_socket, &fds);
+            struct timeval timeout = { 0, 100000 };
+            if (select((int)m_socket + 1, &fds, nullptr, nullptr, &timeout) <= 0)
+                continue;
+
+            const int size = recv(m_socket, (char*)m_buffer, sizeof(m_buffer), 0);
+            if (size <= 0)
+                continue;
+
+            const uint64_t now = localTime();
+            const uint8_t *data = m_buffer;
+            unsigned length = size;
+            uint64_t time = now;
+
+            if (length >= 12 && !memcmp(data, "YMID", 4))
+            {
+                uint64_t remote = 0;
+                for (int i = 0; i < 8; i++)
+                    remote |= (uint64_t)data[4 + i] << (i * 8);
+                time = m_clock.update(remote, now);
+                data += 12;
+                length -= 12;
+            }
+
+            // each datagram stands on its own
+            resetParser();
+            pushBytes(data, length, (uint32_t)(time - m_localBase));
+            wakeup();
+        }
+    }
+
+    std::string m_host;
+    int m_port = 0;
+
+    socket_t m_socket = INVALID_SOCKET;
+    uint64_t m_localBase = 0;
+    MidiClockEstimator m_clock;
+
+    std::thread m_thread;
+    std::atomic<bool> m_running{ false };
+
+    uint8_t m_buffer[65536];
+};
+
+// ----------------------------------------------------------------------------
+MidiInDevice* createMidiInUDP(const char *address)
+{
+    return new MidiInDeviceUDP(address);
+}
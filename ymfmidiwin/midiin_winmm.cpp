@@ -0,0 +1,161 @@
+#include "midiin.h"
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <mmsystem.h>
+
+#pragma comment(lib, "winmm.lib")
+
+class MidiInDeviceWinMM : public MidiInDevice
+{
+public:
+    MidiInDeviceWinMM(int portnum) : m_portnum(portnum) {}
+    ~MidiInDeviceWinMM() {
+        close();
+    }
+
+    bool open()
+    {
+        if (m_hMidiIn) {
+            close();
+        }
+
+        m_closing = false;
+        MMRESULT r = midiInOpen(
+            &m_hMidiIn,
+            m_portnum,
+            (DWORD_PTR)&MidiInCallback,
+            (DWORD_PTR)this,
+            CALLBACK_FUNCTION
+        );
+
+        if (r != MMSYSERR_NOERROR)
+            return false;
+
+        midiInStop(m_hMidiIn); // 動いているはずはないけど念のため
+        midiInReset(m_hMidiIn);
+        prepareSysExBuffers();
+        midiInStart(m_hMidiIn);
+        return true;
+    }
+
+    void close()
+    {
+        if (!m_hMidiIn)
+            return;
+
+        m_closing = true;
+        midiInStop(m_hMidiIn);
+        midiInReset(m_hMidiIn);
+        freeSysExBuffers();
+        midiInClose(m_hMidiIn);
+        m_hMidiIn = nullptr;
+    }
+
+    std::string getName() const
+    {
+        MIDIINCAPSA caps = {};
+        if (midiInGetDevCapsA(m_portnum, &caps, sizeof(caps)) != MMSYSERR_NOERROR) {
+            return "#" + std::to_string(m_portnum) + " (Unknown MIDI IN)";
+        }
+
+        return "#" + std::to_string(m_portnum) + " " + caps.szPname;
+    }
+
+private:
+    // ----------------------------------------------------------
+    // SysEx バッファ準備
+    // ----------------------------------------------------------
+    void prepareSysExBuffers()
+    {
+        for (int i = 0; i < SYSEX_BUFFER_COUNT; ++i)
+        {
+            MIDIHDR& hdr = m_sysexHdr[i];
+            ZeroMemory(&hdr, sizeof(hdr));
+            hdr.lpData = reinterpret_cast<LPSTR>(m_sysexData[i]);
+            hdr.dwBufferLength = SYSEX_BUFFER_SIZE;
+
+            midiInPrepareHeader(m_hMidiIn, &hdr, sizeof(hdr));
+            midiInAddBuffer(m_hMidiIn, &hdr, sizeof(hdr));
+        }
+    }
+
+    void freeSysExBuffers()
+    {
+        for (int i = 0; i < SYSEX_BUFFER_COUNT; ++i)
+        {
+            midiInUnprepareHeader(
+                m_hMidiIn, &m_sysexHdr[i], sizeof(MIDIHDR));
+        }
+    }
+
+    static void CALLBACK MidiInCallback(
+        HMIDIIN,
+        UINT wMsg,
+        DWORD_PTR dwInstance,
+        DWORD_PTR dwParam1,
+        DWORD_PTR dwParam2)
+    {
+        MidiInDeviceWinMM* self = reinterpret_cast<MidiInDeviceWinMM*>(dwInstance);
+
+        if (self->m_closing) return;
+
+        switch (wMsg)
+        {
+        case MIM_DATA:
+        {
+            self->pushMessage(static_cast<DWORD>(dwParam1), static_cast<DWORD>(dwParam2));
+            break;
+        }
+        case MIM_LONGDATA:
+        {
+            MIDIHDR* hdr = reinterpret_cast<MIDIHDR*>(dwParam1);
+
+            if (hdr->dwBytesRecorded > 0)
+            {
+                self->pushSysEx(
+                    reinterpret_cast<BYTE*>(hdr->lpData),
+                    hdr->dwBytesRecorded,
+                    static_cast<DWORD>(dwParam2));
+            }
+
+            // 再生継続なら再投入
+            if (!self->m_closing) {
+                hdr->dwBytesRecorded = 0;
+                midiInAddBuffer(self->m_hMidiIn, hdr, sizeof(MIDIHDR));
+            }
+            break;
+        }
+        }
+
+        self->wakeup();
+    }
+
+    static constexpr int SYSEX_BUFFER_SIZE = SysExRing::SlotSize; // every chunk fits a slot
+    static constexpr int SYSEX_BUFFER_COUNT = 4;
+
+    int m_portnum;
+    bool m_closing = false;
+
+    HMIDIIN  m_hMidiIn = nullptr;
+
+    MIDIHDR m_sysexHdr[SYSEX_BUFFER_COUNT]{};
+    BYTE    m_sysexData[SYSEX_BUFFER_COUNT][SYSEX_BUFFER_SIZE]{};
+};
+
+// ----------------------------------------------------------------------------
+MidiInDevice* createMidiInWinMM(int portnum)
+{
+    return new MidiInDeviceWinMM(portnum);
+}
+
+#else
+
+// ----------------------------------------------------------------------------
+MidiInDevice* createMidiInWinMM(int)
+{
+    return nullptr;
+}
+
+#endif // _WIN32
@@ -3,15 +3,14 @@
 #include <vector>
 
 #include "patches.h"
-#include "player.h"
 
 #include "pe_resource.h"
 
 // ----------------------------------------------------------------------------
 bool OPLPatch::load(OPLPatchSet& patches, const char *path)
 {
-	FILE* file;
-	if (fopen_s(&file, path, "rb")) return false;
+	FILE* file = fopen(path, "rb");
+	if (!file) return false;
 
 	bool ok = load(patches, file);
 	
@@ -115,7 +114,7 @@ bool OPLPatch::loadWOPL(OPLPatchSet& patches, const uint8_t *data, size_t size)
 		patch.voice[0].tune     = (int8_t)bytes[33] - 12;
 		patch.voice[1].tune     = (int8_t)bytes[35] - 12;
 		patch.velocity          = (int8_t)bytes[36];
-		patch.voice[1].finetune = OPLPlayer::midiCalcBend((int8_t)bytes[37] / 64.0);
+		patch.voice[1].finetune = (int8_t)bytes[37] * 4; // (1/64 semitones)
 		patch.fixedNote         = bytes[38];
 		patch.fourOp            = (bytes[39] & 3) == 1;
 		patch.dualTwoOp         = (bytes[39] & 3) == 3;
@@ -168,7 +167,7 @@ bool OPLPatch::loadOP2(OPLPatchSet& patches, const uint8_t *data, size_t size)
 		// flag bit 0 is "fixed pitch" (for drums), but it's seemingly only used for drum patches anyway, so ignore it?
 		patch.dualTwoOp = (bytes[0] & 4);
 		// second voice detune
-		patch.voice[1].finetune = OPLPlayer::midiCalcBend((int8_t)(bytes[2] - 128) / 64.0);
+		patch.voice[1].finetune = (int8_t)(bytes[2] - 128) * 4; // (1/64 semitones)
 	
 		patch.fixedNote = bytes[3];
 		
@@ -335,7 +334,7 @@ bool OPLPatch::loadFMSYNTHBIN(OPLPatchSet& patches, const uint8_t* data, size_t
 	if (size != 256 * 28)
 		return false;
 
-	for (uint16_t key = 0; key < 128; key++) // 128ȍ~̓ĥ͂Ǐ肭Ȃ  ԂBDh̃h[hp
+	for (uint16_t key = 0; key < 128; key++) // 128以降はドラムのはず･･･だけど上手く鳴らない → たぶんBDhのドラムモード専用
 	{
 		OPLPatch& patch = patches[key];
 		// clear patch data
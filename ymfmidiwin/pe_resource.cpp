@@ -1,10 +1,11 @@
-#include <windows.h>
 #include <vector>
 #include <cstdint>
 #include <cstdio>
 
 #include "pe_resource.h"
 
+#ifdef _WIN32
+
 static bool SafeRvaToPtr(
     const BYTE* base, size_t imageSize,
     DWORD rva, size_t size,
@@ -34,7 +35,7 @@ static bool SafeRvaToPtr(
         }
     }
 
-    return false; // ͈͊OG[
+    return false; // 範囲外エラー
 }
 
 struct SafeContext {
@@ -52,7 +53,7 @@ static bool EnumResourceRecursive(
     const IMAGE_NT_HEADERS* nt,
     std::vector<BYTE>& out)
 {
-    if (depth > 5) return false; // [͕̂
+    if (depth > 5) return false; // 深すぎるのは変
 
     const BYTE* dirPtr;
     if (!SafeRvaToPtr(ctx.base, ctx.imageSize, dirRva,
@@ -114,8 +115,8 @@ static bool EnumResourceRecursive(
     return false;
 }
 
-// dll͂ĎwTCỸ\[XΒo
-bool ExtractResourceBySizeFromMemoryPE(const void* basePtr, size_t imageSize, DWORD targetSize, std::vector<BYTE>& out)
+// dllを解析して指定サイズのリソースがあれば抽出
+bool ExtractResourceBySizeFromMemoryPE(const void* basePtr, size_t imageSize, uint32_t targetSize, std::vector<uint8_t>& out)
 {
     out.clear();
 
@@ -152,7 +153,7 @@ bool ExtractResourceBySizeFromMemoryPE(const void* basePtr, size_t imageSize, DW
     }
     else
     {
-        return false; // s or j
+        return false; // 不明 or 破損
     }
 
     if (!rsrcRva || !rsrcSize)
@@ -166,3 +167,14 @@ bool ExtractResourceBySizeFromMemoryPE(const void* basePtr, size_t imageSize, DW
 
     return EnumResourceRecursive(ctx, rsrcRva, 0, targetSize, nt, out);
 }
+
+#else
+
+// PEの解析はWindowsのみ (他環境ではDLL音色は読み込めない)
+bool ExtractResourceBySizeFromMemoryPE(const void*, size_t, uint32_t, std::vector<uint8_t>& out)
+{
+    out.clear();
+    return false;
+}
+
+#endif
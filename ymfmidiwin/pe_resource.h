@@ -1,8 +1,10 @@
 #pragma once
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
 #include <vector>
 #include <cstdint>
 #include <cstdio>
 
-bool ExtractResourceBySizeFromMemoryPE(const void* basePtr, size_t imageSize, DWORD targetSize, std::vector<BYTE>& out);
+bool ExtractResourceBySizeFromMemoryPE(const void* basePtr, size_t imageSize, uint32_t targetSize, std::vector<uint8_t>& out);
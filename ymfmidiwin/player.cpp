@@ -1,7 +1,11 @@
 #include "player.h"
+#include "profiler.h"
 #include "sequence.h"
 
+#include <chrono>
 #include <cmath>
+#include <cstdarg>
+#include <cstdio>
 #include <cstring>
 
 #if 0
@@ -45,6 +49,52 @@ static const unsigned oper_num[18] = {
 	0x100, 0x101, 0x102, 0x108, 0x109, 0x10A, 0x110, 0x111, 0x112
 };
 
+// lookup table shamelessly stolen from Nuke.YKT
+static const uint8_t opl_volume_map[32] =
+{
+	80, 63, 40, 36, 32, 28, 23, 21,
+	19, 17, 15, 14, 13, 12, 11, 10,
+	 9,  8,  7,  6,  5,  5,  4,  4,
+	 3,  3,  2,  2,  1,  1,  0,  0
+};
+
+// pitches are in 1/256 semitones from MIDI note 0
+static const int pitchStepsPerSemitone = 256;
+static const int pitchStepsPerOctave = 12 * pitchStepsPerSemitone;
+// pitch of the first F-number table entry (512 at block 0),
+// from A = 580 at block 0 (calculated from A440)
+static const int fnumTablePitch = 1751;
+
+// ----------------------------------------------------------------------------
+// printf to the end of a string
+static void appendf(std::string& text, const char *fmt, ...)
+{
+	char buffer[256];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(buffer, sizeof(buffer), fmt, args);
+	va_end(args);
+	text += buffer;
+}
+
+// ----------------------------------------------------------------------------
+// F-numbers for each pitch step of an octave, from 512 up to 1023
+// (shared by all players and built on first use)
+static const uint16_t* fnumTable()
+{
+	static const std::array<uint16_t, pitchStepsPerOctave> table = []
+	{
+		std::array<uint16_t, pitchStepsPerOctave> fnums;
+		for (int i = 0; i < pitchStepsPerOctave; i++)
+		{
+			const double fnum = 580.0 * pow(2.0, (double)(fnumTablePitch + i - 9 * pitchStepsPerSemitone) / pitchStepsPerOctave);
+			fnums[i] = (uint16_t)std::min(1023.0, floor(fnum + 0.5));
+		}
+		return fnums;
+	}();
+	return table.data();
+}
+
 // ----------------------------------------------------------------------------
 OPLPlayer::OPLPlayer(int numChips, ChipType type)
 	: ymfm::ymfm_interface()
@@ -68,11 +118,27 @@ OPLPlayer::OPLPlayer(int numChips, ChipType type)
 	for (auto& opl : m_opl3)
 		opl = new ymfm::ymf262(*this);
 	m_sampleFIFO.resize(m_numChips);
+	m_mixBuffer.resize(maxBlockSize * 2);
+	m_floatBuffer.resize(maxBlockSize * 2);
+	m_stemMode = false;
+	m_drumCacheOn = false;
+	m_drumRealtime = true;
+	m_drumRenderer = nullptr;
+	m_drumRunning = false;
+	m_reduceBelow = 0;
+	std::fill(std::begin(m_reducing), std::end(m_reducing), false);
+	
+	m_controlThreadOn = false;
+	m_controlLookahead = maxBlockSize * 2;
+	m_chipWriteTime.resize(m_numChips);
 	
 	m_sequence = nullptr;
+	m_tap = nullptr;
+	m_controlsPending = false;
 	
 	m_samplePos = 0.0;
 	m_samplesLeft = 0;
+	m_framesBeforeEnd = 0;
 	m_hpFilterFreq = 5.0; // 5Hz default to reduce DC offset
 	m_lpFilterFreq = 0; // disable
 	setSampleRate(44100); // setup both sample step and filter coefficients
@@ -81,15 +147,25 @@ OPLPlayer::OPLPlayer(int numChips, ChipType type)
 	m_looping = false;
 	m_sleepMode = false;
 
-	reset();
+	m_numPorts = 0;
+	setNumPorts(1); // (also resets everything)
+	
+	for (auto& display : m_displays)
+		display.voices.resize(m_voices.size());
+	m_displayBack = 0;
+	m_displayMiddle = 1;
+	m_displayFront = 2;
 }
 
 // ----------------------------------------------------------------------------
 OPLPlayer::~OPLPlayer()
 {
+	setControlThread(false);
+	stopPartitionWorkers();
 	for (auto& opl : m_opl3)
 		delete opl;
 	delete m_sequence;
+	setDrumCache(false);
 }
 
 // ----------------------------------------------------------------------------
@@ -98,12 +174,19 @@ void OPLPlayer::setSampleRate(uint32_t rate)
 	uint32_t rateOPL = m_opl3[0]->sample_rate(masterClock);
 	m_sampleStep = (double)rate / rateOPL;
 	m_sampleRate = rate;
+	m_nativeRate = (rate == rateOPL);
 	
 	setHPFilter(m_hpFilterFreq);
 	setLPFilter(m_lpFilterFreq);
 //	printf("OPL sample rate = %u / output sample rate = %u / step %02f\n", rateOPL, rate, m_sampleStep);
 }
 
+// ----------------------------------------------------------------------------
+uint32_t OPLPlayer::nativeSampleRate() const
+{
+	return m_opl3[0]->sample_rate(masterClock);
+}
+
 // ----------------------------------------------------------------------------
 void OPLPlayer::setGain(double gain)
 {
@@ -117,14 +200,14 @@ void OPLPlayer::setHPFilter(double cutoff)
 	
 	if (m_hpFilterFreq <= 0.0)
 	{
-		m_hpFilterCoef = 1.0;
+		m_filterCoefs.hp = 1.0f;
 	}
 	else
 	{
 		static const double pi = 3.14159265358979323846;
-		m_hpFilterCoef = 1.0 / ((2 * pi * cutoff) / m_sampleRate + 1);
+		m_filterCoefs.hp = (float)(1.0 / ((2 * pi * cutoff) / m_sampleRate + 1));
 	}
-//	printf("sample rate = %u / cutoff %f Hz / filter coef %f\n", m_sampleRate, cutoff, m_hpFilterCoef);
+//	printf("sample rate = %u / cutoff %f Hz / filter coef %f\n", m_sampleRate, cutoff, m_filterCoefs.hp);
 }
 
 // ----------------------------------------------------------------------------
@@ -134,21 +217,24 @@ void OPLPlayer::setLPFilter(double cutoff)
 
 	if (m_lpFilterFreq <= 0.0)
 	{
-		m_lpFilterCoef = 1.0;
+		m_filterCoefs.lp = 1.0f;
 	}
 	else
 	{
 		static const double pi = 3.14159265358979323846;
-		m_lpFilterCoef = 1 - exp(-m_lpFilterFreq * 2 * pi / m_sampleRate);
+		m_filterCoefs.lp = (float)(1 - exp(-m_lpFilterFreq * 2 * pi / m_sampleRate));
 	}
-	m_lpLastOut[0] = m_lpLastOut[1] = 0;
-	m_lpLastOutF[0] = m_lpLastOutF[1] = 0;
+	m_filterState.lpLastOut[0] = m_filterState.lpLastOut[1] = 0;
 }
 
 void OPLPlayer::setAutoSuspend(int suspendTimeMilliseconds) {
 	m_sequence->setAutoSuspend(suspendTimeMilliseconds);
 }
 
+void OPLPlayer::setInputLatency(int latencyMilliseconds) {
+	m_sequence->setInputLatency(latencyMilliseconds);
+}
+
 
 // ----------------------------------------------------------------------------
 void OPLPlayer::setStereo(bool on)
@@ -160,11 +246,46 @@ void OPLPlayer::setStereo(bool on)
 	}
 }
 
+// ----------------------------------------------------------------------------
+void OPLPlayer::setNumPorts(unsigned ports)
+{
+	ports = ymfm::clamp(ports, 1u, maxPorts);
+	if (ports == m_numPorts)
+		return;
+	
+	// split the chips as evenly as possible, one partition per port
+	m_numPorts = ports;
+	m_numPartitions = std::min(ports, m_numChips);
+	m_chipPartition.resize(m_numChips);
+	for (unsigned i = 0; i < m_numChips; i++)
+		m_chipPartition[i] = i * m_numPartitions / m_numChips;
+	
+	m_partitionBuffer.resize(m_numPartitions);
+	m_partitionMix.resize(m_numPartitions);
+	for (unsigned i = 0; i < m_numPartitions; i++)
+	{
+		m_partitionBuffer[i].resize(maxBlockSize);
+		m_partitionMix[i].resize(maxBlockSize * 2);
+	}
+	
+	startPartitionWorkers();
+	std::fill(std::begin(m_reducing), std::end(m_reducing), false);
+	
+	// voices point into the channel list, so start over with the new one
+	m_channels.resize(ports * 16);
+	reset();
+}
+
 // ----------------------------------------------------------------------------
 bool OPLPlayer::loadSequence(const char* path)
 {
 	delete m_sequence;
 	m_sequence = Sequence::load(path);
+	if (m_sequence)
+	{
+		m_sequence->setPatches(m_patches);
+		setNumPorts(m_sequence->numPorts());
+	}
 	
 	return m_sequence != nullptr;
 }
@@ -174,6 +295,11 @@ bool OPLPlayer::loadSequence(FILE *file, int offset, size_t size)
 {
 	delete m_sequence;
 	m_sequence = Sequence::load(file, offset, size);
+	if (m_sequence)
+	{
+		m_sequence->setPatches(m_patches);
+		setNumPorts(m_sequence->numPorts());
+	}
 	
 	return m_sequence != nullptr;
 }
@@ -183,6 +309,11 @@ bool OPLPlayer::loadSequence(const uint8_t *data, size_t size)
 {
 	delete m_sequence;
 	m_sequence = Sequence::load(data, size);
+	if (m_sequence)
+	{
+		m_sequence->setPatches(m_patches);
+		setNumPorts(m_sequence->numPorts());
+	}
 	
 	return m_sequence != nullptr;
 }
@@ -190,33 +321,119 @@ bool OPLPlayer::loadSequence(const uint8_t *data, size_t size)
 // ----------------------------------------------------------------------------
 bool OPLPlayer::loadPatches(const char* path)
 {
-	return OPLPatch::load(m_patches, path);
+	if (!OPLPatch::load(m_patches, path))
+		return false;
+	patchesChanged();
+	return true;
 }
 
 // ----------------------------------------------------------------------------
 bool OPLPlayer::loadPatches(FILE *file, int offset, size_t size)
 {
-	return OPLPatch::load(m_patches, file, offset, size);
+	if (!OPLPatch::load(m_patches, file, offset, size))
+		return false;
+	patchesChanged();
+	return true;
 }
 
 // ----------------------------------------------------------------------------
 bool OPLPlayer::loadPatches(const uint8_t *data, size_t size)
 {
-	return OPLPatch::load(m_patches, data, size);
+	if (!OPLPatch::load(m_patches, data, size))
+		return false;
+	patchesChanged();
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::patchesChanged()
+{
+	// one voice reductions of the patches that take two:
+	// double 2op ones keep their first voice, 4op ones the second pair, which always has
+	// the last carrier (op 4) and its modulator (it's additive on its own only for 4op AM+AM)
+	m_reducedPatches.clear();
+	for (auto& entry : m_patches)
+	{
+		const OPLPatch& patch = entry.second;
+		if (!patch.fourOp && !patch.dualTwoOp)
+			continue;
+		
+		OPLPatch& reduced = m_reducedPatches[&patch];
+		reduced = patch;
+		reduced.fourOp = reduced.dualTwoOp = false;
+		if (patch.fourOp)
+		{
+			reduced.voice[0] = patch.voice[1];
+			reduced.voice[0].conn = (patch.voice[1].conn & ~1) | (patch.voice[0].conn & patch.voice[1].conn & 1);
+		}
+	}
+	
+	if (m_drumCacheOn)
+		setDrumCache(true, m_drumRealtime); // patches changed, start over
+	if (m_sequence)
+		m_sequence->setPatches(m_patches);
 }
 
 // ----------------------------------------------------------------------------
 void OPLPlayer::generate(float *data, unsigned numSamples)
+{
+	using namespace std::chrono;
+	const auto start = steady_clock::now();
+
+	applyCommands(m_renderCommands);
+	if (!m_controlThreadOn)
+		applyCommands(m_midiCommands);
+
+	// keep the control thread at least a whole buffer ahead
+	if (m_controlThreadOn && numSamples * 2 > m_controlLookahead)
+		m_controlLookahead = numSamples * 2;
+
+	m_framesBeforeEnd = numSamples;
+	if (m_nativeRate)
+		generateNative(data, numSamples);
+	else
+		generateDownsampled(data, numSamples);
+
+	if (m_controlThreadOn)
+	{
+		publishEnvelopes();
+		m_controlWake.notify_one();
+	}
+	else
+	{
+		publishDisplay();
+	}
+
+	// (audio rendered in sleep mode is thrown away, so it doesn't count)
+	if (!m_sleepMode && numSamples)
+	{
+		const uint64_t time = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+		m_renderNanoseconds.fetch_add(time, std::memory_order_relaxed);
+		m_renderedSamples.fetch_add(numSamples, std::memory_order_relaxed);
+
+		// (a max loop, so that a reset by renderStats() in between isn't overwritten with an old peak)
+		const double load = time * 1e-9 * m_sampleRate / numSamples;
+		double peak = m_peakLoad.load(std::memory_order_relaxed);
+		while (load > peak && !m_peakLoad.compare_exchange_weak(peak, load, std::memory_order_relaxed))
+			;
+	}
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::generateDownsampled(float *data, unsigned numSamples)
 {
 	unsigned samp = 0;
 
 	while (samp < numSamples * 2)
 	{
+		if (m_controlThreadOn && m_sleepMode && !resumeFromSleep())
+			break; // スリープ中
+		
 		updateMIDI();
 
-		if (m_sleepMode) {
+		if (!m_controlThreadOn && m_sleepMode) {
 			m_samplesLeft = 0;
-			break; // X[v
+			break; // スリープ中
 		}
 		
 		float samples[2];
@@ -228,89 +445,362 @@ void OPLPlayer::generate(float *data, unsigned numSamples)
 			data[samp]   = samples[0];
 			data[samp+1] = samples[1];
 			
-			if (m_hpFilterCoef < 1.0)
-			{
-				for (int i = 0; i < 2; i++)
-				{
-					const float lastIn = m_hpLastInF[i];
-					m_hpLastInF[i] = data[samp+i];
-					
-					m_hpLastOutF[i] = m_hpFilterCoef * (m_hpLastOutF[i] + data[samp+i] - lastIn);
-					data[samp+i] = m_hpLastOutF[i];
-				}
-			}
-			if (m_lpFilterCoef < 1.0)
-			{
-				for (int i = 0; i < 2; i++)
-				{
-					m_lpLastOutF[i] = m_lpFilterCoef * data[samp + i] + (1 - m_lpFilterCoef) * m_lpLastOutF[i];
-					data[samp + i] = m_lpLastOutF[i];
-				}
-			}
-			
 			samp += 2;
 			m_samplePos -= 1.0;
-			if (m_samplesLeft)
+			if (m_controlThreadOn)
+				m_renderPos++;
+			else if (m_samplesLeft)
 				m_samplesLeft--;
 		}
 	}
+
+	// filter everything rendered in this call at once
+	prof::Scope profile(prof::StageFilter);
+	dsp::filter(data, samp / 2, m_filterCoefs, m_filterState);
 }
 
 // ----------------------------------------------------------------------------
 void OPLPlayer::generate(int16_t *data, unsigned numSamples)
+{
+	// render in float and convert block by block
+	while (numSamples)
+	{
+		const unsigned count = std::min(numSamples, maxBlockSize);
+		
+		// in sleep mode generate(float*) returns early, leaving silence
+		memset(m_floatBuffer.data(), 0, count * 2 * sizeof(float));
+		generate(m_floatBuffer.data(), count);
+		dsp::toInt16(m_floatBuffer.data(), data, count * 2);
+		
+		data += count * 2;
+		numSamples -= count;
+	}
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::generateNative(float *data, unsigned numSamples)
 {
 	unsigned samp = 0;
 
-	while (samp < numSamples * 2)
+	while (samp < numSamples)
 	{
-		updateMIDI();
-		
-		while (m_samplePos >= 1.0 && samp < numSamples * 2)
+		unsigned count = std::min(numSamples - samp, maxBlockSize);
+		if (m_controlThreadOn)
 		{
-			if (m_hpFilterCoef < 1.0)
+			if (m_sleepMode && !resumeFromSleep())
+				break; // スリープ中
+			
+			// render up to the next queued register write
+			count = applyWrites(count);
+		}
+		else
+		{
+			updateSequence();
+
+			if (m_sleepMode) {
+				m_samplesLeft = 0;
+				break; // スリープ中
+			}
+			if (samp < m_framesBeforeEnd && sequenceAtEnd())
+				m_framesBeforeEnd = samp;
+
+			// render up to the next MIDI event (or the end of the buffer) in one go
+			if (m_samplesLeft && m_samplesLeft < count)
+				count = m_samplesLeft;
+		}
+
+		int32_t *mix = m_mixBuffer.data();
+		memset(mix, 0, count * 2 * sizeof(int32_t));
+
+		if (m_numPartitions > 1 && count >= minParallelBlockSize)
+		{
+			// partitions share no chips, so render all but the first one on the worker threads
+			for (auto& worker : m_partitionWorkers)
+			{
+				worker->count = count;
+				worker->state.store(PartitionWorker::Posted, std::memory_order_release);
+				worker->wake.notify_one();
+			}
+			renderPartition(0, mix, count);
+			for (unsigned p = 1; p < m_numPartitions; p++)
 			{
-				for (int i = 0; i < 2; i++)
+				PartitionWorker& worker = *m_partitionWorkers[p - 1];
+				int state = PartitionWorker::Posted;
+				if (worker.state.compare_exchange_strong(state, PartitionWorker::Claimed, std::memory_order_acquire))
 				{
-					const int32_t lastIn = m_hpLastIn[i];
-					m_hpLastIn[i] = m_output.data[i];
-					
-					m_hpLastOut[i] = m_hpFilterCoef * (m_hpLastOut[i] + m_output.data[i] - lastIn);
-					m_output.data[i] = m_hpLastOut[i];
+					// the worker hasn't woken up yet, don't wait for it
+					renderPartition(p, mix, count);
 				}
+				else
+				{
+					// being rendered: spin, it takes about as long as partition 0 did
+					for (unsigned spin = 0; worker.state.load(std::memory_order_acquire) != PartitionWorker::Done; spin++)
+					{
+						if (spin >= 1000)
+							std::this_thread::yield();
+					}
+					const int32_t *partMix = m_partitionMix[p].data();
+					for (unsigned j = 0; j < count * 2; j++)
+						mix[j] += partMix[j];
+				}
+				worker.state.store(PartitionWorker::Idle, std::memory_order_relaxed);
+			}
+		}
+		else
+		{
+			for (unsigned p = 0; p < m_numPartitions; p++)
+				renderPartition(p, mix, count);
+		}
+		if (!m_drumHits.empty())
+			mixDrums(mix, count);
+		if (m_tap)
+			m_tap->chipOutput(mix, count);
+
+		float *out = data + samp * 2;
+		dsp::gain(mix, out, count, (float)(m_sampleGain / 32767.0));
+		{
+			prof::Scope profile(prof::StageFilter);
+			dsp::filter(out, count, m_filterCoefs, m_filterState);
+		}
+
+		samp += count;
+		if (m_controlThreadOn)
+			m_renderPos += count;
+		else if (m_samplesLeft)
+			m_samplesLeft -= count;
+	}
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::startPartitionWorkers()
+{
+	stopPartitionWorkers();
+	
+	for (unsigned p = 1; p < m_numPartitions; p++)
+	{
+		std::unique_ptr<PartitionWorker> worker(new PartitionWorker);
+		snprintf(worker->name, sizeof(worker->name), "partition %u", p);
+		worker->thread = std::thread(&OPLPlayer::partitionLoop, this, worker.get(), p);
+		m_partitionWorkers.push_back(std::move(worker));
+	}
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::stopPartitionWorkers()
+{
+	for (auto& worker : m_partitionWorkers)
+	{
+		{
+			std::lock_guard<std::mutex> lock(worker->mutex);
+			worker->running = false;
+		}
+		worker->wake.notify_one();
+		worker->thread.join();
+	}
+	m_partitionWorkers.clear();
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::partitionLoop(PartitionWorker *self, unsigned partition)
+{
+	PartitionWorker& worker = *self;
+	prof::setThreadName(worker.name);
+	
+	while (worker.running)
+	{
+		int state = PartitionWorker::Posted;
+		if (worker.state.compare_exchange_strong(state, PartitionWorker::Claimed, std::memory_order_acquire))
+		{
+			const unsigned count = worker.count;
+			int32_t *mix = m_partitionMix[partition].data();
+			memset(mix, 0, count * 2 * sizeof(int32_t));
+			renderPartition(partition, mix, count);
+			worker.state.store(PartitionWorker::Done, std::memory_order_release);
+			continue;
+		}
+		
+		// the audio thread notifies without the lock, so a wakeup can be missed;
+		// it renders the block itself then, and the timeout gets this thread going again
+		std::unique_lock<std::mutex> lock(worker.mutex);
+		worker.wake.wait_for(lock, std::chrono::milliseconds(10), [&worker]
+		{
+			return worker.state.load(std::memory_order_relaxed) == PartitionWorker::Posted || !worker.running;
+		});
+	}
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::renderPartition(unsigned partition, int32_t *mix, unsigned count)
+{
+	auto& buffer = m_partitionBuffer[partition];
+	
+	for (unsigned i = 0; i < m_numChips; i++)
+	{
+		if (m_chipPartition[i] != partition)
+			continue;
+		
+		// use samples already generated between register writes first
+		unsigned pos = 0;
+		auto& fifo = m_sampleFIFO[i];
+		for (; pos < count && !fifo.empty(); pos++)
+		{
+			buffer[pos] = fifo.front();
+			fifo.pop();
+		}
+		if (pos < count)
+		{
+			prof::Scope profile(prof::StageChip);
+			m_opl3[i]->generate(&buffer[pos], count - pos);
+		}
+
+		for (unsigned j = 0; j < count; j++)
+		{
+			mix[j*2]   += buffer[j].data[0];
+			mix[j*2+1] += buffer[j].data[1];
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::setStemMode(bool on)
+{
+	m_stemMode = on;
+	if (on)
+	{
+		m_stemFIFO.resize(m_numChips);
+		m_stemChipBuffer.resize(maxBlockSize);
+		m_stemMixBuffer.resize(numStems * maxBlockSize * 2);
+		for (auto& state : m_stemFilterState)
+			state.reset();
+	}
+	else
+	{
+		m_stemFIFO.clear();
+		m_stemChipBuffer.clear();
+		m_stemMixBuffer.clear();
+	}
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::stemMasks(int chip, uint32_t *masks) const
+{
+	for (unsigned i = 0; i < numStems; i++)
+		masks[i] = 0;
+
+	// released voices keep their channel until they are reused, so tails stay on the right bus
+	// (a 4op voice is output entirely by its primary channel)
+	for (auto& voice : m_voices)
+	{
+		if (voice.chip == chip && voice.channel)
+			masks[voice.channel->num % numStems] |= 1 << ((voice.num & 0xff) + 9 * (voice.num >> 8));
+	}
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::generateStems(float *data, unsigned numSamples)
+{
+	if (!m_nativeRate || !m_stemMode)
+		return;
+	
+	applyCommands(m_renderCommands);
+	applyCommands(m_midiCommands);
+
+	const unsigned busSize = maxBlockSize * 2;
+	unsigned samp = 0;
+	m_framesBeforeEnd = numSamples;
+
+	while (samp < numSamples)
+	{
+		updateSequence();
+
+		if (m_sleepMode) {
+			m_samplesLeft = 0;
+			break; // スリープ中
+		}
+		if (samp < m_framesBeforeEnd && sequenceAtEnd())
+			m_framesBeforeEnd = samp;
+
+		// render up to the next MIDI event (or the end of the buffer) in one go
+		unsigned count = std::min(numSamples - samp, maxBlockSize);
+		if (m_samplesLeft && m_samplesLeft < count)
+			count = m_samplesLeft;
+
+		int32_t *mix = m_stemMixBuffer.data();
+		memset(mix, 0, numStems * busSize * sizeof(int32_t));
+
+		for (unsigned i = 0; i < m_numChips; i++)
+		{
+			uint32_t masks[numStems];
+			stemMasks(i, masks);
+
+			// use samples already generated between register writes first
+			unsigned pos = 0;
+			auto& fifo = m_stemFIFO[i];
+			for (; pos < count && !fifo.empty(); pos++)
+			{
+				m_stemChipBuffer[pos] = fifo.front();
+				fifo.pop();
 			}
-			if (m_lpFilterCoef < 1.0)
+			if (pos < count)
 			{
-				for (int i = 0; i < 2; i++)
+				prof::Scope profile(prof::StageChip);
+				m_opl3[i]->generate_channels(m_stemChipBuffer[pos].data(), count - pos, masks, numStems);
+			}
+
+			for (unsigned j = 0; j < count; j++)
+			{
+				for (unsigned k = 0; k < numStems; k++)
 				{
-					m_lpLastOut[i] = m_lpFilterCoef * m_output.data[i] + (1 - m_lpFilterCoef) * m_lpLastOut[i];
-					m_output.data[i] = m_lpLastOut[i];
+					mix[k * busSize + j*2]   += m_stemChipBuffer[j][k].data[0];
+					mix[k * busSize + j*2+1] += m_stemChipBuffer[j][k].data[1];
 				}
 			}
+		}
 
-			data[samp]   = ymfm::clamp(m_output.data[0], -32768, 32767);
-			data[samp+1] = ymfm::clamp(m_output.data[1], -32768, 32767);
-			
-			samp += 2;
-			m_samplePos -= 1.0;
-			if (m_samplesLeft)
-				m_samplesLeft--;
+		// apply gain and filters per bus, then interleave the buses into the output
+		const float gain = (float)(m_sampleGain / 32767.0);
+		float *bus = m_floatBuffer.data();
+		for (unsigned k = 0; k < numStems; k++)
+		{
+			if (!m_drumHits.empty())
+				mixDrums(mix + k * busSize, count, k);
+			dsp::gain(mix + k * busSize, bus, count, gain);
+			{
+				prof::Scope profile(prof::StageFilter);
+				dsp::filter(bus, count, m_filterCoefs, m_stemFilterState[k]);
+			}
+
+			float *out = data + (samp * numStems + k) * 2;
+			for (unsigned j = 0; j < count; j++)
+			{
+				out[j * numStems * 2]     = bus[j*2];
+				out[j * numStems * 2 + 1] = bus[j*2+1];
+			}
 		}
+
+		samp += count;
+		if (m_samplesLeft)
+			m_samplesLeft -= count;
 	}
+	
+	publishDisplay();
 }
 
 // ----------------------------------------------------------------------------
-void OPLPlayer::updateMIDI()
+bool OPLPlayer::updateSequence()
 {
-	while (!m_samplesLeft && m_sequence && !atEnd())
+	while (!m_samplesLeft && m_sequence && !sequenceAtEnd())
 	{	
 		// time to update midi playback
-		m_samplesLeft = m_sequence->update(*this);
+		{
+			prof::Scope profile(prof::StageSequencer);
+			m_samplesLeft = m_sequence->update(*this);
+		}
 		if (m_samplesLeft == UINT_MAX) {
-			m_samplesLeft = 1; // ݁[
-			m_output.data[0] = 0;
-			m_output.data[1] = 0;
+			m_samplesLeft = 1; // だみー
 			m_sleepMode = true;
-			return;
+			flushControls();
+			return true;
 		}
 		m_sleepMode = false;
 		for (auto& voice : m_voices)
@@ -324,6 +814,25 @@ void OPLPlayer::updateMIDI()
 			m_timePassed = true;
 	}
 
+	// everything up to here happens at once, so only the last values matter
+	flushControls();
+	return false;
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::updateMIDI()
+{
+	if (m_controlThreadOn)
+	{
+		applyWrites(1);
+	}
+	else if (updateSequence())
+	{
+		m_output.data[0] = 0;
+		m_output.data[1] = 0;
+		return;
+	}
+
 	if (m_samplePos >= 1.0)
 	{
 		return; // existing output still waiting to be consumed
@@ -332,6 +841,7 @@ void OPLPlayer::updateMIDI()
 	m_output.data[0] = m_lastOut[0];
 	m_output.data[1] = m_lastOut[1];
 	
+	prof::Scope profile(prof::StageDownsample);
 	while (m_samplePos < 1.0)
 	{
 		ymfm::ymf262::output_data output;
@@ -341,6 +851,7 @@ void OPLPlayer::updateMIDI()
 		{
 			if (m_sampleFIFO[i].empty())
 			{
+				prof::Scope profile(prof::StageChip);
 				m_opl3[i]->generate(&output);
 			}
 			else
@@ -352,6 +863,8 @@ void OPLPlayer::updateMIDI()
 			samples[0] += output.data[0];
 			samples[1] += output.data[1];
 		}
+		if (!m_drumHits.empty())
+			mixDrums(samples, 1);
 		
 		m_samplePos += m_sampleStep;
 		
@@ -381,132 +894,459 @@ void OPLPlayer::updateMIDI()
 	m_output.data[1] *= m_sampleGain * step;
 }
 
+// ----------------------------------------------------------------------------
+bool OPLPlayer::setControlThread(bool on)
+{
+	if (on == m_controlThreadOn)
+		return true;
+	
+	if (on)
+	{
+		// (both would need the voices on the render thread)
+		if (m_stemMode || m_drumCacheOn)
+			return false;
+		
+		m_writeQueues.clear();
+		for (unsigned i = 0; i < m_numChips; i++)
+			m_writeQueues.emplace_back(new RegWriteQueue);
+		m_envelopes.reset(new std::atomic<uint16_t>[m_voices.size() * 2]);
+		
+		m_controlPos = m_renderPos = 0;
+		std::fill(m_chipWriteTime.begin(), m_chipWriteTime.end(), 0);
+		for (auto& voice : m_voices)
+			voice.onTime = 0;
+		publishEnvelopes();
+		
+		m_controlThreadOn = true;
+		m_controlParked = false;
+		m_controlRunning = true;
+		m_controlThread = std::thread(&OPLPlayer::controlLoop, this);
+	}
+	else
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_controlMutex);
+			m_controlRunning = false;
+		}
+		m_controlWake.notify_one();
+		m_controlThread.join();
+		
+		// nothing is rendered ahead, so whatever is still queued is due now
+		for (unsigned i = 0; i < m_numChips; i++)
+			flushWrites(i);
+		m_controlThreadOn = false;
+		m_controlParked = false;
+	}
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::controlLoop()
+{
+	prof::setThreadName("control");
+	
+	std::unique_lock<std::mutex> lock(m_controlMutex);
+	while (m_controlRunning)
+	{
+		applyCommands(m_midiCommands);
+		
+		// don't get more than the lookahead ahead of rendering
+		// (when behind, keep going without waiting: the writes are late, the song isn't)
+		const uint64_t renderPos = m_renderPos;
+		const uint64_t target = renderPos + m_controlLookahead;
+		if (m_controlPos >= target)
+		{
+			m_controlWake.wait_for(lock, std::chrono::milliseconds(1));
+			continue;
+		}
+		
+		lock.unlock();
+		const bool sleeping = updateSequence();
+		if (!sleeping)
+			publishDisplay();
+		lock.lock();
+		
+		if (sleeping)
+		{
+			// the render thread keeps polling the sequence until it wakes up
+			m_samplesLeft = 0;
+			m_controlParked = true;
+			m_controlWake.wait(lock, [this] { return !m_controlParked || !m_controlRunning; });
+			continue;
+		}
+		if (!m_samplesLeft)
+		{
+			// no sequence, or at the end of it: whatever comes next starts from now
+			if (m_controlPos < renderPos)
+				m_controlPos = renderPos;
+			m_controlWake.wait_for(lock, std::chrono::milliseconds(1));
+			continue;
+		}
+		
+		const uint32_t step = (uint32_t)std::min<uint64_t>(m_samplesLeft, target - m_controlPos);
+		m_controlPos += step;
+		m_samplesLeft -= step;
+	}
+}
+
+// ----------------------------------------------------------------------------
+uint64_t OPLPlayer::controlWriteTime(int chip) const
+{
+	return std::max<uint64_t>(m_controlPos, m_chipWriteTime[chip]);
+}
+
+// ----------------------------------------------------------------------------
+unsigned OPLPlayer::applyWrites(unsigned count)
+{
+	const uint64_t pos = m_renderPos;
+	for (unsigned i = 0; i < m_numChips; i++)
+	{
+		// (writes the control thread was late with are applied right away)
+		RegWriteQueue& queue = *m_writeQueues[i];
+		const TimedWrite *next;
+		for (; (next = queue.front()) != nullptr && next->time <= pos; queue.pop())
+			applyWrite(i, next->addr, next->data);
+		
+		if (next && next->time - pos < count)
+			count = (unsigned)(next->time - pos);
+	}
+	return count;
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::flushWrites(int chip)
+{
+	RegWriteQueue& queue = *m_writeQueues[chip];
+	for (const TimedWrite *next; (next = queue.front()) != nullptr; queue.pop())
+		applyWrite(chip, next->addr, next->data);
+}
+
+// ----------------------------------------------------------------------------
+bool OPLPlayer::resumeFromSleep()
+{
+	// (the control thread is about to park, or just being woken up)
+	if (!m_controlParked)
+		return false;
+	std::unique_lock<std::mutex> lock(m_controlMutex, std::try_to_lock);
+	if (!lock.owns_lock())
+		return false;
+	
+	// anything still queued from before going to sleep is long overdue
+	for (unsigned i = 0; i < m_numChips; i++)
+		flushWrites(i);
+	m_controlPos = m_renderPos.load();
+	applyCommands(m_midiCommands);
+	
+	m_samplesLeft = 0;
+	if (updateSequence())
+	{
+		m_samplesLeft = 0;
+		return false;
+	}
+	
+	m_controlParked = false;
+	lock.unlock();
+	m_controlWake.notify_one();
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::publishEnvelopes()
+{
+	// (the voices belong to the control thread, but their operators are fixed, see reset)
+	for (size_t i = 0; i < m_voices.size(); i++)
+	{
+		const ymfm::ymf262& chip = *m_opl3[i / 18];
+		for (unsigned op = 0; op < 2; op++)
+		{
+			const uint32_t opNum = oper_num[i % 18] + op * 3;
+			const uint16_t envelope = (uint16_t)((chip.debug_eg_state(opNum) << 10) | chip.debug_eg_attenuation(opNum));
+			m_envelopes[i * 2 + op].store(envelope, std::memory_order_relaxed);
+		}
+	}
+	m_envelopePos.store(m_renderPos, std::memory_order_release);
+}
+
+// ----------------------------------------------------------------------------
+bool OPLPlayer::postCommand(Command command, double value)
+{
+	const QueuedCommand queued = { command, value };
+	switch (command)
+	{
+	case CommandGain:
+	case CommandHPFilter:
+	case CommandLPFilter:
+		return m_renderCommands.push(queued);
+	default:
+		return m_midiCommands.push(queued);
+	}
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::applyCommands(Commands& queue)
+{
+	QueuedCommand queued;
+	while (queue.pop(queued))
+	{
+		switch (queued.command)
+		{
+		case CommandPanic:     panic(); break;
+		case CommandResetMIDI: resetMIDI((MIDIType)(int)queued.value); break;
+		case CommandReset:     reset(); break;
+		case CommandSongNum:   setSongNum((unsigned)queued.value); break;
+		case CommandGain:      setGain(queued.value); break;
+		case CommandHPFilter:  setHPFilter(queued.value); break;
+		case CommandLPFilter:  setLPFilter(queued.value); break;
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+OPLPlayer::RenderStats OPLPlayer::renderStats(bool reset)
+{
+	RenderStats stats = {};
+
+	const uint64_t time = reset ? m_renderNanoseconds.exchange(0) : m_renderNanoseconds.load();
+	const uint64_t samples = reset ? m_renderedSamples.exchange(0) : m_renderedSamples.load();
+	if (samples)
+		stats.load = time * 1e-9 * m_sampleRate / samples;
+	stats.peakLoad = reset ? m_peakLoad.exchange(0) : m_peakLoad.load();
+	stats.deadlineMisses = reset ? m_deadlineMisses.exchange(0) : m_deadlineMisses.load();
+	stats.underruns = reset ? m_underruns.exchange(0) : m_underruns.load();
+
+	if (m_sequence)
+		m_sequence->inputStats(stats.midiHighWater, stats.midiDropped, reset);
+
+	return stats;
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::reportOutputCycle(double busySeconds, double periodSeconds)
+{
+	if (busySeconds > periodSeconds)
+		m_deadlineMisses.fetch_add(1, std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::reportUnderrun()
+{
+	m_underruns.fetch_add(1, std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::publishDisplay()
+{
+	DisplaySnapshot& display = m_displays[m_displayBack];
+	for (size_t i = 0; i < m_voices.size(); i++)
+	{
+		const OPLVoice& voice = m_voices[i];
+		DisplayVoice& shown = display.voices[i];
+		shown.patch = voice.patch;
+		shown.channel = voice.channel ? voice.channel->num + 1 : 0;
+		shown.note = voice.note;
+		shown.on = voice.on;
+		shown.active = voice.on || voice.justChanged;
+	}
+	for (int i = 0; i < 16; i++)
+	{
+		const MIDIChannel& channel = m_channels[i];
+		DisplayChannel& shown = display.channels[i];
+		shown.patch = findPatch(i, 0);
+		shown.percussion = channel.percussion;
+		shown.volume = channel.volume;
+		shown.pan = channel.pan;
+	}
+	
+	m_displayBack = m_displayMiddle.exchange(m_displayBack | displayFresh, std::memory_order_acq_rel) & 3;
+}
+
+// ----------------------------------------------------------------------------
+const OPLPlayer::DisplaySnapshot& OPLPlayer::displaySnapshot()
+{
+	if (m_displayMiddle.load(std::memory_order_relaxed) & displayFresh)
+		m_displayFront = m_displayMiddle.exchange(m_displayFront, std::memory_order_acq_rel) & 3;
+	return m_displays[m_displayFront];
+}
+
 // ----------------------------------------------------------------------------
 void OPLPlayer::displayClear()
 {
-	for (int i = 0; i < 18; i++)
-		printf("%79s\n", "");
+	// (including the profile below the channels/voices)
+	m_displayText.clear();
+	for (int i = 0; i < 18 + 3 + prof::NumStages; i++)
+		appendf(m_displayText, "%79s\n", "");
+	fwrite(m_displayText.data(), 1, m_displayText.size(), stdout);
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::displayProfile(std::string& text)
+{
+	if (!prof::enabled())
+		return;
+	
+	appendf(text, "%79s\n", "");
+	appendf(text, "Stage         |   calls/s |   p50 us |   p90 us |   p99 us |   max us | load %%\n");
+	appendf(text, "--------------+-----------+----------+----------+----------+----------+-------\n");
+	for (int i = 0; i < prof::NumStages; i++)
+	{
+		const prof::Stats stats = prof::stats((prof::Stage)i);
+		appendf(text, "%-13.13s | %9.0f | %8.2f | %8.2f | %8.2f | %8.2f | %6.2f\n",
+			prof::stageName((prof::Stage)i), stats.callsPerSecond,
+			stats.p50, stats.p90, stats.p99, stats.max, stats.load * 100);
+	}
 }
 
 // ----------------------------------------------------------------------------
 void OPLPlayer::displayChannels()
 {
+	const DisplaySnapshot& display = displaySnapshot();
+	std::string& text = m_displayText;
+	text.clear();
+	
+	// (with several input ports, voices are counted for the same channel of every port)
 	unsigned numVoices[16] = {0};
 	unsigned totalVoices = 0;
-	for (auto& voice : m_voices)
+	for (auto& voice : display.voices)
 	{
-		if (voice.channel && (voice.on || voice.justChanged))
+		if (voice.channel && voice.active)
 		{
-			numVoices[voice.channel->num]++;
+			numVoices[(voice.channel - 1) & 15]++;
 			totalVoices++;
 		}
 	}
 	
-	printf("Chn | Patch Name                       | Vol | Pan | Active Voices: %u/%-6lu\n", totalVoices, (uint32_t)m_voices.size());
-	printf("----+----------------------------------+-----+-----+---------------------------\n");
+	appendf(text, "Chn | Patch Name                       | Vol | Pan | Active Voices: %u/%-6lu\n", totalVoices, (uint32_t)display.voices.size());
+	appendf(text, "----+----------------------------------+-----+-----+---------------------------\n");
 	for (int i = 0; i < 16; i++)
 	{
-		const auto& channel = m_channels[i];
-		const OPLPatch *patch = findPatch(i, 0);
+		const auto& channel = display.channels[i];
 	
-		printf("%3u | %-32.32s | %3u | %3u | ", i + 1, 
-			channel.percussion ? "Percussion" : (patch ? patch->name.c_str() : ""),
+		appendf(text, "%3u | %-32.32s | %3u | %3u | ", i + 1, 
+			channel.percussion ? "Percussion" : (channel.patch ? channel.patch->name.c_str() : ""),
 			channel.volume, channel.pan);
 		
-		if (m_voices.size() < 100)
+		if (display.voices.size() < 100)
 		{
-			printf("%2u ", numVoices[i]);
+			appendf(text, "%2u ", numVoices[i]);
 			for (int j = 0; j < 23; j++)
-				printf("%c", j < numVoices[i] ? '*' : ' ');
+				text += j < numVoices[i] ? '*' : ' ';
 		}
 		else
 		{
-			printf("%3u ", numVoices[i]);
+			appendf(text, "%3u ", numVoices[i]);
 			for (int j = 0; j < 22; j++)
-				printf("%c", j < numVoices[i] ? '*' : ' ');
+				text += j < numVoices[i] ? '*' : ' ';
 		}
-		printf("\n");
+		text += '\n';
 	}
+	
+	displayProfile(text);
+	fwrite(text.data(), 1, text.size(), stdout);
 }
 
 // ----------------------------------------------------------------------------
 void OPLPlayer::displayVoices()
 {
-	const unsigned numRows = std::min(18u, (unsigned)m_voices.size());
+	const DisplaySnapshot& display = displaySnapshot();
+	const auto& voices = display.voices;
+	std::string& text = m_displayText;
+	text.clear();
+	
+	const unsigned numRows = std::min(18u, (unsigned)voices.size());
 	for (unsigned i = 0; i < numRows; i++)
 	{
-		if (m_voices.size() <= 18)
+		if (voices.size() <= 18)
 		{
-			printf("voice %2u: ", i + 1);
-			if (m_voices[i].channel)
+			appendf(text, "voice %2u: ", i + 1);
+			if (voices[i].channel)
 			{
-				printf("channel %2u, note %3u %c %-32.32s",
-					m_voices[i].channel->num + 1, m_voices[i].note,
-					m_voices[i].on ? '*' : ' ',
-					m_voices[i].patch ? m_voices[i].patch->name.c_str() : "");
+				appendf(text, "channel %2u, note %3u %c %-32.32s",
+					voices[i].channel, voices[i].note,
+					voices[i].on ? '*' : ' ',
+					voices[i].patch ? voices[i].patch->name.c_str() : "");
 			}
 			else
 			{
-				printf("%69s", "");
+				appendf(text, "%69s", "");
 			}
 		}
-		else if (m_voices.size() <= 18*2)
+		else if (voices.size() <= 18*2)
 		{
-			for (int j = i; j < m_voices.size(); j += 18)
+			for (int j = i; j < voices.size(); j += 18)
 			{
-				printf("voice %2u: ", j + 1);
-				if (m_voices[j].channel)
+				appendf(text, "voice %2u: ", j + 1);
+				if (voices[j].channel)
 				{
-					printf("channel %2u, note %3u %c",
-						m_voices[j].channel->num + 1, m_voices[j].note,
-						m_voices[j].on ? '*' : ' ');
+					appendf(text, "channel %2u, note %3u %c",
+						voices[j].channel, voices[j].note,
+						voices[j].on ? '*' : ' ');
 				}
 				else
 				{
-					printf("%22s", "");
+					appendf(text, "%22s", "");
 				}
 				
 				if (j < 18)
-					printf("        | ");
+					appendf(text, "        | ");
 			}
 		}
-		else if (m_voices.size() <= 18*4)
+		else if (voices.size() <= 18*4)
 		{
-			for (int j = i; j < m_voices.size(); j += 18)
+			for (int j = i; j < voices.size(); j += 18)
 			{
-				printf("%2u: ", j + 1);
-				if (m_voices[j].channel)
+				appendf(text, "%2u: ", j + 1);
+				if (voices[j].channel)
 				{
-					printf("channel %2u %c",
-						m_voices[j].channel->num + 1,
-						m_voices[j].on ? '*' : ' ');
+					appendf(text, "channel %2u %c",
+						voices[j].channel,
+						voices[j].on ? '*' : ' ');
 				}
 				else
 				{
-					printf("%12s", "");
+					appendf(text, "%12s", "");
 				}
 				
-				if (j < m_voices.size() - 18)
-					printf(" | ");
+				if (j < voices.size() - 18)
+					appendf(text, " | ");
 			}
 		}
-		else if (m_voices.size() <= 18*8)
+		else if (voices.size() <= 18*8)
 		{
-			for (int j = i; j < m_voices.size(); j += 18)
+			for (int j = i; j < voices.size(); j += 18)
 			{
-				printf("%3u: %c ", j + 1, m_voices[j].on ? '*' : ' ');
+				appendf(text, "%3u: %c ", j + 1, voices[j].on ? '*' : ' ');
 				
-				if (j < m_voices.size() - 18)
-					printf(" | ");
+				if (j < voices.size() - 18)
+					appendf(text, " | ");
 			}
 		}
 		
-		printf("\n");
+		text += '\n';
 	}
+	
+	displayProfile(text);
+	fwrite(text.data(), 1, text.size(), stdout);
 }
 
 // ----------------------------------------------------------------------------
 bool OPLPlayer::atEnd() const
+{
+	// the control thread's last writes haven't been heard yet
+	if (m_controlThreadOn)
+	{
+		if (m_renderPos < m_controlPos)
+			return false;
+		for (auto& queue : m_writeQueues)
+		{
+			if (queue->front())
+				return false;
+		}
+	}
+	return sequenceAtEnd();
+}
+
+// ----------------------------------------------------------------------------
+bool OPLPlayer::sequenceAtEnd() const
 {
 	// rewind song at end only if looping is enabled
 	// AND if the song played for at least one sample,
@@ -547,19 +1387,23 @@ void OPLPlayer::reset()
 {
 	for (int i = 0; i < m_opl3.size(); i++)
 	{
-		m_opl3[i]->reset();
+		// (with a control thread, the chips belong to the render thread)
+		if (m_controlThreadOn)
+			write(i, REG_CHIP_RESET, 0);
+		else
+			m_opl3[i]->reset();
 		// enable OPL3 stuff
 		write(i, REG_NEW, 1);
 	}
 		
 	// reset MIDI channel and OPL voice status
 	m_midiType = GeneralMIDI;
-	for (int i = 0; i < 16; i++)
+	for (int i = 0; i < m_channels.size(); i++)
 	{
 		m_channels[i] = MIDIChannel();
 		m_channels[i].num = i;
+		m_channels[i].percussion = ((i & 15) == 9);
 	}
-	m_channels[9].percussion = true;
 	
 	for (int i = 0; i < m_voices.size(); i++)
 	{
@@ -587,6 +1431,8 @@ void OPLPlayer::reset()
 		}
 	}
 	
+	m_drumHits.clear();
+	
 	if (m_sequence)
 		m_sequence->reset();
 	m_samplesLeft = 0;
@@ -598,18 +1444,36 @@ void OPLPlayer::resetMIDI()
 {
 	// reset MIDI channel and OPL voice status
 	m_midiType = GeneralMIDI;
-	for (int i = 0; i < 16; i++)
+	for (unsigned port = 0; port < m_numPorts; port++)
+		resetPort(port);
+
+	m_samplesLeft = 0;
+	m_timePassed = 0;
+}
+void OPLPlayer::resetMIDI(MIDIType midiType)
+{
+	resetMIDI();
+	m_midiType = midiType;
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::resetPort(unsigned port)
+{
+	for (unsigned i = port * 16; i < (port + 1) * 16; i++)
 	{
-		m_channels[i].percussion = false;
+		m_channels[i].percussion = ((i & 15) == 9);
 		m_channels[i].volume = 127;
 		m_channels[i].pan = 64;
 		m_channels[i].basePitch = 0.0; // pitch wheel position
-		m_channels[i].pitch = 1.0; // frequency multiplier
+		m_channels[i].bend = 0;
 		m_channels[i].bendRange = 2;
+		m_channels[i].pending = 0;
 	}
-	m_channels[9].percussion = true;
 	for (auto& voice : m_voices)
 	{
+		if (!voice.channel || (voice.channel->num >> 4) != port)
+			continue;
+		
 		if (voice.on)
 		{
 			silenceVoice(voice);
@@ -619,14 +1483,18 @@ void OPLPlayer::resetMIDI()
 			voice.delayOff = false;
 		}
 	}
-
-	m_samplesLeft = 0;
-	m_timePassed = 0;
-}
-void OPLPlayer::resetMIDI(MIDIType midiType)
-{
-	resetMIDI();
-	m_midiType = midiType;
+	for (unsigned i = 0; i < m_drumHits.size();)
+	{
+		if ((m_drumHits[i].channel >> 4) == port)
+		{
+			m_drumHits[i] = m_drumHits.back();
+			m_drumHits.pop_back();
+		}
+		else
+		{
+			i++;
+		}
+	}
 }
 
 // ----------------------------------------------------------------------------
@@ -646,6 +1514,7 @@ void OPLPlayer::panic()
 			voice.delayOff = false;
 		}
 	}
+	m_drumHits.clear();
 }
 
 // ----------------------------------------------------------------------------
@@ -653,6 +1522,27 @@ void OPLPlayer::runSamples(int chip, unsigned count)
 {
 	// add some delay between register writes where needed
 	// (i.e. when forcing a voice off, changing 4op flags, etc.)
+	flushControls();
+	if (m_controlThreadOn)
+	{
+		// the render thread does the waiting: hold back this chip's next writes instead
+		m_chipWriteTime[chip] = controlWriteTime(chip) + (uint64_t)ceil(count * m_sampleStep);
+		return;
+	}
+	prof::Scope profile(prof::StageChipRun);
+	if (m_stemMode)
+	{
+		uint32_t masks[numStems];
+		stemMasks(chip, masks);
+		while (count--)
+		{
+			StemSample output;
+			m_opl3[chip]->generate_channels(output.data(), 1, masks, numStems);
+			m_stemFIFO[chip].push(output);
+		}
+		return;
+	}
+	
 	while (count--)
 	{
 		ymfm::ymf262::output_data output;
@@ -664,8 +1554,42 @@ void OPLPlayer::runSamples(int chip, unsigned count)
 // ----------------------------------------------------------------------------
 void OPLPlayer::write(int chip, uint16_t addr, uint8_t data)
 {
+	prof::Scope profile(prof::StageRegWrite);
 //	if (addr != 0x104)
 //		printf("write reg %03x val %02x\n", addr, data);
+	if (!m_controlThreadOn)
+	{
+		applyWrite(chip, addr, data);
+		return;
+	}
+	
+	RegWriteQueue& queue = *m_writeQueues[chip];
+	const TimedWrite timed = { controlWriteTime(chip), addr, data };
+	while (!queue.push(timed))
+	{
+		if (m_controlRunning && std::this_thread::get_id() == m_controlThread.get_id())
+		{
+			// wait for the render thread to catch up
+			std::this_thread::yield();
+		}
+		else
+		{
+			// (the render thread itself, while the control thread is parked or stopped)
+			flushWrites(chip);
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::applyWrite(int chip, uint16_t addr, uint8_t data)
+{
+	if (addr == REG_CHIP_RESET)
+	{
+		m_opl3[chip]->reset();
+		return;
+	}
+	if (m_tap)
+		m_tap->regWrite(chip, addr, data);
 	if (addr < 0x100)
 		m_opl3[chip]->write_address((uint8_t)addr);
 	else
@@ -677,21 +1601,43 @@ void OPLPlayer::write(int chip, uint16_t addr, uint8_t data)
 OPLVoice* OPLPlayer::findVoice(uint8_t channel, const OPLPatch *patch, uint8_t note)
 {
 	OPLVoice *found = nullptr;
-	uint32_t duration = 0;
+	uint32_t rank = 0;
+
+	// a 4op note takes over both halves of a pair, so rank it by the louder one
+	auto pairRank = [&](const OPLVoice& voice)
+	{
+		uint32_t vrank = stealRank(voice);
+		if (!useFourOp(voice.patch) && useFourOp(patch) && voice.fourOpOther)
+			vrank = std::min(vrank, stealRank(*voice.fourOpOther));
+		return vrank;
+	};
 	
-	// try to find the "oldest" voice, prioritizing released notes
+	// try to find the quietest voice, prioritizing released notes
 	// (or voices that haven't ever been used yet)
+	// only voices in this channel's partition are considered
 	for (auto& voice : m_voices)
 	{
 		if (useFourOp(patch) && !voice.fourOpPrimary)
 			continue;
+		if (!voiceInPartition(voice, channel))
+			continue;
 	
 		if (!voice.channel)
 			return &voice;
+
+		// a voice that has faded out completely can be taken right away, whether it's
+		// released, held for a delayed key off (drums) or even still on
+		if (voiceSilent(voice) && (!useFourOp(patch) || voiceSilent(*voice.fourOpOther)))
+		{
+			reclaimVoice(voice);
+			if ((useFourOp(voice.patch) || useFourOp(patch)) && voice.fourOpOther)
+				reclaimVoice(*voice.fourOpOther);
+			return &voice;
+		}
 	
 		if (!voice.on && !voice.justChanged)
 		{
-			// ł͒xOFFvoice͑ΏۊOƂ
+			// ここでは遅延OFFのvoiceは対象外とする
 			if (voice.delayOff || (useFourOp(patch) && voice.fourOpOther->delayOff))
 				continue;
 
@@ -705,34 +1651,35 @@ OPLVoice* OPLPlayer::findVoice(uint8_t channel, const OPLPatch *patch, uint8_t n
 				if (useFourOp(voice.patch) && voice.fourOpOther)
 					silenceVoice(*voice.fourOpOther);
 			}
-			else if (voice.duration > duration)
+			else
 			{
-				found = &voice;
-				duration = voice.duration;
+				const uint32_t vrank = pairRank(voice);
+				if (vrank > rank)
+				{
+					found = &voice;
+					rank = vrank;
+				}
 			}
 		}
 	}
 	
 	if (found) return found;
 
-	// xOFFvoicêÂ̂ėp
+	// 遅延OFFのvoiceのうち静かなものを再利用
 	for (auto& voice : m_voices)
 	{
 		if (useFourOp(patch) && !voice.fourOpPrimary)
 			continue;
+		if (!voiceInPartition(voice, channel))
+			continue;
 
 		if (voice.delayOff)
 		{
-			uint32_t vduration = voice.duration;
-			if (!useFourOp(voice.patch) && useFourOp(patch) && voice.fourOpOther) {
-				if (voice.fourOpOther->duration < vduration) {
-					vduration = voice.fourOpOther->duration;
-				}
-			}
-			if (vduration > duration)
+			const uint32_t vrank = pairRank(voice);
+			if (vrank > rank)
 			{
 				found = &voice;
-				duration = vduration;
+				rank = vrank;
 			}
 		}
 	}
@@ -747,34 +1694,23 @@ OPLVoice* OPLPlayer::findVoice(uint8_t channel, const OPLPatch *patch, uint8_t n
 		return found;
 	}
 
-	// if we didn't find one yet, just try to find an old one
-	// using the same patch, even if it should still be playing.
+	// last resort - steal the quietest voice that's still playing
+	// (a note that has decayed a lot is missed less than a fresh one, whatever its patch)
 	for (auto& voice : m_voices)
 	{
 		if (useFourOp(patch) && !voice.fourOpPrimary)
 			continue;
-		if (voice.patch == patch && voice.duration > duration)
-		{
-			found = &voice;
-			duration = voice.duration;
-		}
-	}
-	
-	if (found) return found;
-	// last resort - just find any old voice at all
-	
-	for (auto& voice : m_voices)
-	{
-		if (useFourOp(patch) && !voice.fourOpPrimary)
+		if (!voiceInPartition(voice, channel))
 			continue;
 		// don't let a 2op instrument steal an active voice from a 4op one
 		if (!useFourOp(patch) && voice.on && useFourOp(voice.patch))
 			continue;
 		
-		if (voice.duration > duration)
+		const uint32_t vrank = pairRank(voice);
+		if (vrank > rank)
 		{
 			found = &voice;
-			duration = voice.duration;
+			rank = vrank;
 		}
 	}
 	
@@ -784,7 +1720,6 @@ OPLVoice* OPLPlayer::findVoice(uint8_t channel, const OPLPatch *patch, uint8_t n
 // ----------------------------------------------------------------------------
 OPLVoice* OPLPlayer::findVoice(uint8_t channel, uint8_t note, bool justChanged)
 {
-	channel &= 15;
 	for (auto& voice : m_voices)
 	{
 		if (voice.on 
@@ -803,7 +1738,7 @@ OPLVoice* OPLPlayer::findVoice(uint8_t channel, uint8_t note, bool justChanged)
 const OPLPatch* OPLPlayer::findPatch(uint8_t channel, uint8_t note) const
 {
 	uint16_t key;
-	const MIDIChannel &ch = m_channels[channel & 15];
+	const MIDIChannel &ch = m_channels[channel];
 
 	if (ch.percussion)
 		key = 0x80 | note | (ch.patchNum << 8);
@@ -831,6 +1766,26 @@ bool OPLPlayer::useFourOp(const OPLPatch *patch) const
 	return false;
 }
 
+// ----------------------------------------------------------------------------
+bool OPLPlayer::reduceVoices(uint8_t channel)
+{
+	// (only the partition's voices are available to the note, see findVoice)
+	unsigned freeVoices = 0;
+	for (auto& voice : m_voices)
+	{
+		if (!voice.on && !voice.delayOff && voiceInPartition(voice, channel))
+			freeVoices++;
+	}
+	
+	// (switch back only well above the threshold, so it doesn't flip on every note)
+	bool& reducing = m_reducing[(channel >> 4) % m_numPartitions];
+	if (freeVoices < m_reduceBelow)
+		reducing = true;
+	else if (freeVoices >= m_reduceBelow * 2)
+		reducing = false;
+	return reducing;
+}
+
 // ----------------------------------------------------------------------------
 std::pair<bool, bool> OPLPlayer::activeCarriers(const OPLVoice& voice) const
 {
@@ -872,15 +1827,142 @@ std::pair<bool, bool> OPLPlayer::activeCarriers(const OPLVoice& voice) const
 }
 
 // ----------------------------------------------------------------------------
-void OPLPlayer::updateChannelVoices(int8_t channel, void(OPLPlayer::*func)(OPLVoice&))
+bool OPLPlayer::voiceSilent(const OPLVoice& voice) const
+{
+	// past -84 dB an operator's output rounds to nothing,
+	// and after the attack phase an envelope only gets quieter
+	static const uint16_t silentLevel = 0x380;
+
+	auto carriersSilent = [this](const OPLVoice& voice)
+	{
+		// (a key on that the chip hasn't seen yet still looks silent)
+		if (!voice.patchVoice || voiceStarting(voice))
+			return false;
+
+		auto silent = [&](unsigned op)
+		{
+			ymfm::envelope_state state;
+			return operatorEnvelope(voice, op, state) >= silentLevel && state != ymfm::EG_ATTACK;
+		};
+		const auto carriers = activeCarriers(voice);
+		return (!carriers.first || silent(0)) && (!carriers.second || silent(1));
+	};
+
+	if (!carriersSilent(voice))
+		return false;
+	if (voice.patch && useFourOp(voice.patch) && voice.fourOpOther)
+		return carriersSilent(*voice.fourOpOther);
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+uint16_t OPLPlayer::operatorEnvelope(const OPLVoice& voice, unsigned op, ymfm::envelope_state& state) const
+{
+	if (m_controlThreadOn)
+	{
+		const uint16_t envelope = m_envelopes[(&voice - m_voices.data()) * 2 + op].load(std::memory_order_relaxed);
+		state = (ymfm::envelope_state)(envelope >> 10);
+		return envelope & 0x3ff;
+	}
+	
+	const ymfm::ymf262& chip = *m_opl3[voice.chip];
+	state = chip.debug_eg_state(voice.op + op * 3);
+	return chip.debug_eg_attenuation(voice.op + op * 3);
+}
+
+// ----------------------------------------------------------------------------
+bool OPLPlayer::voiceStarting(const OPLVoice& voice) const
+{
+	// (the control thread runs ahead of the chips, and the envelopes it sees lag behind them)
+	return voice.justChanged
+		|| (m_controlThreadOn && voice.onTime >= m_envelopePos.load(std::memory_order_acquire));
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::reclaimVoice(OPLVoice& voice)
+{
+	if (voice.on || voice.delayOff)
+		write(voice.chip, REG_VOICE_FREQH + voice.num, voice.freq >> 8);
+	voice.on = false;
+	voice.delayOff = false;
+	voice.duration = UINT_MAX;
+}
+
+// ----------------------------------------------------------------------------
+uint16_t OPLPlayer::voiceAttenuation(const OPLVoice& voice) const
+{
+	auto carrierAttenuation = [this](const OPLVoice& voice)
+	{
+		const auto carriers = activeCarriers(voice);
+		ymfm::envelope_state state;
+		// (total level steps are 0.75 dB, 8 envelope steps)
+		uint32_t attenuation = 0x3ff;
+		if (carriers.first)
+			attenuation = std::min<uint32_t>(attenuation, operatorEnvelope(voice, 0, state) + (voice.level[0] << 3));
+		if (carriers.second)
+			attenuation = std::min<uint32_t>(attenuation, operatorEnvelope(voice, 1, state) + (voice.level[1] << 3));
+		return attenuation;
+	};
+
+	uint32_t attenuation = carrierAttenuation(voice);
+	if (voice.patch && useFourOp(voice.patch) && voice.fourOpOther)
+		attenuation = std::min(attenuation, carrierAttenuation(*voice.fourOpOther));
+	return (uint16_t)attenuation;
+}
+
+// ----------------------------------------------------------------------------
+uint32_t OPLPlayer::stealRank(const OPLVoice& voice) const
+{
+	// a note just started hasn't begun its attack on the chip yet, so it's never quiet
+	if (voice.justChanged)
+		return 0;
+	// and one already silenced for reuse is on its way out
+	if (voice.duration == UINT_MAX)
+		return UINT_MAX;
+	// (one the render thread hasn't got to yet counts as loud as can be)
+	const uint16_t attenuation = voiceStarting(voice) ? 0 : voiceAttenuation(voice);
+	return ((uint32_t)(attenuation >> 5) << 24) | std::min(voice.duration, 0xffffffu);
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::updateChannelVoices(int channel, void(OPLPlayer::*func)(OPLVoice&))
 {
 	for (auto& voice : m_voices)
 	{
-		if ((channel < 0) || (voice.channel == &m_channels[channel & 15]))
+		if ((channel < 0) || (voice.channel == &m_channels[channel]))
 			(this->*func)(voice);
 	}
 }
 
+// ----------------------------------------------------------------------------
+void OPLPlayer::flushControls(int channel)
+{
+	if (!m_controlsPending)
+		return;
+	
+	for (unsigned i = 0; i < m_channels.size(); i++)
+	{
+		MIDIChannel& ch = m_channels[i];
+		if ((channel >= 0 && i != (unsigned)channel) || !ch.pending)
+			continue;
+		
+		const uint8_t pending = ch.pending;
+		ch.pending = 0;
+		if (pending & PendingPitch)
+		{
+			ch.bend = (int32_t)floor(ch.basePitch * ch.bendRange * pitchStepsPerSemitone + 0.5);
+			updateChannelVoices(i, &OPLPlayer::updateFrequency);
+		}
+		if (pending & PendingVolume)
+			updateChannelVoices(i, &OPLPlayer::updateVolume);
+		if (pending & PendingPan)
+			updateChannelVoices(i, &OPLPlayer::updatePanning);
+	}
+	// (other channels may still have changes after flushing just one)
+	if (channel < 0)
+		m_controlsPending = false;
+}
+
 // ----------------------------------------------------------------------------
 void OPLPlayer::updatePatch(OPLVoice& voice, const OPLPatch *newPatch, uint8_t numVoice)
 {	
@@ -958,15 +2040,6 @@ void OPLPlayer::updatePatch(OPLVoice& voice, const OPLPatch *newPatch, uint8_t n
 // ----------------------------------------------------------------------------
 void OPLPlayer::updateVolume(OPLVoice& voice)
 {
-	// lookup table shamelessly stolen from Nuke.YKT
-	static const uint8_t opl_volume_map[32] =
-	{
-		80, 63, 40, 36, 32, 28, 23, 21,
-		19, 17, 15, 14, 13, 12, 11, 10,
-		 9,  8,  7,  6,  5,  5,  4,  4,
-		 3,  3,  2,  2,  1,  1,  0,  0
-	};
-
 	if (!voice.patch || !voice.channel) return;
 	
 	uint8_t atten = opl_volume_map[(voice.velocity * voice.channel->volume) >> 9];
@@ -981,12 +2054,14 @@ void OPLPlayer::updateVolume(OPLVoice& voice)
 	else
 		level = patchVoice->op_level[0];
 	write(voice.chip, REG_OP_LEVEL + voice.op,     level | patchVoice->op_ksr[0]);
+	voice.level[0] = level;
 	
 	if (scale.second)
 		level = std::min(0x3f, patchVoice->op_level[1] + atten);
 	else
 		level = patchVoice->op_level[1];
 	write(voice.chip, REG_OP_LEVEL + voice.op + 3, level | patchVoice->op_ksr[1]);
+	voice.level[1] = level;
 }
 
 // ----------------------------------------------------------------------------
@@ -1010,38 +2085,30 @@ void OPLPlayer::updatePanning(OPLVoice& voice)
 // ----------------------------------------------------------------------------
 void OPLPlayer::updateFrequency(OPLVoice& voice)
 {
-	static const uint16_t noteFreq[12] = {
-		// calculated from A440
-		345, 365, 387, 410, 435, 460, 488, 517, 547, 580, 615, 651
-	};
-
 	if (!voice.patch || !voice.channel) return;
 	if (useFourOp(voice.patch) && !voice.fourOpPrimary) return;
 	
-	int note = (!voice.channel->percussion ? voice.note : voice.patch->fixedNote)
-	         + voice.patchVoice->tune;
-
-	int octave = note / 12;
-	note %= 12;
+	const int note = (!voice.channel->percussion ? voice.note : voice.patch->fixedNote)
+	               + voice.patchVoice->tune;
 	
-	// calculate base frequency (and apply pitch bend / patch detune)
-	unsigned freq = (note >= 0) ? noteFreq[note] : (noteFreq[note + 12] >> 1);
-	if (octave < 0)
-		freq >>= -octave;
-	else if (octave > 0)
-		freq <<= octave;
+	// pitch from the bottom of the F-number table (with pitch bend / patch detune)
+	const int pitch = note * pitchStepsPerSemitone + voice.channel->bend + voice.patchVoice->finetune
+	                - fnumTablePitch;
 	
-	freq *= voice.channel->pitch * voice.patchVoice->finetune;
-
-	// convert the calculated frequency back to a block and F-number
-	octave = 0;
-	while (freq > 0x3ff)
+	// one octave per block, lower and higher pitches get what's closest
+	int block = (pitch >= 0) ? (pitch / pitchStepsPerOctave) : -((pitchStepsPerOctave - 1 - pitch) / pitchStepsPerOctave);
+	unsigned freq = fnumTable()[pitch - block * pitchStepsPerOctave];
+	if (block < 0)
+	{
+		freq >>= std::min(-block, 10);
+		block = 0;
+	}
+	else if (block > 7)
 	{
-		freq >>= 1;
-		octave++;
+		freq = 0x3ff;
+		block = 7;
 	}
-	octave = std::min(7, octave);
-	voice.freq = freq | (octave << 10);
+	voice.freq = freq | (block << 10);
 
 	write(voice.chip, REG_VOICE_FREQL + voice.num, voice.freq & 0xff);
 	write(voice.chip, REG_VOICE_FREQH + voice.num, (voice.freq >> 8) | (voice.on ? (1 << 5) : 0));
@@ -1064,7 +2131,18 @@ void OPLPlayer::silenceVoice(OPLVoice& voice)
 // ----------------------------------------------------------------------------
 void OPLPlayer::midiEvent(uint8_t status, uint8_t data0, uint8_t data1)
 {
-	uint8_t channel = status & 15;
+	midiPortEvent(0, status, data0, data1);
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::midiPortEvent(unsigned port, uint8_t status, uint8_t data0, uint8_t data1)
+{
+	if (port >= m_numPorts)
+		return;
+	
+	prof::Scope profile(prof::StageMIDIEvent);
+	
+	uint8_t channel = port * 16 + (status & 15);
 	int16_t pitch;
 
 	switch (status >> 4)
@@ -1115,8 +2193,23 @@ void OPLPlayer::midiNoteOn(uint8_t channel, uint8_t note, uint8_t velocity)
 	const OPLPatch *newPatch = findPatch(channel, note);
 	if (!newPatch) return;
 	
+	// the new note and the ones already playing get the channel's latest bend, volume and pan
+	flushControls(channel);
+	
+	if (m_drumCacheOn && m_channels[channel].percussion
+	    && drumNoteOn(channel, note, velocity, newPatch))
+		return;
+	
+	if (m_reduceBelow && (useFourOp(newPatch) || newPatch->dualTwoOp) && reduceVoices(channel))
+	{
+		auto reduced = m_reducedPatches.find(newPatch);
+		if (reduced != m_reducedPatches.end())
+			newPatch = &reduced->second;
+	}
+	
 	const int numVoices = ((useFourOp(newPatch) || newPatch->dualTwoOp) ? 2 : 1);
 
+	prof::Scope profile(prof::StageVoiceAlloc);
 	OPLVoice *voice = nullptr;
 	for (int i = 0; i < numVoices; i++)
 	{
@@ -1138,11 +2231,12 @@ void OPLPlayer::midiNoteOn(uint8_t channel, uint8_t note, uint8_t velocity)
 		updatePatch(*voice, newPatch, i);
 
 		// update the note parameters for this voice
-		voice->channel = &m_channels[channel & 15];
+		voice->channel = &m_channels[channel];
 		voice->on = voice->justChanged = true;
 		voice->note = note;
 		voice->velocity = ymfm::clamp((int)velocity + newPatch->velocity, 0, 127);
 		voice->duration = 0;
+		voice->onTime = controlWriteTime(voice->chip);
 		
 		updateVolume(*voice);
 		updatePanning(*voice);
@@ -1159,6 +2253,248 @@ void OPLPlayer::midiNoteOn(uint8_t channel, uint8_t note, uint8_t velocity)
 	}
 }
 
+// ----------------------------------------------------------------------------
+void OPLPlayer::setDrumCache(bool on, bool realtime)
+{
+	stopDrumThread();
+	
+	m_drumCacheOn = on;
+	m_drumRealtime = realtime;
+	m_drumHits.clear();
+	m_drumSamples.clear();
+	
+	delete m_drumRenderer;
+	m_drumRenderer = nullptr;
+	if (on)
+	{
+		m_drumRenderer = new OPLPlayer(1, m_chipType);
+		m_drumRenderer->m_patches = m_patches;
+		
+		// set up every percussion patch's slots now, so playing never allocates
+		for (const auto& patch : m_patches)
+		{
+			if (patch.first & 0x80)
+				m_drumSamples[&patch.second].reset(new DrumSample[32]);
+		}
+		m_drumHits.reserve(m_drumSamples.size());
+		
+		if (realtime)
+		{
+			m_drumRunning = true;
+			m_drumThread = std::thread(&OPLPlayer::drumLoop, this);
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::stopDrumThread()
+{
+	if (!m_drumThread.joinable())
+		return;
+	
+	{
+		std::lock_guard<std::mutex> lock(m_drumMutex);
+		m_drumRunning = false;
+	}
+	m_drumWake.notify_one();
+	m_drumThread.join();
+	
+	// (requests still queued point at the samples about to be freed)
+	DrumRequest request;
+	while (m_drumRequests.pop(request)) {}
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::drumLoop()
+{
+	prof::setThreadName("drum cache");
+	
+	std::unique_lock<std::mutex> lock(m_drumMutex);
+	while (m_drumRunning)
+	{
+		lock.unlock();
+		DrumRequest request;
+		while (m_drumRequests.pop(request))
+		{
+			DrumSample& sample = *request.sample;
+			m_drumRenderer->renderDrum(request.patchNum, request.note, request.atten, sample.pcm);
+			sample.state.store(DrumReady, std::memory_order_release);
+		}
+		lock.lock();
+		
+		// (a request pushed just before waiting is picked up on the next timeout)
+		if (m_drumRunning)
+			m_drumWake.wait_for(lock, std::chrono::milliseconds(10));
+	}
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::setVoiceReduction(unsigned freeVoices)
+{
+	m_reduceBelow = freeVoices;
+	std::fill(std::begin(m_reducing), std::end(m_reducing), false);
+}
+
+// ----------------------------------------------------------------------------
+bool OPLPlayer::drumNoteOn(uint8_t channel, uint8_t note, uint8_t velocity, const OPLPatch *patch)
+{
+	// sustaining drums depend on note off timing, so leave them to the OPL voices
+	const int numVoices = ((useFourOp(patch) || patch->dualTwoOp) ? 2 : 1);
+	for (int i = 0; i < numVoices; i++)
+	{
+		const PatchVoice& patchVoice = patch->voice[i];
+		if (((patchVoice.op_sr[1] >> 4) != 0xf) && (patchVoice.op_mode[1] & 0x20))
+			return false;
+	}
+	
+	auto samples = m_drumSamples.find(patch);
+	if (samples == m_drumSamples.end())
+		return false;
+	
+	const MIDIChannel& ch = m_channels[channel];
+	velocity = ymfm::clamp((int)velocity + patch->velocity, 0, 127);
+	const unsigned level = (velocity * ch.volume) >> 9;
+	DrumSample& sample = samples->second[level];
+	
+	// a new hit of the same patch cuts off the old one, same as reusing its voice would
+	DrumHit *hit = nullptr;
+	for (auto& playing : m_drumHits)
+	{
+		if (playing.patch == patch)
+		{
+			hit = &playing;
+			hit->pos = hit->pcm->size();
+			break;
+		}
+	}
+	
+	if (!m_drumRealtime && sample.state.load(std::memory_order_relaxed) != DrumReady)
+	{
+		m_drumRenderer->renderDrum(ch.patchNum, note, opl_volume_map[level], sample.pcm);
+		sample.state.store(DrumReady, std::memory_order_relaxed);
+	}
+	else if (sample.state.load(std::memory_order_acquire) != DrumReady)
+	{
+		// not rendered yet, play this one with the OPL voices in the meantime
+		if (sample.state.load(std::memory_order_relaxed) == DrumEmpty)
+		{
+			const DrumRequest request = { &sample, ch.patchNum, note, opl_volume_map[level] };
+			sample.state.store(DrumPending, std::memory_order_relaxed);
+			if (m_drumRequests.push(request))
+				m_drumWake.notify_one();
+			else
+				sample.state.store(DrumEmpty, std::memory_order_relaxed); // try again next time
+		}
+		return false;
+	}
+	
+	if (!hit)
+	{
+		m_drumHits.emplace_back();
+		hit = &m_drumHits.back();
+	}
+	*hit = DrumHit();
+	hit->pcm = &sample.pcm;
+	hit->patch = patch;
+	hit->channel = channel;
+	if (m_stereo)
+	{
+		if (ch.pan < 32)
+			hit->right = false;
+		else if (ch.pan >= 96)
+			hit->left = false;
+	}
+	
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::renderDrum(uint8_t patchNum, uint8_t note, uint8_t atten, std::vector<int16_t>& out)
+{
+	reset();
+	m_channels[9].patchNum = patchNum;
+	midiNoteOn(9, note, 127);
+	
+	// set the voice velocity to one that maps to the requested attenuation level
+	unsigned index = 0;
+	while (index < 31 && opl_volume_map[index] > atten)
+		index++;
+	for (auto& voice : m_voices)
+	{
+		if (voice.on)
+		{
+			voice.velocity = (index * 512 + 126) / m_channels[9].volume;
+			updateVolume(voice);
+		}
+	}
+	
+	// anything clocked between register writes was from before key on
+	for (auto& fifo : m_sampleFIFO)
+		fifo = std::queue<ymfm::ymf262::output_data>();
+	
+	// render until the sound has been silent for 0.1 sec (up to 5 sec)
+	const unsigned rate = nativeSampleRate();
+	unsigned silent = 0;
+	bool started = false;
+	out.clear();
+	while (out.size() < rate * 5 && silent < rate / 10)
+	{
+		ymfm::ymf262::output_data output;
+		m_opl3[0]->generate(&output);
+		
+		// center panned, so left == right
+		out.push_back(output.data[0]);
+		if (output.data[0] < -1 || output.data[0] > 1)
+		{
+			started = true;
+			silent = 0;
+		}
+		else if (started)
+		{
+			silent++;
+		}
+	}
+	
+	if (started)
+		out.resize(out.size() - silent);
+	else
+		out.clear();
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::mixDrums(int32_t *data, unsigned numSamples, int channel)
+{
+	for (unsigned i = 0; i < m_drumHits.size();)
+	{
+		DrumHit& hit = m_drumHits[i];
+		if (channel >= 0 && hit.channel % numStems != (unsigned)channel)
+		{
+			i++;
+			continue;
+		}
+		
+		const unsigned count = std::min(numSamples, (unsigned)hit.pcm->size() - hit.pos);
+		const int16_t *pcm = hit.pcm->data() + hit.pos;
+		const int32_t left = hit.left, right = hit.right;
+		for (unsigned j = 0; j < count; j++)
+		{
+			data[j*2]   += pcm[j] * left;
+			data[j*2+1] += pcm[j] * right;
+		}
+		
+		hit.pos += count;
+		if (hit.pos >= hit.pcm->size())
+		{
+			hit = m_drumHits.back();
+			m_drumHits.pop_back();
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
 // ----------------------------------------------------------------------------
 void OPLPlayer::midiNoteOff(uint8_t channel, uint8_t note)
 {
@@ -1172,18 +2508,18 @@ void OPLPlayer::midiNoteOff(uint8_t channel, uint8_t note)
 		voice->on = false;
 
 		if (!m_channels[channel].percussion) {
-			// hp[gł͂ȂꍇʂOFF
+			// ドラムパートではない場合普通にOFF
 			write(voice->chip, REG_VOICE_FREQH + voice->num, voice->freq >> 8);
 		}
 		else if (voice->sustainSound) {
-			// hp[głSustainɂȂĂꍇ͎RɌď
+			// ドラムパートでもSustainになっている場合は自然に減衰させて消す
 			voice->duration = UINT_MAX;
 			write(voice->chip, REG_OP_SR + voice->op, 0xf4);
 			write(voice->chip, REG_OP_SR + voice->op + 3, 0xf4);
 			write(voice->chip, REG_VOICE_FREQH + voice->num, voice->freq >> 8);
 		}
 		else {
-			// ɉ炷Ƃ܂Ő扄΂
+			// 次に音を鳴らすときまで先延ばし
 			voice->delayOff = true;
 		}
 	}
@@ -1193,24 +2529,23 @@ void OPLPlayer::midiNoteOff(uint8_t channel, uint8_t note)
 void OPLPlayer::midiPitchControl(uint8_t channel, double pitch)
 {
 //	printf("midiPitchControl: chn %u, val %.02f\n", channel, pitch);
-	MIDIChannel& ch = m_channels[channel & 15];
+	MIDIChannel& ch = m_channels[channel];
 	
 	ch.basePitch = pitch;
-	ch.pitch = midiCalcBend(pitch * ch.bendRange);
-	updateChannelVoices(channel, &OPLPlayer::updateFrequency);
+	ch.pending |= PendingPitch;
+	m_controlsPending = true;
 }
 
 // ----------------------------------------------------------------------------
 void OPLPlayer::midiProgramChange(uint8_t channel, uint8_t patchNum)
 {
-	m_channels[channel & 15].patchNum = patchNum & 0x7f;
+	m_channels[channel].patchNum = patchNum & 0x7f;
 	// patch change will take effect on the next note for this channel
 }
 
 // ----------------------------------------------------------------------------
 void OPLPlayer::midiControlChange(uint8_t channel, uint8_t control, uint8_t value)
 {
-	channel &= 15;
 	control &= 0x7f;
 	value   &= 0x7f;
 	
@@ -1226,7 +2561,7 @@ void OPLPlayer::midiControlChange(uint8_t channel, uint8_t control, uint8_t valu
 			ch.percussion = (value == 0x7f);
 		break;
 
-	case 1: // W[V(MSB/LSB)
+	case 1: // モジュレーション(MSB/LSB)
 		// not supported yet 
 		break;
 
@@ -1240,16 +2575,20 @@ void OPLPlayer::midiControlChange(uint8_t channel, uint8_t control, uint8_t valu
 	
 	case 7:
 		ch.volume = value;
-		updateChannelVoices(channel, &OPLPlayer::updateVolume);
+		ch.pending |= PendingVolume;
+		m_controlsPending = true;
 		break;
 	
 	case 10:
 		ch.pan = value;
 		if (m_stereo)
-			updateChannelVoices(channel, &OPLPlayer::updatePanning);
+		{
+			ch.pending |= PendingPan;
+			m_controlsPending = true;
+		}
 		break;
 
-	case 11: // GNXvbV(MSB/LSB)
+	case 11: // エクスプレッション(MSB/LSB)
 		// not supported yet 
 		break;
 
@@ -1258,15 +2597,15 @@ void OPLPlayer::midiControlChange(uint8_t channel, uint8_t control, uint8_t valu
 			ch.bank = value;
 		break;
 
-	case 64: // _p[y_iTXeCy_j
+	case 64: // ダンパーペダル（サステインペダル）
 		// not supported yet 
 		break;
 
-	case 91: // GtFNg1 fvX
-	case 92: // GtFNg2 fvX
-	case 93: // GtFNg3 fvX
-	case 94: // GtFNg4 fvX
-	case 95: // GtFNg5 fvX
+	case 91: // エフェクト1 デプス
+	case 92: // エフェクト2 デプス
+	case 93: // エフェクト3 デプス
+	case 94: // エフェクト4 デプス
+	case 95: // エフェクト5 デプス
 		// not supported yet 
 		break;
 
@@ -1285,31 +2624,31 @@ void OPLPlayer::midiControlChange(uint8_t channel, uint8_t control, uint8_t valu
 		ch.rpn |= (value << 7);
 		break;
 
-	case 121: // ZbgI[Rg[[
+	case 121: // リセットオールコントローラー
 		ch.volume = 127;
 		ch.pan = 64;
 		ch.basePitch = 0.0; // pitch wheel position
-		ch.pitch = 1.0; // frequency multiplier
+		ch.bend = 0;
 		ch.rpn = 0x3fff;
 		ch.bendRange = 2;
 		break;
 
-	case 120: // I[ETEhEIt
+	case 120: // オール・サウンド・オフ
 	{
 		for (auto& voice : m_voices)
 		{
-			if (voice.on && voice.channel == &m_channels[channel & 15])
+			if (voice.on && voice.channel == &m_channels[channel])
 			{
 				silenceVoice(voice);
 			}
 		}
 		break;
 	}
-	case 123: // I[Em[gEIt
+	case 123: // オール・ノート・オフ
 	{
 		for (auto& voice : m_voices)
 		{
-			if (voice.on && voice.channel == &m_channels[channel & 15])
+			if (voice.on && voice.channel == &m_channels[channel])
 			{
 				silenceVoice(voice);
 				voice.justChanged = voice.on;
@@ -1330,6 +2669,17 @@ void OPLPlayer::midiControlChange(uint8_t channel, uint8_t control, uint8_t valu
 // ----------------------------------------------------------------------------
 void OPLPlayer::midiSysEx(const uint8_t *data, uint32_t length)
 {
+	midiPortSysEx(0, data, length);
+}
+
+// ----------------------------------------------------------------------------
+void OPLPlayer::midiPortSysEx(unsigned port, const uint8_t *data, uint32_t length)
+{
+	if (port >= m_numPorts)
+		return;
+	
+	prof::Scope profile(prof::StageMIDIEvent);
+	
 	if (length > 0 && data[0] == 0xF0)
 	{
 		data++;
@@ -1344,7 +2694,7 @@ void OPLPlayer::midiSysEx(const uint8_t *data, uint32_t length)
 		if (length == 5 && /*data[1] == 0x7f &&*/ data[2] == 0x09)
 		{
 			if (data[3] == 0x01) {
-				resetMIDI(); // Zbg
+				resetPort(port); // リセット
 				m_midiType = GeneralMIDI;
 			}
 			else if (data[3] == 0x03)
@@ -1368,6 +2718,7 @@ void OPLPlayer::midiSysEx(const uint8_t *data, uint32_t length)
 			channel = 9;
 		else if (channel <= 9)
 			channel--;
+		channel += port * 16;
 			
 		// Roland GS part parameters
 		if ((address & 0xfff0ff) == 0x401015) // set drum map
@@ -1375,23 +2726,17 @@ void OPLPlayer::midiSysEx(const uint8_t *data, uint32_t length)
 
 		if (address == 0x40007f) {
 			// GS Reset
-			resetMIDI(); // Zbg
+			resetPort(port); // リセット
 		}
 	}
 	else if (length >= 8 && !memcmp(data, "\x43\x10\x4c\x00\x00\x7e\x00\xf7", 8)) // Yamaha
 	{
 		// XG Reset
-		resetMIDI(); // Zbg
+		resetPort(port); // リセット
 		m_midiType = YamahaXG;
 	}
 }
 
-// ----------------------------------------------------------------------------
-double OPLPlayer::midiCalcBend(double semitones)
-{
-	return pow(2, semitones / 12.0);
-}
-
 // ----------------------------------------------------------------------------
 std::string OPLPlayer::getSequencerFriendlyName()
 {
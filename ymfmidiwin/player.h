@@ -2,17 +2,28 @@
 #define __PLAYER_H
 
 #include <ymfm_opl.h>
+#include <array>
+#include <atomic>
 #include <climits>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <queue>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "commandqueue.h"
+#include "dsp.h"
 #include "patches.h"
+#include "regqueue.h"
 
 class Sequence;
 
 struct MIDIChannel
 {
-	uint8_t num = 0;
+	uint8_t num = 0; // input port * 16 + MIDI channel
 
 	bool percussion = false;
 	uint8_t bank = 0;
@@ -20,11 +31,15 @@ struct MIDIChannel
 	uint8_t volume = 127;
 	uint8_t pan = 64;
 	double basePitch = 0.0; // pitch wheel position
-	double pitch = 1.0; // frequency multiplier
+	int32_t bend = 0; // pitch bend in 1/256 semitones
 	
 	uint16_t rpn = 0x3fff;
 
 	uint8_t bendRange = 2;
+	
+	// bend, volume and pan changes not sent to the voices yet
+	// (OPLPlayer::Pending* flags, see flushControls)
+	uint8_t pending = 0;
 };
 
 struct OPLVoice
@@ -46,12 +61,27 @@ struct OPLVoice
 	
 	// block and F number, calculated from note and channel pitch
 	uint16_t freq = 0;
+	// total level of each operator as last written (including velocity and channel volume)
+	uint8_t level[2] = { 0x3f, 0x3f };
 	
 	// how long has this note been playing (incremented each midi update)
 	uint32_t duration = UINT_MAX;
+	// output sample the last note on was sent to the chip at (control thread only)
+	uint64_t onTime = 0;
+
+	bool delayOff = false; // キーオフを遅延させる　ドラムパート用
+	bool sustainSound = false; // Sustainな音　EGTかつSL>0の場合ドラムパートの場合でもKeyOffを有効化
+};
 
-	bool delayOff = false; // L[Itx@hp[gp
-	bool sustainSound = false; // Sustainȉ@EGTSL>0̏ꍇhp[g̏ꍇłKeyOffL
+// sees what a player sends to its chips and gets back from them (for regression tests)
+class OPLTap
+{
+public:
+	virtual ~OPLTap() {}
+	// every register write (9-bit OPL3 register address)
+	virtual void regWrite(int chip, uint16_t addr, uint8_t data) = 0;
+	// mixed chip output (stereo) before gain and filters, at the native sample rate only
+	virtual void chipOutput(const int32_t *data, unsigned numSamples) = 0;
 };
 
 class OPLPlayer : public ymfm::ymfm_interface
@@ -76,16 +106,28 @@ public:
 	virtual ~OPLPlayer();
 	
 	void setLoop(bool loop) { m_looping = loop; }
+	// set the output sample rate. if this is nativeSampleRate(), generate(float*) renders
+	// chip samples in blocks and bypasses the internal downsampler entirely
+	// (for use in front of an external resampler)
 	void setSampleRate(uint32_t rate);
 	void setGain(double gain);
 	void setHPFilter(double cutoff);
 	void setLPFilter(double cutoff);
 	void setAutoSuspend(int suspendTimeMilliseconds);
+	void setInputLatency(int latencyMilliseconds);
 	
 	// enable/disable OPL3 stereo support. can be called during active playback
 	// (note: the output of OPLPlayer::generate is a stereo stream regardless of this setting)
 	void setStereo(bool on = true);
 	
+	// set the number of MIDI input ports. each port gets its own 16 MIDI channels and its own
+	// partition of the chips (and their voices), ports beyond the number of chips share them.
+	// called automatically when loading a sequence; resets playback
+	static const unsigned maxPorts = 16;
+	void setNumPorts(unsigned ports);
+	unsigned numPorts() const { return m_numPorts; }
+	unsigned numPartitions() const { return m_numPartitions; }
+	
 	// load MIDI data from the specified path
 	bool loadSequence(const char* path);
 	// load MIDI data from an already opened file, optionally at a given offset
@@ -108,6 +150,55 @@ public:
 	void generate(float *data, unsigned numSamples);
 	void generate(int16_t *data, unsigned numSamples);
 	
+	// one stereo output bus per MIDI channel
+	static const unsigned numStems = 16;
+	// enable/disable per-MIDI-channel rendering. must be set before playback starts
+	void setStemMode(bool on);
+	bool stemMode() const { return m_stemMode; }
+	// render each MIDI channel's voices to its own stereo bus in a single pass
+	// (numStems * 2 floats per sample, ordered bus 0 L/R, bus 1 L/R, ...)
+	// only available at the native sample rate and with stem mode enabled
+	void generateStems(float *data, unsigned numSamples);
+	
+	// play non-sustaining percussion notes from pre-rendered one-shot samples
+	// instead of OPL voices (each drum patch / volume level is rendered in the background
+	// on first use, the OPL voices play it until then). when rendering offline, turn off
+	// 'realtime' to render it on the spot instead, so the output doesn't depend on timing
+	void setDrumCache(bool on, bool realtime = true);
+	bool drumCache() const { return m_drumCacheOn; }
+	
+	// play new notes on patches that take two voices (4op and double 2op) with one voice
+	// while fewer than 'freeVoices' voices are free, until twice as many are free again
+	// (counted per chip partition, see setNumPorts. 0 = never, the default)
+	void setVoiceReduction(unsigned freeVoices);
+	unsigned voiceReduction() const { return m_reduceBelow; }
+	
+	// run the sequence, MIDI handling and voice allocation on a separate control thread,
+	// which sends register writes stamped with their output sample position to the render
+	// thread (generate() only applies them on time and clocks the chips).
+	// for realtime output only: the control thread stays a few blocks ahead of rendering
+	// but is never waited for, so anything it does late is played late.
+	// not available with stem mode or the drum cache (returns false).
+	// set after loading and before playback starts, with setSampleRate already called
+	bool setControlThread(bool on);
+	bool controlThread() const { return m_controlThreadOn; }
+	
+	// changes to make during playback, from any thread (the calls above and below this
+	// are only safe while nothing is rendering). they are queued and applied at the start
+	// of the next generate() call, or by the control thread if there is one.
+	// never locks or allocates, returns false if the queue is full
+	enum Command
+	{
+		CommandPanic,     // panic()
+		CommandResetMIDI, // resetMIDI((MIDIType)value)
+		CommandReset,     // reset()
+		CommandSongNum,   // setSongNum(value)
+		CommandGain,      // setGain(value)
+		CommandHPFilter,  // setHPFilter(value)
+		CommandLPFilter,  // setLPFilter(value)
+	};
+	bool postCommand(Command command, double value = 0);
+	
 	// reset OPL and midi file
 	void reset();
 	// reset MIDI only
@@ -117,6 +208,9 @@ public:
 	void panic();
 	// reached end of song?
 	bool atEnd() const;
+	// frames output by the last generate() / generateStems() call before the song reached
+	// its end (all of them if it didn't end there; native rate output only)
+	unsigned framesBeforeEnd() const { return m_framesBeforeEnd; }
 	// song selection (for files with multiple songs)
 	void     setSongNum(unsigned num);
 	unsigned numSongs() const;
@@ -124,7 +218,11 @@ public:
 	
 	// MIDI events, called by the file format handler
 	void midiEvent(uint8_t status, uint8_t data0, uint8_t data1 = 0);
+	// same for a specific input port (midiEvent / midiSysEx use port 0)
+	void midiPortEvent(unsigned port, uint8_t status, uint8_t data0, uint8_t data1 = 0);
+	void midiPortSysEx(unsigned port, const uint8_t *data, uint32_t length);
 	// helpers for midiEvent
+	// ('channel' is port * 16 + MIDI channel)
 	void midiNoteOn(uint8_t channel, uint8_t note, uint8_t velocity);
 	void midiNoteOff(uint8_t channel, uint8_t note);
 	void midiPitchControl(uint8_t channel, double pitch); // range is -1.0 to 1.0
@@ -133,21 +231,42 @@ public:
 	// sysex data (data and length *don't* include the opening 0xF0)
 	void midiSysEx(const uint8_t *data, uint32_t length);
 	
-	// helper for pitch bend and finetune
-	static double midiCalcBend(double semitones);
-	
 	// debug
+	// (the channel/voice displays are followed by the profiling counters while enabled, see profiler.h)
+	// the displays show the latest snapshot of the voices and channels, published by the thread
+	// running the sequence, so they can be called from any one other thread during playback
 	void displayClear();
 	void displayChannels();
 	void displayVoices();
 	
 	// misc. informational stuff
 	uint32_t sampleRate() const { return m_sampleRate; }
+	uint32_t nativeSampleRate() const;
 	ChipType chipType() const { return m_chipType; }
 	bool stereo() const { return m_stereo; }
 	const std::string& patchName(uint8_t num) { return m_patches[num].name; }
+	const OPLPatchSet& patches() const { return m_patches; }
+
+	bool isSleepMode() const { return m_sleepMode.load(); }
 
-	bool isSleepMode() const { return m_sleepMode; }
+	// (nullptr to remove)
+	void setTap(OPLTap *tap) { m_tap = tap; }
+
+	// realtime statistics, for sizing the number of chips, buffer size and resampler
+	struct RenderStats
+	{
+		double load;             // time spent in generate() / duration of the audio it rendered
+		double peakLoad;         // the same for the slowest single generate() call
+		uint32_t deadlineMisses; // output cycles that took longer than the device period
+		uint32_t underruns;      // times the output device ran dry
+		uint32_t midiHighWater;  // most MIDI IN messages waiting at once
+		uint32_t midiDropped;    // MIDI IN messages lost to a full FIFO (since loading the sequence)
+	};
+	// statistics since the last reset (any thread)
+	RenderStats renderStats(bool reset = false);
+	// called by the audio output once per device period / when the device ran out of audio
+	void reportOutputCycle(double busySeconds, double periodSeconds);
+	void reportUnderrun();
 
 	std::string getSequencerFriendlyName();
 
@@ -175,16 +294,102 @@ private:
 		REG_NEW         = 0x105,
 
 		REG_RYTHM       = 0xBD,
+		
+		// not a register: resets the chip when applied from a write queue
+		REG_CHIP_RESET  = 0x200,
+	};
+	
+	// MIDIChannel::pending
+	enum {
+		PendingPitch  = 0x01,
+		PendingVolume = 0x02,
+		PendingPan    = 0x04,
 	};
 
+	// max. number of chip samples rendered at once in native rate mode
+	static constexpr unsigned maxBlockSize = 512;
+	// min. block size worth rendering partitions on separate threads
+	static const unsigned minParallelBlockSize = 256;
+
+	// process pending MIDI events, returns true if the sequence just entered sleep mode
+	bool updateSequence();
 	void updateMIDI();
+	void generateNative(float *data, unsigned numSamples);
+	// generate() through the internal downsampler
+	void generateDownsampled(float *data, unsigned numSamples);
 
 	void runSamples(int chip, unsigned count);
+	
+	// add the profiling counters (if enabled) to the display text
+	void displayProfile(std::string& text);
+	
+	// what the displays show of a voice and a channel
+	struct DisplayVoice
+	{
+		const OPLPatch *patch = nullptr;
+		uint16_t channel = 0; // MIDIChannel::num + 1, 0 = never used
+		uint8_t note = 0;
+		bool on = false;
+		bool active = false; // on, or just turned off
+	};
+	struct DisplayChannel
+	{
+		const OPLPatch *patch = nullptr; // (for note 0)
+		bool percussion = false;
+		uint8_t volume = 0;
+		uint8_t pan = 0;
+	};
+	struct DisplaySnapshot
+	{
+		std::vector<DisplayVoice> voices;
+		DisplayChannel channels[16]; // (the first input port's)
+	};
+	// copy the voices and channels for the displays
+	// (after each rendered block, or each pass of the control thread)
+	void publishDisplay();
+	// the latest snapshot (display thread only)
+	const DisplaySnapshot& displaySnapshot();
+	
+	// control thread (see setControlThread)
+	void controlLoop();
+	// output sample position of the next register write to a chip
+	uint64_t controlWriteTime(int chip) const;
+	// render thread: apply the queued writes that are due, returns how many of the next
+	// 'count' samples can be rendered before another one is
+	unsigned applyWrites(unsigned count);
+	// apply everything queued for a chip right away, due or not
+	void flushWrites(int chip);
+	// the sequence went to sleep on the control thread: keep polling it from the render thread,
+	// true once it wakes up again
+	bool resumeFromSleep();
+	// copy the envelope state of all voices for the control thread
+	void publishEnvelopes();
+	// envelope attenuation of operator 0 or 1 of a voice, and its state
+	// (from the copy made by the render thread when there's a control thread)
+	uint16_t operatorEnvelope(const OPLVoice& voice, unsigned op, ymfm::envelope_state& state) const;
+	// has the chip not started the voice's last note yet?
+	bool voiceStarting(const OPLVoice& voice) const;
+	// reached end of song, as far as the sequence is concerned?
+	bool sequenceAtEnd() const;
+	
+	// apply queued commands, see postCommand
+	struct QueuedCommand
+	{
+		Command command;
+		double value;
+	};
+	typedef CommandQueue<QueuedCommand, 256> Commands;
+	void applyCommands(Commands& queue);
+	
+	// get the OPL channel mask for each MIDI channel's voices on a chip
+	void stemMasks(int chip, uint32_t *masks) const;
 
 	void write(int chip, uint16_t addr, uint8_t data);
+	// write a register right away (render thread when there's a control thread)
+	void applyWrite(int chip, uint16_t addr, uint8_t data);
 	
-	// find a voice with the oldest note, or the same patch & note
-	// if no "off" voices are found, steal one using the same patch or MIDI channel
+	// find an unused or silent voice, or the quietest (then oldest) released one
+	// if no "off" voices are found, steal the quietest (then oldest) one that's playing
 	OPLVoice* findVoice(uint8_t channel, const OPLPatch *patch, uint8_t note);
 	// find a voice that's playing a specific note on a specific channel
 	OPLVoice* findVoice(uint8_t channel, uint8_t note, bool justChanged = false);
@@ -194,13 +399,48 @@ private:
 
 	// determine whether this patch should be configured as 4op
 	bool useFourOp(const OPLPatch *patch) const;
+	// is a new note on a two voice patch to be played with its one voice reduction right now?
+	// (counts the free voices of the channel's partition and switches its reduction on and off)
+	bool reduceVoices(uint8_t channel);
+	// redo everything made from the patches after loading new ones
+	void patchesChanged();
 
 	// determine which operator(s) to scale based on the current operator settings
 	std::pair<bool, bool> activeCarriers(const OPLVoice& voice) const;
 
+	// has a voice (both halves of a 4op one) decayed to silence, even if it's still keyed on?
+	// it can't be heard again before its next key on, so it's as good as free
+	bool voiceSilent(const OPLVoice& voice) const;
+	// key off a silent voice and return it to the free ones
+	void reclaimVoice(OPLVoice& voice);
+	// current attenuation of a voice's loudest carrier: envelope plus total level
+	// (4.6 format like the envelope, 0x3ff = silent)
+	uint16_t voiceAttenuation(const OPLVoice& voice) const;
+	// order to steal voices in, higher first: quieter ones (in steps of 3 dB), then older ones
+	uint32_t stealRank(const OPLVoice& voice) const;
+
 	// update a property of all currently playing voices on a MIDI channel
 	// (or all channels if `channel` < 0)
-	void updateChannelVoices(int8_t channel, void(OPLPlayer::*func)(OPLVoice&));
+	void updateChannelVoices(int channel, void(OPLPlayer::*func)(OPLVoice&));
+	// send the pending bend, volume and pan changes of a MIDI channel (or all channels
+	// if `channel` < 0) to its voices, using only the last value of each
+	// (done before the chips render anything, and before a note on the channel starts)
+	void flushControls(int channel = -1);
+	
+	// is this voice in the chip partition assigned to a channel's input port?
+	bool voiceInPartition(const OPLVoice& voice, uint8_t channel) const
+	{
+		return m_chipPartition[voice.chip] == (channel >> 4) % m_numPartitions;
+	}
+	// reset the controllers of one input port's channels and silence their voices
+	void resetPort(unsigned port);
+	// render a block from the chips of one partition, adding it to 'mix'
+	void renderPartition(unsigned partition, int32_t *mix, unsigned count);
+	// (re)start one worker thread for each partition but the first, see generateNative
+	void startPartitionWorkers();
+	void stopPartitionWorkers();
+	struct PartitionWorker;
+	void partitionLoop(PartitionWorker *worker, unsigned partition);
 
 	// update the patch parameters for a voice
 	void updatePatch(OPLVoice& voice, const OPLPatch *newPatch, uint8_t numVoice = 0);
@@ -217,6 +457,18 @@ private:
 	// silence a voice immediately
 	void silenceVoice(OPLVoice& voice);
 
+	// percussion one-shot cache
+	// start a cached drum hit, returns false if this note should be played by OPL voices
+	bool drumNoteOn(uint8_t channel, uint8_t note, uint8_t velocity, const OPLPatch *patch);
+	// drum cache thread, renders the samples requested by drumNoteOn
+	void drumLoop();
+	void stopDrumThread();
+	// render a drum note using this (otherwise unused) player instance
+	void renderDrum(uint8_t patchNum, uint8_t note, uint8_t atten, std::vector<int16_t>& out);
+	// mix active drum hits into a block of stereo samples
+	// (only hits on one MIDI channel if 'channel' >= 0)
+	void mixDrums(int32_t *data, unsigned numSamples, int channel = -1);
+
 	std::vector<ymfm::ymf262*> m_opl3;
 	unsigned m_numChips;
 	ChipType m_chipType;
@@ -224,35 +476,147 @@ private:
 	
 	bool m_stereo;
 	uint32_t m_sampleRate; // output sample rate (default 44.1k)
+	bool m_nativeRate; // output sample rate == OPL sample rate
 	double m_sampleGain;
 	double m_sampleStep; // ratio of OPL sample rate to output sample rate (usually < 1.0)
 	double m_samplePos; // number of pending output samples (when >= 1.0, output one)
 	uint32_t m_samplesLeft; // remaining samples until next midi event
+	unsigned m_framesBeforeEnd; // see framesBeforeEnd()
 	ymfm::ymf262::output_data m_output; // output sample data
 	// if we need to clock one of the OPLs between register writes, save the resulting sample
 	std::vector<std::queue<ymfm::ymf262::output_data>> m_sampleFIFO;
+	// mixed sample block for native rate output
+	std::vector<int32_t> m_mixBuffer;
 	
 	// last output for downsampling
 	int32_t m_lastOut[2] = {0};
 	// recursive highpass filter to remove/reduce DC offset
-	double m_hpFilterFreq, m_hpFilterCoef;
-	int32_t m_hpLastIn[2] = {0}, m_hpLastOut[2] = {0};
-	float m_hpLastInF[2] = {0}, m_hpLastOutF[2] = {0};
+	double m_hpFilterFreq;
 	// IIR 1-pole lowpass filter
-	double m_lpFilterFreq, m_lpFilterCoef;
-	int32_t m_lpLastOut[2] = { 0 };
-	float m_lpLastOutF[2] = { 0 };
+	double m_lpFilterFreq;
+	dsp::FilterCoefs m_filterCoefs;
+	dsp::FilterState m_filterState;
+	// float output block for generate(int16_t*)
+	std::vector<float> m_floatBuffer;
+	
+	// per-MIDI-channel rendering
+	bool m_stemMode;
+	typedef std::array<ymfm::ymf262::output_data, numStems> StemSample;
+	std::vector<std::queue<StemSample>> m_stemFIFO;
+	std::vector<StemSample> m_stemChipBuffer;
+	std::vector<int32_t> m_stemMixBuffer; // numStems blocks of maxBlockSize stereo samples
+	dsp::FilterState m_stemFilterState[numStems];
+	
+	// percussion one-shot cache
+	struct DrumHit
+	{
+		const std::vector<int16_t> *pcm = nullptr;
+		const OPLPatch *patch = nullptr;
+		uint32_t pos = 0;
+		uint8_t channel = 0;
+		bool left = true, right = true;
+	};
+	enum { DrumEmpty, DrumPending, DrumReady };
+	struct DrumSample
+	{
+		std::atomic<uint8_t> state{ DrumEmpty };
+		std::vector<int16_t> pcm; // owned by the drum cache thread until ready
+	};
+	struct DrumRequest
+	{
+		DrumSample *sample;
+		uint8_t patchNum, note, atten;
+	};
+	bool m_drumCacheOn;
+	bool m_drumRealtime;
+	OPLPlayer *m_drumRenderer; // drum cache thread only (if realtime)
+	// rendered hits of each percussion patch, by volume level (see opl_volume_map)
+	std::unordered_map<const OPLPatch*, std::unique_ptr<DrumSample[]>> m_drumSamples;
+	std::vector<DrumHit> m_drumHits; // at most one per patch, so it never grows past m_drumSamples
+	CommandQueue<DrumRequest, 256> m_drumRequests;
+	std::thread m_drumThread;
+	bool m_drumRunning;
+	std::mutex m_drumMutex;
+	std::condition_variable m_drumWake;
+	
+	// one voice reductions of two voice patches, used under polyphony pressure
+	unsigned m_reduceBelow;
+	bool m_reducing[maxPorts]; // per partition
+	std::unordered_map<const OPLPatch*, OPLPatch> m_reducedPatches;
 	
 	bool m_looping;
 	bool m_timePassed;
-	bool m_sleepMode;
+	std::atomic<bool> m_sleepMode;
+	
+	// control thread
+	bool m_controlThreadOn;
+	std::thread m_controlThread;
+	std::atomic<bool> m_controlRunning{ false };
+	std::atomic<bool> m_controlParked{ false }; // waiting for the render thread to wake the sequence
+	std::mutex m_controlMutex;
+	std::condition_variable m_controlWake;
+	std::atomic<uint64_t> m_controlPos{ 0 };  // output sample the control thread has got to
+	std::atomic<uint64_t> m_renderPos{ 0 };   // output sample the render thread has got to
+	std::atomic<uint32_t> m_controlLookahead; // how far ahead of rendering the control thread runs
+	std::vector<uint64_t> m_chipWriteTime;   // writes delayed by runSamples, per chip
+	std::vector<std::unique_ptr<RegWriteQueue>> m_writeQueues; // per chip
+	// envelope of each voice's two operators as of m_envelopePos (state << 10 | attenuation)
+	std::unique_ptr<std::atomic<uint16_t>[]> m_envelopes;
+	std::atomic<uint64_t> m_envelopePos{ 0 };
+	
+	// queued commands: filters and gain for the render thread,
+	// the rest for whichever thread runs the sequence
+	Commands m_renderCommands;
+	Commands m_midiCommands;
 	
-	MIDIChannel m_channels[16];
+	// realtime statistics
+	std::atomic<uint64_t> m_renderNanoseconds{ 0 };
+	std::atomic<uint64_t> m_renderedSamples{ 0 };
+	std::atomic<double> m_peakLoad{ 0 };
+	std::atomic<uint32_t> m_deadlineMisses{ 0 };
+	std::atomic<uint32_t> m_underruns{ 0 };
+	
+	// input ports, each with its own channels and chip partition
+	unsigned m_numPorts;
+	unsigned m_numPartitions;
+	std::vector<uint8_t> m_chipPartition; // partition number of each chip
+	std::vector<std::vector<ymfm::ymf262::output_data>> m_partitionBuffer; // chip output, per partition
+	std::vector<std::vector<int32_t>> m_partitionMix;
+	
+	// render thread for a partition, woken once per block.
+	// the audio thread hands blocks over through 'state' only (it never locks), and renders
+	// a partition itself if the worker hasn't claimed the block by the time it gets to it
+	struct PartitionWorker
+	{
+		enum { Idle, Posted, Claimed, Done };
+		std::thread thread;
+		std::atomic<int> state{ Idle };
+		std::atomic<bool> running{ true };
+		unsigned count = 0; // samples to render into m_partitionMix (set before Posted)
+		std::mutex mutex; // (only for the worker's sleep)
+		std::condition_variable wake;
+		char name[16];
+	};
+	std::vector<std::unique_ptr<PartitionWorker>> m_partitionWorkers; // partitions 1 and up
+	
+	std::vector<MIDIChannel> m_channels; // 16 per port
+	bool m_controlsPending; // some channel may have pending changes
 	std::vector<OPLVoice> m_voices;
 	MIDIType m_midiType;
 	
 	Sequence *m_sequence;
 	OPLPatchSet m_patches;
+	
+	OPLTap *m_tap;
+	
+	// display snapshots, triple buffered: the publisher fills m_displayBack and swaps it with
+	// the middle one, the display swaps the middle one with m_displayFront when it's newer
+	static const uint8_t displayFresh = 4; // (flag in m_displayMiddle)
+	DisplaySnapshot m_displays[3];
+	uint8_t m_displayBack;
+	std::atomic<uint8_t> m_displayMiddle;
+	uint8_t m_displayFront;
+	std::string m_displayText;
 };
 
 #endif // __PLAYER_H
@@ -0,0 +1,316 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace prof
+{
+
+std::atomic<bool> g_enabled{ false };
+
+// durations of the last calls of each stage
+static const unsigned windowSize = 4096;
+
+struct StageData
+{
+	std::atomic<uint64_t> calls{ 0 };
+	std::atomic<uint64_t> total{ 0 };
+	std::atomic<uint32_t> next{ 0 };
+	std::atomic<uint32_t> window[windowSize];
+};
+
+static StageData g_stages[NumStages];
+
+// when profiling was turned on, for the call rates
+static std::atomic<int64_t> g_startTime{ 0 };
+
+std::atomic<bool> g_tracing{ false };
+
+// spans kept per thread (16 bytes each, allocated when tracing is turned on or the thread is named)
+static const unsigned traceSize = 1 << 18;
+// threads that can be traced (those named by setThreadName, and the one turning tracing on)
+static const unsigned maxTraceThreads = 32;
+
+struct Span
+{
+	uint64_t start;
+	uint32_t duration;
+	uint32_t stage;
+};
+
+// written only by the thread that claimed it, read by writeTrace()
+struct TraceBuffer
+{
+	char name[32];
+	std::atomic<bool> inUse{ false };
+	std::atomic<uint64_t> next{ 0 };
+	std::atomic<Span*> spans{ nullptr };
+};
+
+// (buffers stay allocated until exit. threads come and go with audio device restarts,
+// a new thread takes over the buffer of an ended one with the same name)
+static std::mutex g_traceMutex;
+static TraceBuffer g_traceBuffers[maxTraceThreads];
+static unsigned g_traceThreads = 0; // buffers claimed so far
+static thread_local TraceBuffer *t_traceBuffer = nullptr;
+
+// gives the buffer back when its thread ends
+struct TraceOwner
+{
+	~TraceOwner()
+	{
+		if (t_traceBuffer)
+			t_traceBuffer->inUse = false;
+	}
+};
+static thread_local TraceOwner t_traceOwner;
+
+// spans started before this aren't written
+static std::atomic<uint64_t> g_traceStart{ 0 };
+
+// ----------------------------------------------------------------------------
+static int64_t nanoseconds()
+{
+	using namespace std::chrono;
+	return duration_cast<std::chrono::nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// ----------------------------------------------------------------------------
+// ticks() and nanoseconds() at the first call, to convert between them
+static void calibrationBase(uint64_t& baseTicks, int64_t& baseTime)
+{
+	static const uint64_t startTicks = ticks();
+	static const int64_t startTime = nanoseconds();
+	baseTicks = startTicks;
+	baseTime = startTime;
+}
+
+// ----------------------------------------------------------------------------
+void setEnabled(bool on)
+{
+	if (on && !enabled())
+	{
+		for (auto& stage : g_stages)
+		{
+			stage.calls = 0;
+			stage.total = 0;
+			stage.next = 0;
+		}
+		g_startTime = nanoseconds();
+		ticksPerSecond();
+	}
+	g_enabled = on;
+}
+
+// ----------------------------------------------------------------------------
+// (with g_traceMutex held)
+static void allocateSpans(TraceBuffer& buffer)
+{
+	if (!buffer.spans.load(std::memory_order_relaxed))
+		buffer.spans.store(new Span[traceSize], std::memory_order_release);
+}
+
+// ----------------------------------------------------------------------------
+// (with g_traceMutex held)
+static void claimBuffer(const char *name)
+{
+	TraceBuffer *buffer = t_traceBuffer;
+	if (!buffer)
+	{
+		// a free buffer of an ended thread with this name, or an unused one
+		for (unsigned i = 0; i < g_traceThreads && !buffer; i++)
+		{
+			if (!g_traceBuffers[i].inUse && strcmp(g_traceBuffers[i].name, name) == 0)
+				buffer = &g_traceBuffers[i];
+		}
+		if (!buffer && g_traceThreads < maxTraceThreads)
+			buffer = &g_traceBuffers[g_traceThreads++];
+		if (!buffer)
+			return; // too many threads, this one isn't traced
+		
+		buffer->inUse = true;
+		t_traceBuffer = buffer;
+		(void)&t_traceOwner;
+	}
+	
+	snprintf(buffer->name, sizeof(buffer->name), "%s", name);
+	if (tracing())
+		allocateSpans(*buffer);
+}
+
+// ----------------------------------------------------------------------------
+void setTracing(bool on)
+{
+	std::lock_guard<std::mutex> lock(g_traceMutex);
+	if (on && !tracing())
+	{
+		g_traceStart = ticks();
+		ticksPerSecond();
+		
+		// spans of the threads named so far (and of this one), so recording never allocates
+		for (unsigned i = 0; i < g_traceThreads; i++)
+			allocateSpans(g_traceBuffers[i]);
+		if (!t_traceBuffer)
+			claimBuffer("main");
+		if (t_traceBuffer)
+			allocateSpans(*t_traceBuffer);
+	}
+	g_tracing = on;
+}
+
+// ----------------------------------------------------------------------------
+void setThreadName(const char *name)
+{
+	std::lock_guard<std::mutex> lock(g_traceMutex);
+	claimBuffer(name);
+}
+
+// ----------------------------------------------------------------------------
+void record(Stage stage, uint64_t ticks)
+{
+	StageData& data = g_stages[stage];
+	data.calls.fetch_add(1, std::memory_order_relaxed);
+	data.total.fetch_add(ticks, std::memory_order_relaxed);
+
+	const uint32_t slot = data.next.fetch_add(1, std::memory_order_relaxed) % windowSize;
+	data.window[slot].store((uint32_t)std::min<uint64_t>(ticks, UINT32_MAX), std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------------
+void traceSpan(Stage stage, uint64_t start, uint64_t end)
+{
+	// (threads without a buffer aren't traced, see setThreadName)
+	TraceBuffer *buffer = t_traceBuffer;
+	if (!buffer)
+		return;
+	Span *spans = buffer->spans.load(std::memory_order_acquire);
+	if (!spans)
+		return;
+
+	const uint64_t index = buffer->next.load(std::memory_order_relaxed);
+	Span& span = spans[index % traceSize];
+	span.start = start;
+	span.duration = (uint32_t)std::min<uint64_t>(end - start, UINT32_MAX);
+	span.stage = stage;
+	buffer->next.store(index + 1, std::memory_order_release);
+}
+
+// ----------------------------------------------------------------------------
+const char* stageName(Stage stage)
+{
+	static const char *names[NumStages] = {
+		"sequencer", "midi_event", "voice_alloc", "reg_write", "chip_generate", "chip_run",
+		"downsampler", "filter", "resampler", "sink_write"
+	};
+	return names[stage];
+}
+
+// ----------------------------------------------------------------------------
+double ticksPerSecond()
+{
+	uint64_t baseTicks;
+	int64_t baseTime;
+	calibrationBase(baseTicks, baseTime);
+#ifdef PROF_HAVE_TSC
+	const double elapsed = (nanoseconds() - baseTime) / 1e9;
+	if (elapsed < 0.01)
+		return 1e9; // not measurable yet
+	return (ticks() - baseTicks) / elapsed;
+#else
+	return 1e9;
+#endif
+}
+
+// ----------------------------------------------------------------------------
+Stats stats(Stage stage)
+{
+	const StageData& data = g_stages[stage];
+	Stats stats = {};
+
+	const double elapsed = (nanoseconds() - g_startTime) / 1e9;
+	const double usPerTick = 1e6 / ticksPerSecond();
+
+	stats.calls = data.calls.load(std::memory_order_relaxed);
+	if (elapsed > 0)
+	{
+		stats.callsPerSecond = stats.calls / elapsed;
+		stats.load = data.total.load(std::memory_order_relaxed) * usPerTick / 1e6 / elapsed;
+	}
+
+	// (another thread may be recording meanwhile, which only mixes in a few newer values)
+	const unsigned count = (unsigned)std::min<uint64_t>(stats.calls, windowSize);
+	if (!count)
+		return stats;
+
+	std::vector<uint32_t> window(count);
+	for (unsigned i = 0; i < count; i++)
+		window[i] = data.window[i].load(std::memory_order_relaxed);
+	std::sort(window.begin(), window.end());
+
+	auto percentile = [&](unsigned p)
+	{
+		return window[std::min(count - 1, count * p / 100)] * usPerTick;
+	};
+	stats.p50 = percentile(50);
+	stats.p90 = percentile(90);
+	stats.p99 = percentile(99);
+	stats.max = window.back() * usPerTick;
+	return stats;
+}
+
+// ----------------------------------------------------------------------------
+void dump(FILE *file)
+{
+	fprintf(file, "{\n  \"enabled\": %s,\n  \"ticks_per_second\": %.0f,\n  \"window\": %u,\n  \"stages\": {\n",
+		enabled() ? "true" : "false", ticksPerSecond(), windowSize);
+	for (int i = 0; i < NumStages; i++)
+	{
+		const Stats s = stats((Stage)i);
+		fprintf(file, "    \"%s\": { \"calls\": %llu, \"calls_per_second\": %.1f, \"load\": %.6f, "
+			"\"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f }%s\n",
+			stageName((Stage)i), (unsigned long long)s.calls, s.callsPerSecond, s.load,
+			s.p50, s.p90, s.p99, s.max, i + 1 < NumStages ? "," : "");
+	}
+	fprintf(file, "  }\n}\n");
+}
+
+// ----------------------------------------------------------------------------
+void writeTrace(FILE *file)
+{
+	const double usPerTick = 1e6 / ticksPerSecond();
+	const uint64_t traceStart = g_traceStart;
+
+	std::lock_guard<std::mutex> lock(g_traceMutex);
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"ymfmidiwin\"}}");
+
+	for (unsigned i = 0; i < g_traceThreads; i++)
+	{
+		const TraceBuffer& buffer = g_traceBuffers[i];
+		const Span *spans = buffer.spans.load(std::memory_order_acquire);
+		if (!spans)
+			continue;
+		const unsigned tid = i + 1;
+		fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+			tid, buffer.name);
+
+		// the oldest spans of a full buffer may be overwritten while this runs (skip some extra)
+		const uint64_t next = buffer.next.load(std::memory_order_acquire);
+		const uint64_t first = next > traceSize ? next - traceSize + traceSize / 64 : 0;
+		for (uint64_t n = first; n < next; n++)
+		{
+			const Span& span = spans[n % traceSize];
+			if (span.start < traceStart || span.stage >= NumStages)
+				continue;
+			fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				stageName((Stage)span.stage), tid,
+				(span.start - traceStart) * usPerTick, span.duration * usPerTick);
+		}
+	}
+	fprintf(file, "\n]}\n");
+}
+
+} // namespace prof
@@ -0,0 +1,115 @@
+#ifndef __PROFILER_H
+#define __PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define PROF_HAVE_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROF_HAVE_TSC
+#endif
+
+// hot path profiling counters, always compiled in and switched on/off at runtime.
+// each stage keeps its call count, total time and the durations of its last calls
+// (for rolling percentiles). recording is lock-free and may happen on any thread;
+// while profiling and tracing are off a scope costs two relaxed atomic loads.
+// stages nest (e.g. register writes happen inside MIDI event handling), so times are inclusive.
+//
+// tracing records every scope as a span into a buffer of the thread it ran on (the most
+// recent spans are kept), to be written as Chrome trace event JSON for chrome://tracing or
+// https://ui.perfetto.dev. it's independent of the counters, either can be on without the other
+namespace prof
+{
+
+enum Stage
+{
+	StageSequencer,  // Sequence::update()
+	StageMIDIEvent,  // MIDI event and SysEx handling
+	StageVoiceAlloc, // finding and setting up the voices of a note-on (patch changes included)
+	StageRegWrite,   // OPL register writes
+	StageChip,       // ymfm generate (per chip)
+	StageChipRun,    // advancing a chip between register writes (runSamples)
+	StageDownsample, // the internal downsampler (non-native output rates)
+	StageFilter,     // output filters
+	StageResample,   // libsamplerate
+	StageSink,       // writing to the audio device / WAV file
+	NumStages
+};
+
+struct Stats
+{
+	uint64_t calls;        // since profiling was turned on
+	double callsPerSecond;
+	double load;           // fraction of the elapsed time spent in this stage
+	// of the last calls, in microseconds
+	double p50, p90, p99, max;
+};
+
+// (turning profiling on resets all counters)
+void setEnabled(bool on);
+extern std::atomic<bool> g_enabled;
+inline bool enabled() { return g_enabled.load(std::memory_order_relaxed); }
+
+// (turning tracing on drops the spans recorded so far)
+void setTracing(bool on);
+extern std::atomic<bool> g_tracing;
+inline bool tracing() { return g_tracing.load(std::memory_order_relaxed); }
+// name of the calling thread in the trace. call it when the thread starts: only named threads
+// (and the one turning tracing on, as "main") are traced, recording spans never allocates
+void setThreadName(const char *name);
+
+// CPU cycles if available, nanoseconds otherwise
+inline uint64_t ticks()
+{
+#ifdef PROF_HAVE_TSC
+	return __rdtsc();
+#else
+	using namespace std::chrono;
+	return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void record(Stage stage, uint64_t ticks);
+void traceSpan(Stage stage, uint64_t start, uint64_t end);
+
+const char* stageName(Stage stage);
+Stats stats(Stage stage);
+// ticks() per second (measured while profiling is on)
+double ticksPerSecond();
+
+// all stages as JSON
+void dump(FILE *file);
+// the recorded spans of all threads as Chrome trace event JSON
+// (safe while tracing; spans being recorded meanwhile may be left out)
+void writeTrace(FILE *file);
+
+// times the enclosing block
+class Scope
+{
+public:
+	Scope(Stage stage) : m_stage(stage), m_start(enabled() || tracing() ? ticks() : 0) {}
+	~Scope()
+	{
+		if (m_start)
+		{
+			const uint64_t end = ticks();
+			if (enabled())
+				record(m_stage, end - m_start);
+			if (tracing())
+				traceSpan(m_stage, m_start, end);
+		}
+	}
+
+private:
+	Stage m_stage;
+	uint64_t m_start;
+};
+
+} // namespace prof
+
+#endif // __PROFILER_H
@@ -0,0 +1,55 @@
+#ifndef __REGQUEUE_H
+#define __REGQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// an OPL register write, to be applied at a given output sample
+struct TimedWrite
+{
+	uint64_t time;
+	uint16_t addr;
+	uint8_t data;
+};
+
+// single producer / single consumer ring of register writes for one chip, in time order
+// (the control thread pushes, the render thread applies them, see OPLPlayer::setControlThread)
+class RegWriteQueue
+{
+public:
+	static const size_t Capacity = 16384;
+
+	// false if the ring is full
+	bool push(const TimedWrite& write)
+	{
+		const size_t w = m_writeIndex.load(std::memory_order_relaxed);
+		if (w - m_readIndex.load(std::memory_order_acquire) >= Capacity)
+			return false;
+
+		m_buffer[w % Capacity] = write;
+		m_writeIndex.store(w + 1, std::memory_order_release);
+		return true;
+	}
+
+	// oldest write, or nullptr if there is none
+	const TimedWrite* front() const
+	{
+		const size_t r = m_readIndex.load(std::memory_order_relaxed);
+		if (r == m_writeIndex.load(std::memory_order_acquire))
+			return nullptr;
+		return &m_buffer[r % Capacity];
+	}
+
+	void pop()
+	{
+		m_readIndex.store(m_readIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+private:
+	TimedWrite m_buffer[Capacity];
+	std::atomic<size_t> m_writeIndex{ 0 };
+	std::atomic<size_t> m_readIndex{ 0 };
+};
+
+#endif // __REGQUEUE_H
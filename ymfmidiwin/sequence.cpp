@@ -1,3 +1,4 @@
+#include <cctype>
 #include <cstdio>
 
 #include "sequence.h"
@@ -7,6 +8,18 @@
 #include "sequence_mus.h"
 #include "sequence_xmi.h"
 #include "sequence_midiin.h"
+#include "sequence_load.h"
+
+// ----------------------------------------------------------------------------
+static bool hasPrefix(const char *path, const char *prefix)
+{
+	for (; *prefix; path++, prefix++)
+	{
+		if (toupper((unsigned char)*path) != *prefix)
+			return false;
+	}
+	return true;
+}
 
 // ----------------------------------------------------------------------------
 Sequence::~Sequence() {}
@@ -14,17 +27,23 @@ Sequence::~Sequence() {}
 // ----------------------------------------------------------------------------
 Sequence* Sequence::load(const char *path)
 {
-	if (_strnicmp(path, "//MIDIIN", 8) == 0) {
-		Sequence* seqmidiin = new SequenceMIDIIN(atol(path + 8));
+	if (hasPrefix(path, "//MIDIIN")) {
+		Sequence* seqmidiin = new SequenceMIDIIN(path + 8);
 		if (seqmidiin)
 		{
 			seqmidiin->reset();
 		}
 		return seqmidiin;
 	}
+	if (hasPrefix(path, "//LOADGEN")) {
+		LoadSettings settings;
+		if (!parseLoadPath(settings, path))
+			return nullptr;
+		return new SequenceLoad(settings);
+	}
 
-	FILE* file;
-	if (fopen_s(&file, path, "rb")) return nullptr;
+	FILE* file = fopen(path, "rb");
+	if (!file) return nullptr;
 	
 	Sequence *seq = load(file);
 	
@@ -11,6 +11,7 @@ public:
 		m_atEnd = false;
 		m_songNum = 0;
 		m_suspendTimeMilliseconds = 0;
+		m_inputLatencyMilliseconds = 0;
 	}
 	virtual ~Sequence();
 	
@@ -33,6 +34,8 @@ public:
 		reset();
 	}
 	virtual unsigned numSongs() const { return 1; }
+	// number of MIDI input ports (16 channels each)
+	virtual unsigned numPorts() const { return 1; }
 	unsigned songNum() const { return m_songNum; }
 	
 	// has this track reached the end?
@@ -40,16 +43,26 @@ public:
 	bool atEnd() const { return m_atEnd; }
 
 	virtual void setAutoSuspend(int suspendTimeMilliseconds) { m_suspendTimeMilliseconds = suspendTimeMilliseconds; }
+	// fixed delay between receiving a realtime MIDI event and playing it (MIDI IN only)
+	virtual void setInputLatency(int latencyMilliseconds) { m_inputLatencyMilliseconds = latencyMilliseconds; }
 
 	virtual std::string GetFriendlyName() { return "FILE"; };
 
 	virtual void* getWakeupEvent() { return nullptr; };
+
+	// the player's patches, when it loads the sequence and whenever they change
+	virtual void setPatches(const OPLPatchSet&) {}
+
+	// realtime input statistics: most messages waiting at once (since the last reset),
+	// messages lost to a full input FIFO (MIDI IN only)
+	virtual void inputStats(uint32_t& highWater, uint32_t& dropped, bool) { highWater = dropped = 0; }
 	
 protected:
 	bool m_atEnd;
 	unsigned m_songNum;
 
 	int m_suspendTimeMilliseconds;
+	int m_inputLatencyMilliseconds;
 	
 private:
 	virtual void read(const uint8_t *data, size_t size) = 0;
@@ -0,0 +1,56 @@
+#include <cmath>
+
+#include "sequence_load.h"
+
+// ----------------------------------------------------------------------------
+SequenceLoad::SequenceLoad(const LoadSettings& settings)
+	: Sequence()
+{
+	m_settings = settings;
+	m_pos = 0;
+	m_time = 0;
+}
+
+// ----------------------------------------------------------------------------
+void SequenceLoad::reset()
+{
+	Sequence::reset();
+	m_pos = 0;
+	m_time = 0;
+}
+
+// ----------------------------------------------------------------------------
+void SequenceLoad::setPatches(const OPLPatchSet& patches)
+{
+	m_events = songMessages(makeLoad(m_settings, &patches));
+	reset();
+}
+
+// ----------------------------------------------------------------------------
+uint32_t SequenceLoad::update(OPLPlayer& player)
+{
+	m_atEnd = false;
+
+	for (; m_pos < m_events.size() && m_events[m_pos].time <= m_time; m_pos++)
+	{
+		const SongEvent& event = m_events[m_pos];
+		if (event.status == 0xf0)
+			player.midiSysEx(event.sysex.data(), (uint32_t)event.sysex.size());
+		else
+			player.midiEvent(event.status, event.data0, event.data1);
+	}
+
+	if (m_pos >= m_events.size())
+	{
+		reset();
+		m_atEnd = true;
+		return 0;
+	}
+
+	// convert from the song position, so that rounding doesn't add up
+	const double samplesPerTick = (double)player.sampleRate() / songTicksPerSecond;
+	const uint32_t next = m_events[m_pos].time;
+	const uint32_t samples = (uint32_t)(round(next * samplesPerTick) - round(m_time * samplesPerTick));
+	m_time = next;
+	return samples;
+}
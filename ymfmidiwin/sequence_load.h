@@ -0,0 +1,30 @@
+#ifndef __SEQUENCE_LOAD_H
+#define __SEQUENCE_LOAD_H
+
+#include "sequence.h"
+
+#include "loadgen.h"
+
+// synthetic load (see loadgen.h) sent straight to the player, opened as "//LOADGEN:<settings>"
+class SequenceLoad : public Sequence
+{
+public:
+	SequenceLoad(const LoadSettings& settings);
+
+	void reset();
+	uint32_t update(OPLPlayer& player);
+	void setPatches(const OPLPatchSet& patches);
+
+	std::string GetFriendlyName() { return "LOADGEN"; }
+
+private:
+	void read(const uint8_t *, size_t) {}
+
+	LoadSettings m_settings;
+	// made from the player's patches (to pick programs from them), not while playing
+	std::vector<SongEvent> m_events;
+	size_t m_pos;
+	uint32_t m_time;
+};
+
+#endif // __SEQUENCE_LOAD_H
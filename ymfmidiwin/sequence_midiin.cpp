@@ -1,8 +1,15 @@
 #include "sequence_midiin.h"
 
+#include <algorithm>
+#include <climits>
 #include <cmath>
+#include <cstdio>
 #include <cstring>
 
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
 #define READ_U16BE(data, pos) ((data[pos] << 8) | data[pos+1])
 #define READ_U24BE(data, pos) ((data[pos] << 16) | (data[pos+1] << 8) | data[pos+2])
 #define READ_U32BE(data, pos) ((data[pos] << 24) | (data[pos+1] << 16) | (data[pos+2] << 8) | data[pos+3])
@@ -38,41 +45,56 @@ static void trace_fmt_exw(const WCHAR* fmt, ...)
 #define	TRACEOUTW(s)	(void)0
 #endif	/* 1 */
 
-static std::string GetMidiInDeviceName(UINT deviceId)
-{
-	MIDIINCAPSA caps = {};
-	if (midiInGetDevCapsA(deviceId, &caps, sizeof(caps)) != MMSYSERR_NOERROR) {
-		return "(Unknown MIDI IN)";
-	}
-
-	return caps.szPname;
-}
-
-
 // ----------------------------------------------------------------------------
 SequenceMIDIIN::SequenceMIDIIN() : 
-	m_portnum(0),
-	m_currentTime(0),
-	m_currentTimeReal(0),
+	m_samplePos(0),
+	m_lastEventSample(0),
+	m_samplesWait(0),
 	m_lastSleepMode(false),
 	Sequence()
 {
+	m_sysex.data.reserve(SysExRing::SlotSize);
+	setSpec("", 0);
 }
-SequenceMIDIIN::SequenceMIDIIN(int portnum) :
-	m_portnum(0),
-	m_currentTime(0),
-	m_currentTimeReal(0),
+SequenceMIDIIN::SequenceMIDIIN(const char *spec) :
+	m_samplePos(0),
+	m_lastEventSample(0),
+	m_samplesWait(0),
 	m_lastSleepMode(false),
 	Sequence()
 {
-	m_portnum = portnum;
+	m_sysex.data.reserve(SysExRing::SlotSize);
+	setSpec(spec, strlen(spec));
 }
 
 // ----------------------------------------------------------------------------
 SequenceMIDIIN::~SequenceMIDIIN()
 {
-	// I
-	m_midiIn.close();
+	// 終了時
+	for (auto& port : m_ports)
+		delete port.device;
+}
+
+// ----------------------------------------------------------------------------
+void SequenceMIDIIN::setSpec(const char *spec, size_t size)
+{
+	// "//MIDIIN1" or "//MIDIIN:alsa", "//MIDIIN:pipe:name", ...
+	// several ports are separated by ',' ("//MIDIIN1,2", "//MIDIIN:alsa:a,alsa:b")
+	m_spec.assign(spec, size);
+	m_spec.erase(m_spec.find_last_not_of(" \t\r\n") + 1);
+	if (!m_spec.empty() && m_spec[0] == ':')
+		m_spec.erase(0, 1);
+
+	m_portSpecs.clear();
+	size_t pos = 0;
+	while (m_portSpecs.size() < OPLPlayer::maxPorts)
+	{
+		const size_t end = m_spec.find(',', pos);
+		m_portSpecs.push_back(m_spec.substr(pos, end - pos));
+		if (end == std::string::npos)
+			break;
+		pos = end + 1;
+	}
 }
 
 // ----------------------------------------------------------------------------
@@ -90,7 +112,7 @@ void SequenceMIDIIN::read(const uint8_t* data, size_t size)
 {
 	if (size >= 9 && !memcmp(data, "//MIDIIN", 8))
 	{
-		m_portnum = atol((const char*)data + 8);
+		setSpec((const char*)data + 8, size - 8);
 	}
 }
 
@@ -100,13 +122,33 @@ void SequenceMIDIIN::reset()
 	Sequence::reset();
 	setDefaults();
 
-    if (!m_midiIn.open(m_portnum))
-    {
-        MessageBox(nullptr, L"MIDI IN open failed", L"Error", MB_OK);
-        return;
-    }
-	m_currentTime = 0;
-	m_currentTimeReal = GetTickCount64();
+	if (m_ports.empty())
+	{
+		m_ports.resize(m_portSpecs.size());
+		for (unsigned i = 0; i < m_ports.size(); i++)
+		{
+			m_ports[i].device = MidiInDevice::create(m_portSpecs[i].c_str());
+			// wake up the player on input from any port
+			if (i > 0 && m_ports[i].device && m_ports[0].device)
+				m_ports[i].device->shareWakeupEvent(*m_ports[0].device);
+		}
+	}
+
+	for (auto& port : m_ports)
+	{
+		port.anchored = false;
+		if (!port.device || !port.device->open())
+		{
+#ifdef _WIN32
+			MessageBox(nullptr, L"MIDI IN open failed", L"Error", MB_OK);
+#else
+			fprintf(stderr, "MIDI IN open failed (%s)\n", m_spec.c_str());
+#endif
+		}
+	}
+	m_samplePos = 0;
+	m_lastEventSample = 0;
+	m_samplesWait = 0;
 }
 
 // ----------------------------------------------------------------------------
@@ -127,85 +169,167 @@ unsigned SequenceMIDIIN::numSongs() const
 }
 
 // ----------------------------------------------------------------------------
-uint32_t SequenceMIDIIN::update(OPLPlayer& player)
+unsigned SequenceMIDIIN::numPorts() const
 {
-	MidiMessage m;
-	size_t count = m_midiIn.getMessageCount();
-	uint32_t nextTimestamp = m_midiIn.getNextTimestamp();
-
-	if (count == 0) { // ۂȂҋ@[h 
-		ULONGLONG curTimeReal = GetTickCount64();
-		if (m_suspendTimeMilliseconds > 0 && curTimeReal - m_currentTimeReal > m_suspendTimeMilliseconds) {
-			// X[v[h
-			m_lastSleepMode = true;
-			return UINT_MAX;
-		}
-		else if (curTimeReal - m_currentTimeReal > 1000) {
-			// 1bȂ10msec炢Ăł傤
-			return player.sampleRate() / 100;
-		}
-		else {
-			// 邩mȂ̂ōŒZҋ@
-			return 1;
-		}
+	return (unsigned)m_portSpecs.size();
+}
+
+// ----------------------------------------------------------------------------
+uint64_t SequenceMIDIIN::scheduleTime(InputPort& port, uint32_t timestamp, uint32_t rate)
+{
+	const uint64_t latency = (uint64_t)rate * m_inputLatencyMilliseconds / 1000;
+	const int64_t units = port.device->timestampRate();
+
+	if (!port.anchored)
+	{
+		// first event after being idle: play it 'latency' from now, and the following
+		// events at the same distance from it as they were received
+		port.anchored = true;
+		port.anchorTime = timestamp;
+		port.anchorSample = m_samplePos + latency;
 	}
-	else {
-		MidiMessage m;
-		m_midiIn.fetchOneMessage(m);
-		BYTE status;
-		BYTE data[2];
-		status = m.data & 0xFF;
-		data[0] = (m.data >> 8) & 0xFF;
-		data[1] = (m.data >> 16) & 0xFF;
-		switch (status >> 4)
-		{
-		case 9: // note on
-			player.midiEvent(status, data[0], data[1]);
-			break;
 
-		case 8:  // note off
-		case 10: // polyphonic pressure
-		case 11: // controller change
-		case 14: // pitch bend
-			player.midiEvent(status, data[0], data[1]);
-			break;
+	const int64_t delta = (int32_t)(timestamp - port.anchorTime);
+	int64_t due = (int64_t)port.anchorSample + delta * rate / units;
 
-		case 12: // program change
-		case 13: // channel pressure (ignored)
-			player.midiEvent(status, data[0]);
-			break;
+	if (due < (int64_t)m_samplePos)
+	{
+		// arrived too late for its slot (jitter larger than the latency):
+		// play it now and delay the whole schedule by the same amount to keep the spacing
+		port.anchorSample += m_samplePos - due;
+		due = m_samplePos;
+	}
+	else if ((uint64_t)due > m_samplePos + latency * 2 + rate / 10)
+	{
+		// the MIDI clock ran ahead of the audio clock, start over
+		port.anchorTime = timestamp;
+		port.anchorSample = m_samplePos + latency;
+		due = port.anchorSample;
+	}
+	else if (delta > units * 60)
+	{
+		// move the anchor along now and then, the timestamps wrap around
+		port.anchorTime = timestamp;
+		port.anchorSample = due;
+	}
+
+	return due;
+}
+
+// ----------------------------------------------------------------------------
+uint32_t SequenceMIDIIN::update(OPLPlayer& player)
+{
+	if (m_ports.empty())
+		return UINT_MAX;
+
+	const uint32_t rate = player.sampleRate();
 
-		case 15: // sysex / meta event
+	// the player has rendered everything we asked it to wait for last time
+	m_samplePos += m_samplesWait;
+	m_samplesWait = 0;
+
+	// play every event that is due by now, then wait exactly until the next one
+	for (;;)
+	{
+		// (the earliest event of all ports first)
+		int next = -1;
+		uint64_t due = 0;
+		for (unsigned i = 0; i < m_ports.size(); i++)
 		{
-			MidiSysEx sysex;
-			if (m_midiIn.fetchSysEx(sysex)) {
-				if (!metaEvent(player, sysex)) {
-					// end 
-				}
+			MidiInDevice *device = m_ports[i].device;
+			if (!device || !device->getMessageCount())
+				continue;
+
+			const uint64_t portDue = scheduleTime(m_ports[i], device->getNextTimestamp(), rate);
+			if (next < 0 || portDue < due)
+			{
+				next = i;
+				due = portDue;
 			}
-
-			break;
 		}
+		if (next < 0)
+			break;
+
+		if (due > m_samplePos)
+		{
+			m_samplesWait = (uint32_t)std::min<uint64_t>(due - m_samplePos, rate);
+			return m_samplesWait;
 		}
 
+		MidiMessage m;
+		m_ports[next].device->fetchOneMessage(m);
+		playMessage(player, next, m);
+
 		m_lastSleepMode = false;
+		m_lastEventSample = m_samplePos;
+	}
 
-		m_currentTime = m.timestamp;
-		m_currentTimeReal = GetTickCount64();
-		if (nextTimestamp != UINT_MAX) {
-			// ̃^C~OԂ
-			DWORD nextTime = nextTimestamp - m_currentTime;
-			return (uint32_t)((uint64_t)player.sampleRate() * nextTime / 1000);
-		}
-		else {
-			// 邩mȂ̂ōŒZҋ@
-			return 1;
+	// 空っぽなら待機モード 
+	// (idle time on the sample clock, so that playback driven by a simulated clock behaves the same)
+	const uint64_t idleTime = (m_samplePos - m_lastEventSample) * 1000 / rate;
+	if (m_suspendTimeMilliseconds > 0 && idleTime > (uint64_t)m_suspendTimeMilliseconds) {
+		// スリープモード
+		m_lastSleepMode = true;
+		for (auto& port : m_ports)
+			port.anchored = false;
+		return UINT_MAX;
+	}
+	else if (idleTime > 1000) {
+		// 1秒来なければ10msecくらいずれてもいいでしょう
+		// (次のイベントでタイミングを取り直す)
+		for (auto& port : m_ports)
+			port.anchored = false;
+		m_samplesWait = rate / 100;
+	}
+	else {
+		// 次が来るかも知れないので1msec毎に確認
+		// (遅延時間内に拾えばサンプル単位で正確に鳴らせる)
+		m_samplesWait = std::max<uint32_t>(rate / 1000, 1);
+	}
+	return m_samplesWait;
+}
+
+// ----------------------------------------------------------------------------
+void SequenceMIDIIN::playMessage(OPLPlayer& player, unsigned port, const MidiMessage& m)
+{
+	uint8_t status;
+	uint8_t data[2];
+	status = m.data & 0xFF;
+	data[0] = (m.data >> 8) & 0xFF;
+	data[1] = (m.data >> 16) & 0xFF;
+	switch (status >> 4)
+	{
+	case 9: // note on
+		player.midiPortEvent(port, status, data[0], data[1]);
+		break;
+
+	case 8:  // note off
+	case 10: // polyphonic pressure
+	case 11: // controller change
+	case 14: // pitch bend
+		player.midiPortEvent(port, status, data[0], data[1]);
+		break;
+
+	case 12: // program change
+	case 13: // channel pressure (ignored)
+		player.midiPortEvent(port, status, data[0]);
+		break;
+
+	case 15: // sysex / meta event
+	{
+		if (m_ports[port].device->fetchSysEx(m_sysex)) {
+			if (!metaEvent(player, port, m_sysex)) {
+				// end 
+			}
 		}
+
+		break;
+	}
 	}
 }
 
 // ----------------------------------------------------------------------------
-uint32_t SequenceMIDIIN::readVLQ(BYTE* exdata, int &pos, int exdatasize)
+uint32_t SequenceMIDIIN::readVLQ(const uint8_t* exdata, int &pos, int exdatasize)
 {
 	uint32_t vlq = 0;
 	uint8_t data = 0;
@@ -221,22 +345,22 @@ uint32_t SequenceMIDIIN::readVLQ(BYTE* exdata, int &pos, int exdatasize)
 }
 
 // ----------------------------------------------------------------------------
-bool SequenceMIDIIN::metaEvent(OPLPlayer& player, MidiSysEx sysex)
+bool SequenceMIDIIN::metaEvent(OPLPlayer& player, unsigned port, const MidiSysEx& sysex)
 {
 	uint32_t len;
 
-	BYTE exstatus = sysex.data[0];
-	BYTE *exdata = sysex.data.data() + 1;
+	uint8_t exstatus = sysex.data[0];
+	const uint8_t *exdata = sysex.data.data() + 1;
 	int exdatasize = sysex.data.size() - 1;
-	BYTE gmReset[] = { 0x7E, 0x7F, 0x09, 0x01, 0xF7 };
-	BYTE gsReset[] = { 0x41, 0x10, 0x42, 0x12, 0x40, 0x00, 0x7F, 0x00, 0x41, 0xF7 };
+	uint8_t gmReset[] = { 0x7E, 0x7F, 0x09, 0x01, 0xF7 };
+	uint8_t gsReset[] = { 0x41, 0x10, 0x42, 0x12, 0x40, 0x00, 0x7F, 0x00, 0x41, 0xF7 };
 
 	int pos = 0;
 	if (exstatus != 0xFF)
 	{
 		len = readVLQ(exdata, pos, exdatasize);
 		if (exstatus == 0xf0)
-			player.midiSysEx(exdata, exdatasize);
+			player.midiPortSysEx(port, exdata, exdatasize);
 	}
 	else
 	{
@@ -255,11 +379,33 @@ bool SequenceMIDIIN::metaEvent(OPLPlayer& player, MidiSysEx sysex)
 // ----------------------------------------------------------------------------
 std::string SequenceMIDIIN::GetFriendlyName()
 { 
-	return "[MIDI IN] #" + std::to_string(m_portnum) + " " + GetMidiInDeviceName(m_portnum);
+	std::string name = "[MIDI IN] ";
+	for (unsigned i = 0; i < m_ports.size(); i++)
+	{
+		if (i > 0)
+			name += ", ";
+		name += m_ports[i].device ? m_ports[i].device->getName() : m_portSpecs[i];
+	}
+	return name;
 };
 
+// ----------------------------------------------------------------------------
+void SequenceMIDIIN::inputStats(uint32_t& highWater, uint32_t& dropped, bool reset)
+{
+	highWater = dropped = 0;
+	for (auto& port : m_ports)
+	{
+		if (!port.device)
+			continue;
+		highWater = std::max(highWater, port.device->getHighWater(reset));
+		dropped += port.device->getDroppedMessages() + port.device->getDroppedSysEx();
+	}
+}
+
 // ----------------------------------------------------------------------------
 void* SequenceMIDIIN::getWakeupEvent()
 {
-	return m_midiIn.getWakeupEvent();
+	if (m_ports.empty() || !m_ports[0].device)
+		return nullptr;
+	return m_ports[0].device->getWakeupEvent();
 }
\ No newline at end of file
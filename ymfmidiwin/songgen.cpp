@@ -0,0 +1,420 @@
+#include "songgen.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+
+// ----------------------------------------------------------------------------
+void putU16LE(std::vector<uint8_t>& data, size_t pos, uint16_t value)
+{
+	data[pos]     = value & 0xff;
+	data[pos + 1] = value >> 8;
+}
+
+// ----------------------------------------------------------------------------
+void putU32LE(std::vector<uint8_t>& data, size_t pos, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		data[pos + i] = (value >> (i * 8)) & 0xff;
+}
+
+// ----------------------------------------------------------------------------
+void appendU32BE(std::vector<uint8_t>& data, uint32_t value)
+{
+	for (int i = 3; i >= 0; i--)
+		data.push_back((value >> (i * 8)) & 0xff);
+}
+
+// ----------------------------------------------------------------------------
+void appendBytes(std::vector<uint8_t>& data, const char *bytes, size_t size)
+{
+	data.insert(data.end(), bytes, bytes + size);
+}
+
+// ----------------------------------------------------------------------------
+// MIDI style variable length quantity (most significant group first)
+void appendVLQ(std::vector<uint8_t>& data, uint32_t value)
+{
+	uint8_t bytes[5];
+	int count = 0;
+	do
+	{
+		bytes[count++] = value & 0x7f;
+		value >>= 7;
+	} while (value);
+
+	while (count--)
+		data.push_back(bytes[count] | (count ? 0x80 : 0));
+}
+
+// ----------------------------------------------------------------------------
+// MIDI message without the status byte's running status
+void appendMessage(std::vector<uint8_t>& data, const SongEvent& event)
+{
+	data.push_back(event.status);
+	if (event.status == 0xf0)
+	{
+		appendVLQ(data, (uint32_t)event.sysex.size());
+		data.insert(data.end(), event.sysex.begin(), event.sysex.end());
+		return;
+	}
+	data.push_back(event.data0);
+	if ((event.status >> 4) != 12 && (event.status >> 4) != 13)
+		data.push_back(event.data1);
+}
+
+// ----------------------------------------------------------------------------
+bool isNoteOn(const SongEvent& event)
+{
+	return (event.status >> 4) == 9 && event.data1;
+}
+
+// ----------------------------------------------------------------------------
+// time of the last note-off (or event)
+uint32_t endTime(const std::vector<SongEvent>& events)
+{
+	uint32_t end = 0;
+	for (auto& event : events)
+		end = std::max(end, event.time + (isNoteOn(event) ? event.duration : 0));
+	return end;
+}
+
+// ----------------------------------------------------------------------------
+// track data shared by MID, HMI and HMP: a delay before each event, then the end of track
+// (XMI/HMI style note durations if 'durations' is set)
+std::vector<uint8_t> writeTrack(const std::vector<SongEvent>& events, bool durations,
+	void (*appendDelay)(std::vector<uint8_t>&, uint32_t))
+{
+	std::vector<uint8_t> data;
+	uint32_t time = 0;
+
+	for (auto& event : durations ? events : songMessages(events))
+	{
+		appendDelay(data, event.time - time);
+		appendMessage(data, event);
+		if (durations && isNoteOn(event))
+			appendVLQ(data, event.duration);
+		time = event.time;
+	}
+
+	appendDelay(data, endTime(events) - time);
+	appendBytes(data, "\xff\x2f\x00", 3);
+	return data;
+}
+
+// ----------------------------------------------------------------------------
+// HMP delays: least significant group first, the last byte has the high bit set
+void appendHMPDelay(std::vector<uint8_t>& data, uint32_t value)
+{
+	while (value >= 0x80)
+	{
+		data.push_back(value & 0x7f);
+		value >>= 7;
+	}
+	data.push_back(value | 0x80);
+}
+
+// ----------------------------------------------------------------------------
+std::vector<uint8_t> writeMID(const std::vector<SongEvent>& events)
+{
+	// 60 ticks per beat at the default 120 bpm
+	std::vector<uint8_t> track;
+	appendBytes(track, "\x00\xff\x51\x03\x07\xa1\x20", 7);
+	const std::vector<uint8_t> body = writeTrack(events, false, appendVLQ);
+	track.insert(track.end(), body.begin(), body.end());
+
+	std::vector<uint8_t> data;
+	appendBytes(data, "MThd\x00\x00\x00\x06\x00\x00\x00\x01\x00\x3c", 14);
+	appendBytes(data, "MTrk", 4);
+	appendU32BE(data, (uint32_t)track.size());
+	data.insert(data.end(), track.begin(), track.end());
+	return data;
+}
+
+// ----------------------------------------------------------------------------
+std::vector<uint8_t> writeXMI(const std::vector<SongEvent>& events)
+{
+	// XMI delays: a series of bytes < 0x80 added together (any but the last one are 0x7f),
+	// no delay at all before the first event
+	std::vector<uint8_t> evnt;
+	uint32_t time = 0;
+	auto appendDelay = [&](uint32_t delay)
+	{
+		for (; delay >= 0x7f; delay -= 0x7f)
+			evnt.push_back(0x7f);
+		if (delay)
+			evnt.push_back(delay);
+	};
+
+	for (auto& event : events)
+	{
+		appendDelay(event.time - time);
+		appendMessage(evnt, event);
+		if (isNoteOn(event))
+			appendVLQ(evnt, event.duration);
+		time = event.time;
+	}
+	appendDelay(endTime(events) - time);
+	appendBytes(evnt, "\xff\x2f\x00", 3);
+	if (evnt.size() & 1)
+		evnt.push_back(0);
+
+	std::vector<uint8_t> data;
+	// FORM XDIR with the number of songs
+	appendBytes(data, "FORM", 4);
+	appendU32BE(data, 14);
+	appendBytes(data, "XDIRINFO\x00\x00\x00\x02\x01\x00", 14);
+	// CAT XMID with one FORM XMID
+	appendBytes(data, "CAT ", 4);
+	appendU32BE(data, (uint32_t)evnt.size() + 24);
+	appendBytes(data, "XMIDFORM", 8);
+	appendU32BE(data, (uint32_t)evnt.size() + 12);
+	appendBytes(data, "XMIDEVNT", 8);
+	appendU32BE(data, (uint32_t)evnt.size());
+	data.insert(data.end(), evnt.begin(), evnt.end());
+	return data;
+}
+
+// ----------------------------------------------------------------------------
+std::vector<uint8_t> writeMUS(const std::vector<SongEvent>& events)
+{
+	// MUS channels 0-8 and 9-14 are MIDI channels 1-9 and 11-16, 15 is percussion
+	auto musChannel = [](uint8_t channel)
+	{
+		if (channel == 9)
+			return 15;
+		return channel > 9 ? channel - 1 : (int)channel;
+	};
+	// MIDI controllers MUS has
+	static const uint8_t controllers[10] = { 0xff, 0, 1, 7, 10, 11, 91, 93, 64, 67 };
+	static const uint8_t modes[5] = { 120, 123, 126, 127, 121 };
+
+	// events of one time are a group, the last one is flagged and followed by the delay
+	std::vector<uint8_t> score;
+	size_t lastEvent = 0;
+	uint32_t lastTime = 0;
+	bool pending = false;
+	auto finishGroup = [&](uint32_t musTime)
+	{
+		if (pending && musTime > lastTime)
+		{
+			score[lastEvent] |= 0x80;
+			appendVLQ(score, musTime - lastTime);
+			lastTime = musTime;
+			pending = false;
+		}
+	};
+
+	for (auto& event : songMessages(events))
+	{
+		const uint32_t musTime = (uint32_t)((uint64_t)event.time * 140 / songTicksPerSecond);
+		finishGroup(musTime);
+
+		const uint8_t channel = musChannel(event.status & 15);
+		const size_t pos = score.size();
+		switch (event.status >> 4)
+		{
+		case 8:
+			score.push_back(0x00 | channel);
+			score.push_back(event.data0);
+			break;
+
+		case 9:
+			if (!event.data1)
+			{
+				score.push_back(0x00 | channel);
+				score.push_back(event.data0);
+			}
+			else
+			{
+				score.push_back(0x10 | channel);
+				score.push_back(event.data0 | 0x80);
+				score.push_back(event.data1);
+			}
+			break;
+
+		case 11:
+			for (uint8_t i = 0; i < 5; i++)
+			{
+				if (modes[i] == event.data0)
+				{
+					score.push_back(0x30 | channel);
+					score.push_back(10 + i);
+				}
+			}
+			for (uint8_t i = 1; i < 10; i++)
+			{
+				if (controllers[i] == event.data0)
+				{
+					score.push_back(0x40 | channel);
+					score.push_back(i);
+					score.push_back(event.data1);
+				}
+			}
+			break;
+
+		case 12:
+			score.push_back(0x40 | channel);
+			score.push_back(0);
+			score.push_back(event.data0);
+			break;
+
+		case 14:
+			score.push_back(0x20 | channel);
+			score.push_back(((event.data1 << 7) | event.data0) >> 6);
+			break;
+
+		default:
+			break;
+		}
+
+		if (score.size() > pos)
+		{
+			lastEvent = pos;
+			pending = true;
+		}
+	}
+	finishGroup((uint32_t)((uint64_t)endTime(events) * 140 / songTicksPerSecond));
+	score.push_back(0x60); // end of score
+
+	std::vector<uint8_t> data(16, 0);
+	memcpy(data.data(), "MUS\x1a", 4);
+	putU16LE(data, 4, (uint16_t)score.size());
+	putU16LE(data, 6, 16);
+	putU16LE(data, 8, 16); // primary channels
+	data.insert(data.end(), score.begin(), score.end());
+	return data;
+}
+
+// ----------------------------------------------------------------------------
+std::vector<uint8_t> writeHMI(const std::vector<SongEvent>& events)
+{
+	static const uint32_t trackTable = 0x100;
+	static const uint32_t trackOffset = 0x110;
+	static const uint32_t trackHeader = 0x5b;
+
+	const std::vector<uint8_t> track = writeTrack(events, true, appendVLQ);
+
+	std::vector<uint8_t> data(trackOffset + trackHeader, 0);
+	memcpy(data.data(), "HMI-MIDISONG061595", 18);
+	putU16LE(data, 0xd2, 60);
+	putU16LE(data, 0xd4, songTicksPerSecond);
+	putU32LE(data, 0xe4, 1);
+	putU32LE(data, 0xe8, trackTable);
+	putU32LE(data, trackTable, trackOffset);
+
+	memcpy(data.data() + trackOffset, "HMI-MIDITRACK", 13);
+	putU32LE(data, trackOffset + 0x57, trackHeader);
+	data.insert(data.end(), track.begin(), track.end());
+	return data;
+}
+
+// ----------------------------------------------------------------------------
+std::vector<uint8_t> writeHMP(const std::vector<SongEvent>& events)
+{
+	static const uint32_t trackOffset = 0x308;
+
+	const std::vector<uint8_t> track = writeTrack(events, false, appendHMPDelay);
+
+	std::vector<uint8_t> data(trackOffset + 12, 0);
+	memcpy(data.data(), "HMIMIDIP", 8);
+	putU32LE(data, 0x30, 1);
+	putU32LE(data, 0x34, 60);
+	putU32LE(data, 0x38, songTicksPerSecond);
+	putU32LE(data, trackOffset + 4, (uint32_t)track.size() + 12);
+	data.insert(data.end(), track.begin(), track.end());
+	return data;
+}
+
+} // namespace
+
+// ----------------------------------------------------------------------------
+const char* songFormatName(SongFormat format)
+{
+	static const char *names[NumSongFormats] = { "mid", "xmi", "mus", "hmi", "hmp" };
+	return names[format];
+}
+
+// ----------------------------------------------------------------------------
+std::vector<uint8_t> writeSong(const std::vector<SongEvent>& events, SongFormat format)
+{
+	switch (format)
+	{
+	case SongMID: return writeMID(events);
+	case SongXMI: return writeXMI(events);
+	case SongMUS: return writeMUS(events);
+	case SongHMI: return writeHMI(events);
+	case SongHMP: return writeHMP(events);
+	default:      return std::vector<uint8_t>();
+	}
+}
+
+// ----------------------------------------------------------------------------
+// (at the same time, note-offs go first)
+std::vector<SongEvent> songMessages(const std::vector<SongEvent>& events)
+{
+	std::vector<SongEvent> out;
+	for (auto& event : events)
+	{
+		out.push_back(event);
+		if (isNoteOn(event))
+			out.push_back({ event.time + event.duration, (uint8_t)(0x80 | (event.status & 15)), event.data0, 0, 0, {} });
+	}
+
+	std::stable_sort(out.begin(), out.end(), [](const SongEvent& a, const SongEvent& b)
+	{
+		if (a.time != b.time)
+			return a.time < b.time;
+		return (a.status >> 4) == 8 && (b.status >> 4) != 8;
+	});
+	return out;
+}
+
+// ----------------------------------------------------------------------------
+std::vector<SongEvent> makeTestSong(unsigned bars)
+{
+	static const uint32_t step = songTicksPerSecond / 8; // 16th note
+
+	std::vector<SongEvent> events;
+	for (uint8_t ch = 0; ch < 16; ch++)
+	{
+		// one of every few GM programs, drums on channel 10
+		if (ch != 9)
+			events.push_back({ 0, (uint8_t)(0xc0 | ch), (uint8_t)(ch * 8), 0, 0, {} });
+		events.push_back({ 0, (uint8_t)(0xb0 | ch), 7, 100, 0, {} });
+		events.push_back({ 0, (uint8_t)(0xb0 | ch), 10, (uint8_t)(ch * 8), 0, {} });
+	}
+
+	for (unsigned s = 0; s < bars * 16; s++)
+	{
+		const uint32_t time = s * step;
+		for (unsigned i = 0; i < 4; i++)
+		{
+			const uint8_t ch = (s * 4 + i) % 16;
+			const uint8_t note = (ch == 9) ? 35 + (s + i) % 47 : 36 + (s * 7 + i * 12) % 48;
+			const uint32_t duration = (ch == 9) ? step / 2 : step * 16 - 1;
+			events.push_back({ time, (uint8_t)(0x90 | ch), note, (uint8_t)(64 + (s * 13) % 64), duration, {} });
+		}
+
+		const unsigned bend = 8192 + (s % 16) * 256;
+		events.push_back({ time, 0xe0, (uint8_t)(bend & 0x7f), (uint8_t)(bend >> 7), 0, {} });
+	}
+	return events;
+}
+
+// ----------------------------------------------------------------------------
+unsigned songEventCount(const std::vector<SongEvent>& events)
+{
+	unsigned count = 0;
+	for (auto& event : events)
+		count += isNoteOn(event) ? 2 : 1;
+	return count;
+}
+
+// ----------------------------------------------------------------------------
+double songLength(const std::vector<SongEvent>& events)
+{
+	return (double)endTime(events) / songTicksPerSecond;
+}
@@ -0,0 +1,47 @@
+#ifndef __SONGGEN_H
+#define __SONGGEN_H
+
+#include <cstdint>
+#include <vector>
+
+// generated songs, written in any of the supported formats (for benchmarks and regression tests)
+
+// event times are in ticks of 1/120 second, the native rate of XMI, HMI and HMP
+static const unsigned songTicksPerSecond = 120;
+
+struct SongEvent
+{
+	uint32_t time;
+	uint8_t status, data0, data1;
+	uint32_t duration; // note-ons only: ticks until the note-off
+	std::vector<uint8_t> sysex; // status 0xf0 only: the data after the 0xf0 (not written to MUS)
+};
+
+enum SongFormat
+{
+	SongMID, // standard MIDI file, format 0
+	SongXMI,
+	SongMUS, // (at 140 ticks per second; controllers MUS doesn't have are left out)
+	SongHMI,
+	SongHMP,
+	NumSongFormats
+};
+
+// file extension, without the dot
+const char* songFormatName(SongFormat format);
+
+// 'events' must be sorted by time
+std::vector<uint8_t> writeSong(const std::vector<SongEvent>& events, SongFormat format);
+
+// the same events with a separate note-off after each note-on, in the order they are played
+std::vector<SongEvent> songMessages(const std::vector<SongEvent>& events);
+
+// test pattern: every channel with its own program, volume and panning, 4 notes starting every
+// 16th note at 120 bpm (each held for a bar, drums shorter), a pitch bend sweep on channel 1
+std::vector<SongEvent> makeTestSong(unsigned bars);
+
+// number of MIDI events (including note-offs) and length of a song in seconds
+unsigned songEventCount(const std::vector<SongEvent>& events);
+double songLength(const std::vector<SongEvent>& events);
+
+#endif // __SONGGEN_H
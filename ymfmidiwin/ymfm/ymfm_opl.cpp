@@ -1419,6 +1419,28 @@ void ymf262::generate(output_data *output, uint32_t numsamples, int32_t* lpHasda
 }
 
 
+//-------------------------------------------------
+//  generate_channels - generate samples of sound
+//  with the channels split into separate groups
+//-------------------------------------------------
+
+void ymf262::generate_channels(output_data *output, uint32_t numsamples, uint32_t const *chanmasks, uint32_t numgroups)
+{
+	for (uint32_t samp = 0; samp < numsamples; samp++)
+	{
+		// clock the system
+		m_fm.clock(fm_engine::ALL_CHANNELS);
+
+		// update the FM content once per group
+		for (uint32_t group = 0; group < numgroups; group++, output++)
+		{
+			m_fm.output(output->clear(), 0, 32767, chanmasks[group]);
+			output->clamp16();
+		}
+	}
+}
+
+
 
 //*********************************************************
 //  YMF289B
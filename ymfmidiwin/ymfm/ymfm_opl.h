@@ -670,7 +670,19 @@ public:
 	// generate samples of sound
 	void generate(output_data *output, uint32_t numsamples = 1, int32_t* lpHasdata = nullptr);
 
+	// generate samples of sound, split into 'numgroups' outputs per sample;
+	// output[samp * numgroups + group] receives the channels set in chanmasks[group]
+	void generate_channels(output_data *output, uint32_t numsamples, uint32_t const *chanmasks, uint32_t numgroups);
+
+	// envelope of the operator at register offset 'opoffs' (0x00-0x15, 0x100-0x115): its state
+	// and attenuation (4.6 format, 0x3ff = silent; without total level and LFO)
+	envelope_state debug_eg_state(uint32_t opoffs) const { return m_fm.debug_operator(operator_number(opoffs))->debug_eg_state(); }
+	uint16_t debug_eg_attenuation(uint32_t opoffs) const { return m_fm.debug_operator(operator_number(opoffs))->debug_eg_attenuation(); }
+
 protected:
+	// inverse of opl_registers_base::operator_offset
+	static uint32_t operator_number(uint32_t opoffs) { return (opoffs & 0xff) - 2 * ((opoffs & 0xff) / 8) + 18 * (opoffs >> 8); }
+
 	// internal state
 	uint16_t m_address;              // address register
 	fm_engine m_fm;                  // core FM engine